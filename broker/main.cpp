@@ -0,0 +1,719 @@
+//=================================================================================================
+// main.cpp - A daemon that shares the Sidewinders in a machine between unprivileged processes
+//
+// Mapping a card's BARs normally needs root, and nothing stops two benchmarks from driving the
+// same measure_bw engine at the same time.  The broker runs as root, finds every Sidewinder,
+// and serves requests on a Unix socket (see Broker.h).  It hands out open "resourceN" files so
+// clients can map BARs themselves, relays the eventfds of each card's interrupt driver, and
+// gives each measure_bw engine to one client connection at a time
+//=================================================================================================
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <poll.h>
+#include <grp.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include "Broker.h"
+#include "IrqSocket.h"
+#include "PciDevice.h"
+#include "RegisterBlock.h"
+
+using namespace std;
+
+void parseCommandLine(const char** argv);
+void signalHandler(int sigNumber);
+void findCards();
+int  createSocket();
+void serve(int listener);
+void handleRequest(int client, const brokerRequest_t& request);
+void openBar(int client, const brokerRequest_t& request);
+void openIrqs(int client, const brokerRequest_t& request);
+void lockEngines(int client, const brokerRequest_t& request);
+void unlockEngines(int client, uint32_t card, uint64_t engines);
+void grantWaiters();
+void checkPending();
+void dropClient(int client);
+
+// Configuration parameters from the command line
+struct conf_t
+{
+    string         device;
+    string         socketName;
+    string         group;
+    bool           world;
+    vector<string> dirName;
+    bool           verbose;
+} conf;
+
+// Register map of the "measure_bw" RTL core that matters to us: its status register
+enum {REG_CTL_STAT = 10};
+
+// This is the longest we'll wait for an engine that its last owner left running
+const int IDLE_TIMEOUT_MS = 10000;
+
+// While we're waiting for engines to go idle, this is how often we look at them
+const int IDLE_POLL_MS = 1;
+
+// This describes one card we own
+struct card_t
+{
+    pciFunction_t         function;
+    unique_ptr<PciDevice> pci;
+    string                dirName;      // Where the card's interrupt driver keeps its socket
+    int                   owner[64];    // The client that owns each engine, or -1
+};
+
+// These are the cards we own
+vector<card_t> cards;
+
+// This is a lock request that's waiting for engines that are in use
+struct waiter_t {int client; uint32_t card; uint64_t engines;};
+deque<waiter_t> waiters;
+
+// This is a lock we've granted whose engines are still running a measurement their last owner
+// left behind.  The client isn't told it has them until they go idle (or "deadline" passes)
+struct pending_t {int client; uint32_t card; uint64_t engines; uint64_t deadline;};
+vector<pending_t> pending;
+
+//=================================================================================================
+// main() - Execution starts here
+//=================================================================================================
+int main(int argc, const char** argv)
+{
+    // Set some default configuration parameters
+    conf.device     = "10ee:903f";
+    conf.socketName = BROKER_SOCKET;
+    conf.world      = false;
+    conf.verbose    = false;
+
+    // Tell Linux which signals we'd like to handle
+    signal(SIGINT,  signalHandler);
+    signal(SIGTERM, signalHandler);
+
+    // Parse configuration parameters from the command line
+    parseCommandLine(argv);
+
+    // If we're not running with root priveleges, give up
+    if (geteuid() != 0)
+    {
+        fprintf(stderr, "Must be root to run.  Use sudo.\n");
+        exit(1);
+    }
+
+    // Find and map every card we're going to share
+    findCards();
+
+    // Create the socket that clients connect to, and serve them until we're killed
+    serve(createSocket());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// findCards() - Finds and maps every card with the configured vendor and device ID
+//=================================================================================================
+void findCards()
+{
+    // Find the colon in the device name
+    const char* colon = strchr(conf.device.c_str(), ':');
+
+    // If there was no colon in the device name, we fail
+    if (colon == nullptr)
+    {
+        fprintf(stderr, "Malformed device name %s\n", conf.device.c_str());
+        exit(1);
+    }
+
+    // Extract the vendor ID and device ID from the device name
+    int vendorID = strtoul(conf.device.c_str(), nullptr, 16);
+    int deviceID = strtoul(colon + 1, nullptr, 16);
+
+    // Map every card with those IDs.  We keep BAR0 mapped so we can tell when an engine is idle.
+    // Clients map BAR1 for themselves, so we never do
+    for (auto& function : findPciDevices(vendorID, deviceID))
+    {
+        card_t card;
+        card.function = function;
+        card.pci.reset(new PciDevice);
+        card.pci->setLazy(1);
+        if (cards.size() < conf.dirName.size()) card.dirName = conf.dirName[cards.size()];
+
+        try
+        {
+            card.pci->open(function);
+        }
+        catch(const exception& e)
+        {
+            fprintf(stderr, "%s: %s\n", function.bdf.c_str(), e.what());
+            exit(1);
+        }
+
+        for (auto& owner : card.owner) owner = -1;
+        printf("card %d: %s\n", (int)cards.size(), function.bdf.c_str());
+        cards.push_back(move(card));
+    }
+
+    // If there are no cards, there's nothing to share
+    if (cards.empty())
+    {
+        fprintf(stderr, "No %s cards found\n", conf.device.c_str());
+        exit(1);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// createSocket() - Creates the socket that clients connect to, and returns its file descriptor
+//
+// A client gets BAR0 of a card, and with it the card's DMA engines, which can read and write any
+// host memory.  So by default only root can connect.  With "-group", members of that group can
+// too, and with "-world", any local user can
+//=================================================================================================
+int createSocket()
+{
+    sockaddr_un addr;
+
+    // If the socket name won't fit in a socket address, there's no way to create it
+    if (conf.socketName.size() >= sizeof addr.sun_path)
+    {
+        fprintf(stderr, "Socket name %s is too long\n", conf.socketName.c_str());
+        exit(1);
+    }
+
+    // Build the address of the socket
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, conf.socketName.c_str());
+
+    // Get rid of any socket a previous run left behind, and create ours
+    unlink(conf.socketName.c_str());
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || bind(sock, (sockaddr*)&addr, sizeof addr) != 0 || listen(sock, 16) != 0)
+    {
+        perror(conf.socketName.c_str());
+        exit(1);
+    }
+
+    // Decide who is allowed to connect
+    if (conf.world)
+        chmod(conf.socketName.c_str(), 0666);
+    else if (conf.group.empty())
+        chmod(conf.socketName.c_str(), 0600);
+    else
+    {
+        group* grp = getgrnam(conf.group.c_str());
+        if (grp == nullptr || chown(conf.socketName.c_str(), 0, grp->gr_gid) != 0)
+        {
+            fprintf(stderr, "Can't give group %s access to %s\n", conf.group.c_str(), conf.socketName.c_str());
+            exit(1);
+        }
+        chmod(conf.socketName.c_str(), 0660);
+    }
+
+    // Hand the caller the socket
+    return sock;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// serve() - Accepts client connections and answers their requests, forever
+//
+// Every request is answered quickly, so a single thread serves every client.  The exceptions are
+// a lock request for engines that are in use, which waits in "waiters" until they're released,
+// and a granted lock whose engines are still running, which waits in "pending" until they go
+// idle.  While any lock is pending, we wake up every IDLE_POLL_MS to look at its engines
+//=================================================================================================
+void serve(int listener)
+{
+    vector<pollfd> pfd = {{listener, POLLIN, 0}};
+    brokerRequest_t request;
+    int fd[BROKER_MAX_FDS];
+
+    while (true)
+    {
+        // Wait for a new connection, or for a client to say something
+        if (poll(pfd.data(), pfd.size(), pending.empty() ? -1 : IDLE_POLL_MS) < 0)
+        {
+            if (errno == EINTR) continue;
+            perror("poll");
+            exit(1);
+        }
+
+        // Tell the clients whose engines have gone idle that they have them
+        checkPending();
+
+        // If there's a new client, start listening to it
+        if (pfd[0].revents & POLLIN)
+        {
+            int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0)
+            {
+                ucred cred;
+                socklen_t length = sizeof cred;
+                if (conf.verbose && getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &length) == 0)
+                {
+                    printf("client %d connected: pid %d, uid %d\n", client, cred.pid, cred.uid);
+                }
+                pfd.push_back({client, POLLIN, 0});
+            }
+        }
+
+        // Answer every client that sent us a request, and forget the ones that hung up
+        for (int i = pfd.size() - 1; i > 0; --i)
+        {
+            if (pfd[i].revents == 0) continue;
+            int client = pfd[i].fd;
+
+            // Clients never send us file descriptors, but if they do, don't leak them
+            int fdCount = brokerReceive(client, &request, sizeof request, fd);
+            for (int j=0; j<fdCount; ++j) close(fd[j]);
+
+            if (fdCount >= 0)
+                handleRequest(client, request);
+            else
+            {
+                dropClient(client);
+                pfd.erase(pfd.begin() + i);
+            }
+        }
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// reply() - Sends a reply to a client, and closes our copies of any file descriptors attached
+//=================================================================================================
+static void reply(int client, brokerReply_t& response, const int* fd = nullptr, int fdCount = 0)
+{
+    brokerSend(client, &response, sizeof response, fd, fdCount);
+    for (int i=0; i<fdCount; ++i) close(fd[i]);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// handleRequest() - Answers one request from a client
+//=================================================================================================
+void handleRequest(int client, const brokerRequest_t& request)
+{
+    brokerReply_t response;
+    memset(&response, 0, sizeof response);
+
+    // Every request names a card, and it has to be one we own
+    response.count = cards.size();
+    if (request.card >= cards.size())
+    {
+        response.status = ENODEV;
+        reply(client, response);
+        return;
+    }
+
+    switch (request.op)
+    {
+        case BROKER_LIST:
+            strncpy(response.bdf, cards[request.card].function.bdf.c_str(), sizeof response.bdf - 1);
+            reply(client, response);
+            break;
+
+        case BROKER_OPEN_BAR:
+            openBar(client, request);
+            break;
+
+        case BROKER_OPEN_IRQS:
+            openIrqs(client, request);
+            break;
+
+        case BROKER_LOCK:
+            lockEngines(client, request);
+            break;
+
+        case BROKER_UNLOCK:
+            unlockEngines(client, request.card, request.engines);
+            reply(client, response);
+            grantWaiters();
+            break;
+
+        default:
+            response.status = EINVAL;
+            reply(client, response);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// openBar() - Hands a client an open "resourceN" file for one of a card's mappable resources.
+//             A write-combining mapping is handed out if the client asks for it and the kernel
+//             offers it
+//=================================================================================================
+void openBar(int client, const brokerRequest_t& request)
+{
+    brokerReply_t response;
+    memset(&response, 0, sizeof response);
+
+    card_t& card     = cards[request.card];
+    auto&   resource = card.pci->resourceList();
+    strncpy(response.bdf, card.function.bdf.c_str(), sizeof response.bdf - 1);
+
+    // If the card doesn't have that many resources, tell the client
+    if (request.index >= resource.size())
+    {
+        response.status = ENOENT;
+        reply(client, response);
+        return;
+    }
+
+    // Open the sysfs file for the resource
+    auto&  bar      = resource[request.index];
+    string filename = card.function.dir + "/resource" + to_string(bar.index);
+    int    fd       = -1;
+    if (request.flags & BROKER_WC) fd = open((filename + "_wc").c_str(), O_RDWR | O_CLOEXEC);
+    if (fd >= 0) response.flags = BROKER_WC;
+    if (fd < 0) fd = open(filename.c_str(), O_RDWR | O_CLOEXEC);
+
+    // Describe the resource to the client, and hand it the file
+    response.status   = (fd < 0) ? errno : 0;
+    response.index    = bar.index;
+    response.size     = bar.size;
+    response.physAddr = bar.physAddr;
+    reply(client, response, &fd, fd < 0 ? 0 : 1);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// openIrqs() - Fetches the eventfds (and event ring) from a card's interrupt driver and relays
+//              them to a client, so the client doesn't need access to the driver's directory
+//=================================================================================================
+void openIrqs(int client, const brokerRequest_t& request)
+{
+    irqSocketMsg_t message;
+    brokerReply_t  response;
+    int            fd[IRQ_SOCKET_MAX_IRQS + 1];
+    int            fdCount = -1;
+
+    memset(&response, 0, sizeof response);
+    card_t& card = cards[request.card];
+    strncpy(response.bdf, card.function.bdf.c_str(), sizeof response.bdf - 1);
+
+    // Ask the card's interrupt driver for its file descriptors
+    if (!card.dirName.empty())
+    {
+        fdCount = receiveIrqFDs(card.dirName + "/" + IRQ_SOCKET_NAME, &message, fd);
+    }
+
+    // And pass them along
+    response.status = (fdCount < 0) ? ENOENT : 0;
+    response.count  = (fdCount < 0) ? 0 : message.irqCount;
+    response.flags  = (fdCount < 0) ? 0 : message.flags;
+    reply(client, response, fd, fdCount < 0 ? 0 : fdCount);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// isFree() - Returns true if none of the specified engines on a card belong to a client
+//=================================================================================================
+static bool isFree(const card_t& card, uint64_t engines)
+{
+    for (int i=0; i<64; ++i)
+    {
+        if ((engines & (1ULL << i)) && card.owner[i] >= 0) return false;
+    }
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// msNow() - Returns the current time in milliseconds
+//=================================================================================================
+static uint64_t msNow()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// runningEngines() - Returns the subset of the specified engines on a card that are still in the
+//                    middle of a measurement
+//=================================================================================================
+static uint64_t runningEngines(const card_t& card, uint64_t engines)
+{
+    uint8_t* bar0    = card.pci->resourceList()[0].baseAddr;
+    size_t   size    = card.pci->resourceList()[0].size;
+    uint64_t running = 0;
+
+    for (int i=0; i<64; ++i)
+    {
+        if (!(engines & (1ULL << i))) continue;
+
+        // If this engine's registers are beyond BAR0, there's nothing to wait for
+        if ((i + 1) * 0x1000ULL > size) continue;
+        RegisterBlock regs(bar0, i * 0x1000);
+        if (regs.read<REG_CTL_STAT>() & 3) running |= (1ULL << i);
+    }
+
+    return running;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// tellOwner() - Tells a client whether its lock request has been granted
+//=================================================================================================
+static void tellOwner(int client, uint32_t card, uint64_t engines, int status)
+{
+    brokerReply_t response;
+    memset(&response, 0, sizeof response);
+    strncpy(response.bdf, cards[card].function.bdf.c_str(), sizeof response.bdf - 1);
+    response.status = status;
+
+    if (conf.verbose && status == 0)
+        printf("client %d owns engines 0x%lx on card %u\n", client, engines, card);
+    if (conf.verbose && status != 0)
+        printf("engines 0x%lx on card %u never went idle; client %d told they're busy\n", engines, card, client);
+
+    reply(client, response);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// grant() - Gives a set of engines to a client and tells the client it has them
+//
+// If an engine's previous owner disconnected in the middle of a measurement, the engine is still
+// running, and the new owner's first measurement would be wrong.  So the engines are set aside for
+// the client right away, but if any of them are running, the client isn't told until they've all
+// gone idle.  That happens in checkPending(), so that nobody else waits while we do
+//=================================================================================================
+static void grant(int client, uint32_t card, uint64_t engines)
+{
+    for (int i=0; i<64; ++i)
+    {
+        if (engines & (1ULL << i)) cards[card].owner[i] = client;
+    }
+
+    if (runningEngines(cards[card], engines))
+        pending.push_back({client, card, engines, msNow() + IDLE_TIMEOUT_MS});
+    else
+        tellOwner(client, card, engines, 0);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// checkPending() - Tells the owner of each pending lock that it has its engines once they've all
+//                  gone idle.  If they're still running after IDLE_TIMEOUT_MS, the engines are
+//                  taken back and the client is told they're busy
+//=================================================================================================
+void checkPending()
+{
+    bool released = false;
+
+    for (auto it = pending.begin(); it != pending.end();)
+    {
+        if (runningEngines(cards[it->card], it->engines) == 0)
+            tellOwner(it->client, it->card, it->engines, 0);
+        else if (msNow() >= it->deadline)
+        {
+            unlockEngines(it->client, it->card, it->engines);
+            tellOwner(it->client, it->card, it->engines, EBUSY);
+            released = true;
+        }
+        else
+        {
+            ++it;
+            continue;
+        }
+
+        it = pending.erase(it);
+    }
+
+    // If we took engines back, someone else may be waiting for them
+    if (released) grantWaiters();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// lockEngines() - Gives a client exclusive use of some engines.  If any of them are in use, the
+//                 client either waits its turn (BROKER_WAIT) or is told EBUSY
+//=================================================================================================
+void lockEngines(int client, const brokerRequest_t& request)
+{
+    card_t& card = cards[request.card];
+
+    // Engines that are free and that nobody is queued for are the client's right away
+    bool queued = false;
+    for (auto& waiter : waiters)
+    {
+        if (waiter.card == request.card && (waiter.engines & request.engines)) queued = true;
+    }
+
+    if (!queued && isFree(card, request.engines))
+    {
+        grant(client, request.card, request.engines);
+        return;
+    }
+
+    // Otherwise, either wait in line or tell the client they're busy
+    if (request.flags & BROKER_WAIT)
+    {
+        waiters.push_back({client, request.card, request.engines});
+        return;
+    }
+
+    brokerReply_t response;
+    memset(&response, 0, sizeof response);
+    response.status = EBUSY;
+    reply(client, response);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// unlockEngines() - Takes back whichever of the specified engines a client owns
+//=================================================================================================
+void unlockEngines(int client, uint32_t card, uint64_t engines)
+{
+    for (int i=0; i<64; ++i)
+    {
+        if ((engines & (1ULL << i)) && cards[card].owner[i] == client) cards[card].owner[i] = -1;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// grantWaiters() - Hands engines to the clients waiting for them, in the order they asked.  A
+//                  waiter never jumps ahead of an earlier one that wants any of the same engines
+//=================================================================================================
+void grantWaiters()
+{
+    vector<uint64_t> blocked(cards.size(), 0);
+
+    for (auto it = waiters.begin(); it != waiters.end();)
+    {
+        if ((it->engines & blocked[it->card]) == 0 && isFree(cards[it->card], it->engines))
+        {
+            grant(it->client, it->card, it->engines);
+            it = waiters.erase(it);
+        }
+        else
+        {
+            blocked[it->card] |= it->engines;
+            ++it;
+        }
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// dropClient() - Forgets a client that has disconnected, and gives its engines to whoever is next
+//=================================================================================================
+void dropClient(int client)
+{
+    // Take back every engine the client owned
+    for (int card = 0; card < cards.size(); ++card) unlockEngines(client, card, ~0ULL);
+
+    // And forget any lock requests it had waiting
+    for (auto it = waiters.begin(); it != waiters.end();)
+    {
+        if (it->client == client) it = waiters.erase(it); else ++it;
+    }
+    for (auto it = pending.begin(); it != pending.end();)
+    {
+        if (it->client == client) it = pending.erase(it); else ++it;
+    }
+
+    if (conf.verbose) printf("client %d disconnected\n", client);
+    close(client);
+    grantWaiters();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// showHelp() - Displays some help text
+//=================================================================================================
+void showHelp()
+{
+    printf("broker [-device <vendorID:deviceID>] [-socket <name>] [-group <name> | -world]\n");
+    printf("       [-dir <interrupt driver directory>]... [-verbose]\n");
+    printf("\n");
+    printf("Give \"-dir\" once per card, in card order\n");
+    printf("Without \"-group\" or \"-world\", only root can connect\n");
+    exit(1);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// parseCommandLine() - Parses the command line, filling in the "conf" structure
+//=================================================================================================
+void parseCommandLine(const char** argv)
+{
+    int idx = 0;
+
+    while (true)
+    {
+        // Fetch the next command-line token
+        const char* token = argv[++idx];
+
+        // If we've hit the end of the list, we're done
+        if (token == nullptr) break;
+
+        // For convenience, convert that token to a string
+        string option = token;
+
+        // Assume for a moment that this option has no argument
+        string arg = "";
+
+        // If there's an argument available fetch it
+        if (argv[idx+1] && *argv[idx+1] != '-') arg = argv[++idx];
+
+        if (option == "-device" && !arg.empty())
+            conf.device = arg;
+        else if (option == "-socket" && !arg.empty())
+            conf.socketName = arg;
+        else if (option == "-group" && !arg.empty())
+            conf.group = arg;
+        else if (option == "-world")
+            conf.world = true;
+        else if (option == "-dir" && !arg.empty())
+            conf.dirName.push_back(arg);
+        else if (option == "-verbose")
+            conf.verbose = true;
+        else
+            showHelp();
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// signalHandler() - Removes our socket and exits
+//=================================================================================================
+void signalHandler(int sigNumber)
+{
+    unlink(conf.socketName.c_str());
+    exit(1);
+}
+//=================================================================================================
@@ -0,0 +1,362 @@
+//=================================================================================================
+// BandwidthEngine.cpp - Implements a class that drives one "measure_bw" RTL core
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include "BandwidthEngine.h"
+using namespace std;
+
+// This is defined in IrqSource.cpp
+int openIrqSource(string dirName, int irq);
+
+// Register map for the "measure_bw" RTL core
+enum
+{
+    REG_RADDR_H   = 0,
+    REG_RADDR_L   = 1,
+    REG_WADDR_H   = 2,
+    REG_WADDR_L   = 3,
+    REG_BLK_SIZE  = 4,
+    REG_COUNT     = 5,
+    REG_RRESULT_H = 6,
+    REG_RRESULT_L = 7,
+    REG_WRESULT_H = 8,
+    REG_WRESULT_L = 9,
+    REG_CTL_STAT  = 10
+};
+
+
+//=================================================================================================
+// throwRuntime() - Throws a runtime exception
+//=================================================================================================
+static void throwRuntime(const char* fmt, ...)
+{
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsprintf(buffer, fmt, ap);
+    va_end(ap);
+
+    throw runtime_error(buffer);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// nanoTime() - Returns a timestamp in nanoseconds from a clock that never jumps
+//=================================================================================================
+static uint64_t nanoTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Constructor - Saves the engine description and computes the address of its registers
+//
+// Passed: config = description of the engine
+//         bar0   = userspace address where the AXI registers (i.e., BAR0) are mapped
+//=================================================================================================
+BandwidthEngine::BandwidthEngine(const config_t& config, uint8_t* bar0)
+{
+    config_ = config;
+    regs_   = RegisterBlock(bar0, config.regOffset);
+    irqFD_  = -1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// probe() - Returns true if a measure_bw core appears to be present at this engine's address
+//
+// The block-size register is read/write and the upper 30 bits of CTL_STAT always read as zero.
+// Anything else that happens to live at this address is very unlikely to behave that way.
+//=================================================================================================
+bool BandwidthEngine::probe()
+{
+    // The status register only has two meaningful bits
+    if (regs_.read<REG_CTL_STAT>() & ~3) return false;
+
+    // Make sure the block size register holds what we write to it
+    uint32_t saved = regs_.read<REG_BLK_SIZE>();
+    regs_.write<REG_BLK_SIZE>(0x5A5A5A40);
+    bool ok = (regs_.read<REG_BLK_SIZE>() == 0x5A5A5A40);
+    regs_.write<REG_BLK_SIZE>(saved);
+
+    // Tell the caller whether this looks like a measure_bw core
+    return ok;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// openIrq() - Opens the FIFO or eventfd that the interrupt driver notifies when our IRQ source fires
+//
+// Passed: dirName = the directory where the userspace interrupt driver creates its FIFOs
+//=================================================================================================
+void BandwidthEngine::openIrq(string dirName)
+{
+    // If this engine doesn't strobe an interrupt on completion, there's nothing to do
+    if (config_.irq < 0) return;
+
+    // Open the driver's eventfd or FIFO for this interrupt source
+    irqFD_ = openIrqSource(dirName, config_.irq);
+
+    // If we can't, fall back to polling the engine
+    if (irqFD_ < 0) fprintf(stderr, "Can't open interrupt %d in %s, polling for completion instead\n",
+                            config_.irq, dirName.c_str());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// drainIrq() - Throws away any interrupt notifications that are sitting in the FIFO
+//=================================================================================================
+void BandwidthEngine::drainIrq()
+{
+    char buffer[64];
+    if (irqFD_ >= 0) while (read(irqFD_, buffer, sizeof buffer) > 0);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// arm() - Configures the engine without starting a measurement
+//
+// Passed: readAddress   = The first address to read from
+//         writeAddress  = The first address to write to
+//         blockSize     = The number of bytes in one AXI burst
+//         blockCount    = The total number of bursts to perform
+//=================================================================================================
+void BandwidthEngine::arm(uint64_t readAddress, uint64_t writeAddress, uint32_t blockSize,
+                          uint32_t blockCount)
+{
+    // Configure the bandwith measurement core
+    regs_.writeHiLo<REG_RADDR_H, REG_RADDR_L>(readAddress);
+    regs_.writeHiLo<REG_WADDR_H, REG_WADDR_L>(writeAddress);
+    regs_.write<REG_BLK_SIZE>(blockSize);
+    regs_.write<REG_COUNT>(blockCount);
+
+    // Make sure a completion notification from an earlier measurement doesn't confuse us
+    drainIrq();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// start() - Starts the measurements that "arm()" configured
+//
+// Passed: ctl = START_READ, START_WRITE, or both
+//=================================================================================================
+void BandwidthEngine::start(uint32_t ctl)
+{
+    regs_.write<REG_CTL_STAT>(ctl);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// isBusy() - Returns true if a read or write measurement is in progress
+//=================================================================================================
+bool BandwidthEngine::isBusy()
+{
+    return regs_.read<REG_CTL_STAT>() != 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// wait() - Waits for every measurement in progress to complete
+//
+// If we have a completion interrupt, we sleep until it arrives.  Otherwise, we spin on CTL_STAT
+// for a little while (so short measurements complete with no dead time), then back off
+// exponentially so that long measurements don't flood the PCI bus with register reads
+//=================================================================================================
+void BandwidthEngine::wait()
+{
+    char buffer[64];
+
+    // This is how long we'll spin before we start sleeping between polls
+    const uint64_t SPIN_NS = 50000;
+
+    // This is the longest we'll ever sleep between polls
+    const uint32_t MAX_SLEEP_US = 1000;
+
+    // If we have a completion interrupt, wait for it.  The engine remains the final word
+    // on completion, so a spurious or coalesced notification can't fool us
+    if (irqFD_ >= 0)
+    {
+        pollfd pfd = {irqFD_, POLLIN, 0};
+        while (isBusy())
+        {
+            if (poll(&pfd, 1, MAX_SLEEP_US / 1000) > 0) while (read(irqFD_, buffer, sizeof buffer) > 0);
+        }
+        return;
+    }
+
+    // Find out what time it is before we begin spinning
+    uint64_t spinStart = nanoTime();
+
+    // Spin until the measurement is complete or our spin-time runs out
+    while (isBusy())
+    {
+        if (nanoTime() - spinStart > SPIN_NS) break;
+    }
+
+    // Sleep a little longer between each poll until the measurement completes
+    for (uint32_t sleepUS = 1; isBusy(); sleepUS = min(sleepUS * 2, MAX_SLEEP_US))
+    {
+        usleep(sleepUS);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// cycles() - Returns the number of clock cycles the most recent measurement took
+//
+// Passed: isWrite = true for the write measurement, false for the read measurement
+//=================================================================================================
+uint64_t BandwidthEngine::cycles(bool isWrite)
+{
+    // Fetch the number of clock cycles the measurement took
+    if (isWrite)
+        return regs_.readHiLo<REG_WRESULT_H, REG_WRESULT_L>();
+    else
+        return regs_.readHiLo<REG_RRESULT_H, REG_RRESULT_L>();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// measure() - Returns the number of clock-cycles it took to perform the requested bandwidth
+//             measurement
+//
+// Passed: isWrite    = true to measure write bandwidth, false to measure read bandwidth
+//         address    = The first address to read or write from
+//         blockSize  = The number of bytes in one AXI burst
+//         blockCount = The total number of bursts to perform
+//=================================================================================================
+uint64_t BandwidthEngine::measure(bool isWrite, uint64_t address, uint32_t blockSize,
+                                  uint32_t blockCount)
+{
+    // Configure the bandwith measurement core
+    arm(address, address, blockSize, blockCount);
+
+    // Start the bandwidth measurement
+    start(isWrite ? START_WRITE : START_READ);
+
+    // Wait for the measurement to complete
+    wait();
+
+    // And return the elapsed number of clock cycles to the caller
+    return cycles(isWrite);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// bandwidth() - Converts a measured cycle count into GB/sec
+//
+// Passed: byteCount = The number of bytes that were transferred
+//         cycles    = The number of clock cycles the transfer took
+//=================================================================================================
+double BandwidthEngine::bandwidth(uint64_t byteCount, uint64_t cycles) const
+{
+    // Translate the measured number of clock cycles into nanoseconds
+    double nanoseconds = cycles * 1000 / config_.clockMHz;
+
+    // Bytes per nanosecond is the same thing as GB/sec
+    return byteCount / nanoseconds;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// defaultConfig() - Returns the engines built into the standard Sidewinder bitstream
+//
+// The PCI engine masters host memory through the PCIe bridge, and the DDR engine masters the
+// on-card DDR4.  Both have a 512-bit data bus, so the largest legal AXI burst is 4K.
+//=================================================================================================
+vector<BandwidthEngine::config_t> BandwidthEngine::defaultConfig()
+{
+    return
+    {
+        {"PCI", 0x1000, 250.0, HOST_MEMORY, 0, 4096, -1},
+        {"DDR", 0x2000, 266.5, CARD_MEMORY, 0, 4096, -1}
+    };
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// loadConfig() - Reads a list of engines from a file
+//
+// Each non-blank line that doesn't start with '#' describes one engine:
+//
+//    <name> <register offset> <clock MHz> <host|card> [base address] [max burst] [irq]
+//
+// For example:   DDR1  0x5000  266.5  card  0x0  4096  2
+//=================================================================================================
+vector<BandwidthEngine::config_t> BandwidthEngine::loadConfig(string filename)
+{
+    string           line, target, offset, extra;
+    vector<config_t> result;
+
+    // Open the specified file
+    ifstream file(filename);
+
+    // If we couldn't open the file, complain
+    if (!file.is_open()) throwRuntime("Can't open %s", filename.c_str());
+
+    // Loop through each line of the file...
+    while (getline(file, line))
+    {
+        config_t engine = {"", 0, 0, HOST_MEMORY, 0, 4096, -1};
+
+        // Ignore blank lines and comments
+        auto first = line.find_first_not_of(" \t");
+        if (first == string::npos || line[first] == '#') continue;
+
+        // Parse the mandatory fields on this line
+        istringstream fields(line);
+        fields >> engine.name >> offset >> engine.clockMHz >> target;
+        if (!fields) throwRuntime("Malformed engine definition in %s: %s", filename.c_str(), line.c_str());
+        engine.regOffset = stoul(offset, 0, 0);
+
+        // Parse the optional fields, if they're present
+        if (fields >> extra) engine.baseAddress = stoull(extra, 0, 0);
+        if (fields >> extra) engine.maxBurst    = stoul(extra, 0, 0);
+        if (fields >> extra) engine.irq         = stoi(extra, 0, 0);
+
+        // Find out what this engine's AXI master can reach
+        if (target == "host")
+            engine.target = HOST_MEMORY;
+        else if (target == "card")
+            engine.target = CARD_MEMORY;
+        else
+            throwRuntime("Unknown engine target '%s' in %s", target.c_str(), filename.c_str());
+
+        // Add this engine to the list
+        result.push_back(engine);
+    }
+
+    // If there are no engines in the file, something is awry
+    if (result.empty()) throwRuntime("No engines defined in %s", filename.c_str());
+
+    // Hand the caller the list of engines
+    return result;
+}
+//=================================================================================================
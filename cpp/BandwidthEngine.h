@@ -0,0 +1,96 @@
+//=================================================================================================
+// BandwidthEngine.h - Defines a class that drives one "measure_bw" RTL core
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "RegisterBlock.h"
+
+class BandwidthEngine
+{
+public:
+
+    // These describe what an engine's AXI master is able to reach
+    enum target_t {HOST_MEMORY, CARD_MEMORY};
+
+    // These are the bits to write to the CTL_STAT register to start a measurement
+    enum {START_READ = 1, START_WRITE = 2};
+
+    // This describes one "measure_bw" core in the bitstream
+    struct config_t
+    {
+        std::string name;           // Human readable name, e.g. "PCI" or "DDR"
+        uint32_t    regOffset;      // Offset of the core's AXI registers within BAR0
+        double      clockMHz;       // Clock speed (in MHz) that drives the core
+        target_t    target;         // What the core's AXI master is connected to
+        uint64_t    baseAddress;    // First address to read/write (filled in at runtime for host memory)
+        uint32_t    maxBurst;       // Largest AXI burst the core supports, in bytes
+        int         irq;            // Interrupt source strobed on completion, or -1 if none
+    };
+
+    // Constructor
+    BandwidthEngine(const config_t& config, uint8_t* bar0);
+
+    // Fetch information about this engine
+    const config_t& config()   const {return config_;}
+    const char*     name()     const {return config_.name.c_str();}
+    double          clockMHz() const {return config_.clockMHz;}
+
+    // Sets the address that measurements start at, for engines that target host memory
+    void        setBaseAddress(uint64_t address) {config_.baseAddress = address;}
+
+    // Changes the clock speed that cycle counts are converted with (i.e., after calibration)
+    void        setClockMHz(double clockMHz) {config_.clockMHz = clockMHz;}
+
+    // Returns true if a measure_bw core appears to be present at this engine's address
+    bool        probe();
+
+    // Opens the interrupt FIFO (created by the userspace interrupt driver) for this engine
+    void        openIrq(std::string dirName);
+
+    // Uses an interrupt notification channel that was opened elsewhere (i.e., by the broker)
+    void        setIrqFD(int fd) {irqFD_ = fd;}
+
+    // Configures the engine without starting a measurement
+    void        arm(uint64_t readAddress, uint64_t writeAddress, uint32_t blockSize, uint32_t blockCount);
+
+    // Starts the read and/or write measurements that "arm()" configured
+    void        start(uint32_t ctl);
+
+    // Returns true if a measurement is in progress
+    bool        isBusy();
+
+    // Waits for every measurement in progress to complete
+    void        wait();
+
+    // Returns the number of clock cycles the most recent read or write measurement took
+    uint64_t    cycles(bool isWrite);
+
+    // Performs a complete read or write measurement and returns the elapsed clock cycles
+    uint64_t    measure(bool isWrite, uint64_t address, uint32_t blockSize, uint32_t blockCount);
+
+    // Converts a cycle count from this engine into GB/sec
+    double      bandwidth(uint64_t byteCount, uint64_t cycles) const;
+
+    // Returns the engines built into the standard Sidewinder bitstream
+    static std::vector<config_t> defaultConfig();
+
+    // Reads a list of engines from a file
+    static std::vector<config_t> loadConfig(std::string filename);
+
+protected:
+
+    // Drains any stale completion notifications from our interrupt FIFO
+    void        drainIrq();
+
+    // This describes the engine
+    config_t    config_;
+
+    // The engine's AXI registers
+    RegisterBlock regs_;
+
+    // File descriptor of our interrupt FIFO, or -1 if we poll for completion
+    int         irqFD_;
+};
+//=================================================================================================
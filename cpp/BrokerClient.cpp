@@ -0,0 +1,193 @@
+//=================================================================================================
+// BrokerClient.cpp - Talks to the Sidewinder broker (in "broker"), which lets an unprivileged
+//                    process map a card, receive its interrupts, and own its measure_bw engines
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Broker.h"
+#include "IrqSocket.h"
+#include "PciDevice.h"
+using namespace std;
+
+
+//=================================================================================================
+// throwRuntime() - Throws a runtime exception
+//=================================================================================================
+static void throwRuntime(const char* fmt, ...)
+{
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsprintf(buffer, fmt, ap);
+    va_end(ap);
+
+    throw runtime_error(buffer);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// call() - Sends the broker a request and waits for its reply
+//
+// Returns: the number of file descriptors attached to the reply
+//=================================================================================================
+static int call(int sock, const brokerRequest_t& request, brokerReply_t* reply, int* fd)
+{
+    if (!brokerSend(sock, &request, sizeof request)) throwRuntime("Lost the connection to the broker");
+    int fdCount = brokerReceive(sock, reply, sizeof *reply, fd);
+    if (fdCount < 0) throwRuntime("Lost the connection to the broker");
+    return fdCount;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// brokerConnect() - Connects to the broker's socket
+//
+// Returns: the connected socket, or -1 if the broker isn't running
+//=================================================================================================
+int brokerConnect(string socketName)
+{
+    sockaddr_un addr;
+
+    // If the socket name won't fit in a socket address, there's no way to connect to it
+    if (socketName.size() >= sizeof addr.sun_path) return -1;
+
+    // Build the address of the socket
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketName.c_str());
+
+    // And connect to the broker
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+    if (connect(sock, (sockaddr*)&addr, sizeof addr) != 0)
+    {
+        ::close(sock);
+        return -1;
+    }
+    return sock;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// brokerFindCard() - Returns the broker's index for the card at the specified BDF
+//=================================================================================================
+int brokerFindCard(int sock, string bdf)
+{
+    brokerRequest_t request = {BROKER_LIST, 0, 0, 0, 0};
+    brokerReply_t   reply;
+    int             fd[BROKER_MAX_FDS];
+
+    // The broker tells us how many cards there are each time we ask about one of them
+    do
+    {
+        call(sock, request, &reply, fd);
+        if (reply.status == 0 && (bdf == reply.bdf || "0000:" + bdf == reply.bdf)) return request.card;
+    }
+    while (++request.card < reply.count);
+
+    throwRuntime("The broker doesn't own a card at %s", bdf.c_str());
+    return -1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// brokerOpenDevice() - Maps every resource of a card through files the broker opens for us
+//
+// Passed: sock   = our connection to the broker
+//         card   = the broker's index for the card
+//         pci    = the PciDevice to map the card into
+//         wcMask = bit "n" is set if we want resource "n" mapped write-combining
+//=================================================================================================
+void brokerOpenDevice(int sock, int card, PciDevice& pci, uint32_t wcMask)
+{
+    brokerRequest_t               request = {BROKER_OPEN_BAR, (uint32_t)card, 0, 0, 0};
+    brokerReply_t                 reply;
+    vector<PciDevice::resource_t> resources;
+    vector<int>                   fds;
+    int                           fd[BROKER_MAX_FDS];
+
+    // Ask for each resource in turn until the broker says there aren't any more
+    for (request.index = 0; ; ++request.index)
+    {
+        request.flags = (wcMask & (1 << request.index)) ? BROKER_WC : 0;
+        int fdCount = call(sock, request, &reply, fd);
+        if (reply.status == ENOENT) break;
+
+        // If the broker couldn't open the resource, give back what we have and complain
+        if (reply.status != 0 || fdCount != 1)
+        {
+            for (int i : fds) ::close(i);
+            for (int i=0; i<fdCount; ++i) ::close(fd[i]);
+            if (reply.status == ENODEV) throwRuntime("The broker doesn't own card %d", card);
+            throwRuntime("The broker can't open resource %u: %s", request.index, strerror(reply.status));
+        }
+
+        resources.push_back({nullptr, reply.size, (off_t)reply.physAddr, (int)reply.index,
+                             (reply.flags & BROKER_WC) != 0});
+        fds.push_back(fd[0]);
+    }
+
+    // Map the resources through the files we were handed
+    pci.open(reply.bdf, resources, fds);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// brokerIrqFD() - Returns an eventfd that becomes readable when the specified interrupt source
+//                 fires, or -1 if the card's interrupt driver isn't handing out eventfds
+//=================================================================================================
+int brokerIrqFD(int sock, int card, int irq)
+{
+    brokerRequest_t request = {BROKER_OPEN_IRQS, (uint32_t)card, 0, 0, 0};
+    brokerReply_t   reply;
+    int             fd[BROKER_MAX_FDS];
+    int             result = -1;
+
+    int fdCount = call(sock, request, &reply, fd);
+
+    // The eventfds (if any) come first, followed by the ring (if there is one)
+    bool haveEventFDs = (reply.status == 0) && (reply.flags & IRQ_MSG_EVENTFDS);
+
+    // Keep the one we want and close the rest
+    for (int i=0; i<fdCount; ++i)
+    {
+        if (haveEventFDs && i == irq && irq < reply.count)
+            result = fd[i];
+        else
+            ::close(fd[i]);
+    }
+
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// brokerLockEngines() - Asks the broker for exclusive use of a card's measure_bw engines
+//
+// Passed: engines = bit N is the engine whose registers are at BAR0 offset N * 0x1000
+//         wait    = true to wait until they're free, false to fail if any of them aren't
+//
+// Returns: true if we own the engines.  We own them until we unlock them or disconnect
+//=================================================================================================
+bool brokerLockEngines(int sock, int card, uint64_t engines, bool wait)
+{
+    brokerRequest_t request = {BROKER_LOCK, (uint32_t)card, 0, wait ? (uint32_t)BROKER_WAIT : 0, engines};
+    brokerReply_t   reply;
+    int             fd[BROKER_MAX_FDS];
+
+    call(sock, request, &reply, fd);
+    return reply.status == 0;
+}
+//=================================================================================================
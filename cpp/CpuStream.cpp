@@ -0,0 +1,300 @@
+//=================================================================================================
+// CpuStream.cpp - Measures CPU-initiated (i.e., PIO) throughput into the card's DDR window and
+//                 into a host DMA buffer
+//
+// Every kernel moves one "message" at a time and, if it's a store kernel, fences at the end of
+// each message so the data is on its way to the destination before the next message starts.
+// That's the same thing a driver has to do when it pushes a command or a small packet via PIO.
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include "PciDevice.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+// This is the most memory we'll stream through in any one target
+static const size_t MAX_REGION_SIZE = 64 << 20;
+
+// This is how long (in milliseconds) we measure each data point for
+static const int RUN_MS = 100;
+
+// The sizes of the messages we measure.  The last entry is a "bulk" transfer
+static const size_t messageSize[] = {64, 256, 1024, 4096, 1 << 20};
+
+// Store kernels copy from here, and loads are summed into here so they can't be optimized away
+alignas(64) static uint8_t  source[1 << 20];
+static volatile uint64_t    sink;
+
+// This is the signature of a kernel that moves one message
+typedef void (*kernel_t)(uint8_t* target, size_t length);
+
+// These are the instruction set levels a kernel may require
+enum {ISA_BASE, ISA_AVX2, ISA_AVX512};
+
+
+//=================================================================================================
+// flushMessage() - Makes sure every store in a message has been pushed toward its destination
+//=================================================================================================
+static inline void flushMessage()
+{
+    PciDevice::flushWC();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// These kernels work on any CPU
+//=================================================================================================
+static void loadPlain(uint8_t* target, size_t length)
+{
+    volatile uint64_t* p = (uint64_t*)target;
+    uint64_t sum = 0;
+    for (size_t i=0; i<length/8; ++i) sum += p[i];
+    sink = sum;
+}
+
+static void storePlain(uint8_t* target, size_t length)
+{
+    volatile uint64_t* p = (uint64_t*)target;
+    for (size_t i=0; i<length/8; ++i) p[i] = i;
+    flushMessage();
+}
+
+static void storeMemcpy(uint8_t* target, size_t length)
+{
+    memcpy(target, source, length);
+    flushMessage();
+}
+//=================================================================================================
+
+
+#if defined(__x86_64__)
+//=================================================================================================
+// These kernels require AVX2 or AVX-512.  They're only called if the CPU supports them
+//=================================================================================================
+__attribute__((target("avx2")))
+static void loadNtAvx2(uint8_t* target, size_t length)
+{
+    __m256i sum = _mm256_setzero_si256();
+    for (size_t i=0; i<length; i += 32)
+    {
+        sum = _mm256_add_epi64(sum, _mm256_stream_load_si256((__m256i*)(target + i)));
+    }
+    sink = _mm256_extract_epi64(sum, 0);
+}
+
+__attribute__((target("avx2")))
+static void storeNtAvx2(uint8_t* target, size_t length)
+{
+    __m256i value = _mm256_set1_epi32(0x5A5A5A5A);
+    for (size_t i=0; i<length; i += 32) _mm256_stream_si256((__m256i*)(target + i), value);
+    flushMessage();
+}
+
+__attribute__((target("avx512f")))
+static void storeNtAvx512(uint8_t* target, size_t length)
+{
+    __m512i value = _mm512_set1_epi32(0x5A5A5A5A);
+    for (size_t i=0; i<length; i += 64) _mm512_stream_si512((__m512i*)(target + i), value);
+    flushMessage();
+}
+
+// Each store is exactly one aligned 64-byte line, which on a write-combining mapping leaves the
+// CPU as a single full-line write
+__attribute__((target("avx512f")))
+static void storeLine64(uint8_t* target, size_t length)
+{
+    __m512i value = _mm512_set1_epi32(0x5A5A5A5A);
+    for (size_t i=0; i<length; i += 64) _mm512_store_si512((__m512i*)(target + i), value);
+    flushMessage();
+}
+//=================================================================================================
+#endif
+
+
+//=================================================================================================
+// This is the list of kernels we measure
+//=================================================================================================
+struct kernelDesc_t
+{
+    const char* name;
+    kernel_t    fn;
+    int         isa;
+};
+
+static const kernelDesc_t kernelList[] =
+{
+    {"load 64-bit",        loadPlain,     ISA_BASE  },
+    {"store 64-bit",       storePlain,    ISA_BASE  },
+    {"memcpy",             storeMemcpy,   ISA_BASE  },
+#if defined(__x86_64__)
+    {"load NT AVX2",       loadNtAvx2,    ISA_AVX2  },
+    {"store NT AVX2",      storeNtAvx2,   ISA_AVX2  },
+    {"store NT AVX-512",   storeNtAvx512, ISA_AVX512},
+    {"store 64B line",     storeLine64,   ISA_AVX512},
+#endif
+};
+//=================================================================================================
+
+
+//=================================================================================================
+// supportedIsa() - Returns the highest instruction-set level this CPU supports
+//=================================================================================================
+static int supportedIsa()
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return ISA_AVX512;
+    if (__builtin_cpu_supports("avx2"))    return ISA_AVX2;
+#endif
+    return ISA_BASE;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// runKernel() - Runs a kernel from several threads at once for RUN_MS milliseconds, and returns
+//               the aggregate throughput in GB/sec, or -1 if the region is too small to give
+//               every thread a whole message of its own
+//
+// Passed: fn          = the kernel to run
+//         region      = userspace address of the memory to stream through
+//         regionSize  = the number of bytes at "region"
+//         msgSize     = the number of bytes in one message
+//         threadCount = the number of threads to spread the work across
+//=================================================================================================
+static double runKernel(kernel_t fn, uint8_t* region, size_t regionSize, size_t msgSize,
+                        int threadCount)
+{
+    vector<thread>   threads;
+    vector<uint64_t> bytes(threadCount, 0);
+    atomic<bool>     stop(false);
+    timespec         t0, t1;
+
+    // Each thread streams through its own slice of the region
+    size_t sliceSize = (regionSize / threadCount) & ~(msgSize - 1);
+    if (sliceSize < msgSize) return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    // Start the threads
+    for (int i=0; i<threadCount; ++i)
+    {
+        threads.emplace_back([&, i]()
+        {
+            uint8_t* slice  = region + i * sliceSize;
+            size_t   offset = 0;
+            uint64_t total  = 0;
+
+            while (!stop.load(memory_order_relaxed))
+            {
+                fn(slice + offset, msgSize);
+                total  += msgSize;
+                offset += msgSize;
+                if (offset >= sliceSize) offset = 0;
+            }
+
+            bytes[i] = total;
+        });
+    }
+
+    // Let them run for a while, then tell them to stop
+    usleep(RUN_MS * 1000);
+    stop = true;
+    for (auto& t : threads) t.join();
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    // Add up how much data all of the threads moved
+    uint64_t total = 0;
+    for (auto b : bytes) total += b;
+
+    // Bytes per nanosecond is the same thing as GB/sec
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    return total / ns;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// measureTarget() - Measures every kernel at every message size against one region of memory
+//=================================================================================================
+static void measureTarget(string name, uint8_t* region, size_t regionSize, int threadCount)
+{
+    int isa = supportedIsa();
+
+    printf("\n%s, %lu MB, %d thread%s (GB/sec)\n", name.c_str(), regionSize >> 20, threadCount,
+           threadCount == 1 ? "" : "s");
+    printf("%-20s", "kernel");
+    for (auto size : messageSize)
+    {
+        if (size < 1024)
+            printf(" %8luB", size);
+        else if (size < (1 << 20))
+            printf(" %8luK", size >> 10);
+        else
+            printf(" %8s", "bulk");
+    }
+    printf("\n");
+
+    for (auto& kernel : kernelList)
+    {
+        // Skip kernels that this CPU can't run
+        if (kernel.isa > isa) continue;
+
+        printf("%-20s", kernel.name);
+        fflush(stdout);
+        for (auto size : messageSize)
+        {
+            double gbPerSec = runKernel(kernel.fn, region, regionSize, size, threadCount);
+            if (gbPerSec < 0)
+                printf(" %9s", "-");
+            else
+                printf(" %9.3lf", gbPerSec);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// measureCpuBandwidth() - Measures CPU-initiated throughput into the card's DDR window (BAR1)
+//                         and into a DMA buffer in host RAM
+//
+// Passed: bar1          = userspace address where BAR1 is mapped, or nullptr if there isn't one
+//         bar1Size      = the size of BAR1, in bytes
+//         bar1WC        = true if BAR1 is mapped write-combining
+//         hostBuffer    = userspace address of a host DMA buffer
+//         hostSize      = the size of that buffer, in bytes
+//         threadCount   = the number of threads to spread the work across
+//=================================================================================================
+void measureCpuBandwidth(uint8_t* bar1, size_t bar1Size, bool bar1WC, uint8_t* hostBuffer,
+                         size_t hostSize, int threadCount)
+{
+    // Give the store kernels something to copy
+    for (size_t i=0; i<sizeof source; ++i) source[i] = (uint8_t)i;
+
+    // Measure the card's DDR window
+    if (bar1)
+    {
+        size_t size = bar1Size < MAX_REGION_SIZE ? bar1Size : MAX_REGION_SIZE;
+        measureTarget(bar1WC ? "BAR1 (card DDR, write-combining)" : "BAR1 (card DDR, uncached)",
+                      bar1, size, threadCount);
+    }
+
+    // Measure the host DMA buffer.  It's ordinary cacheable RAM, just like any DMA buffer
+    size_t size = hostSize < MAX_REGION_SIZE ? hostSize : MAX_REGION_SIZE;
+    measureTarget("Host DMA buffer", hostBuffer, size, threadCount);
+}
+//=================================================================================================
@@ -0,0 +1,420 @@
+//=================================================================================================
+// DmaPool.cpp - Implements a pool of physically contiguous host memory for DMA buffers
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <linux/mman.h>
+#include <stdexcept>
+#include <vector>
+#include "DmaPool.h"
+#include "FindContig.h"
+using namespace std;
+
+// These are defined in Numa.cpp
+int  numaNodeOfAddress(uint64_t physAddr);
+bool bindMemoryToNode(int node);
+
+// Every buffer is a whole number of cache lines
+static const size_t CACHE_LINE = 64;
+
+
+//=================================================================================================
+// throwRuntime() - Throws a runtime exception
+//=================================================================================================
+static void throwRuntime(const char* fmt, ...)
+{
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsprintf(buffer, fmt, ap);
+    va_end(ap);
+
+    throw runtime_error(buffer);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// physicalAddress() - Looks up the physical address of a userspace address in /proc/self/pagemap
+//
+// Returns 0 if the page isn't present, or if we're not privileged enough to see physical addresses
+//=================================================================================================
+static uint64_t physicalAddress(int pagemapFD, const void* virtAddr)
+{
+    const uint64_t PRESENT  = 1ULL << 63;
+    const uint64_t PFN_MASK = (1ULL << 55) - 1;
+    uint64_t       pageSize = getpagesize();
+    uint64_t       address  = (uint64_t)virtAddr;
+    uint64_t       entry;
+
+    // There's one 64-bit entry per page
+    if (pread(pagemapFD, &entry, sizeof entry, (address / pageSize) * sizeof entry) != sizeof entry) return 0;
+
+    // If the page isn't present, or the kernel won't tell us its frame number, we're out of luck
+    if (!(entry & PRESENT) || (entry & PFN_MASK) == 0) return 0;
+
+    // Combine the page frame number with the offset into the page
+    return (entry & PFN_MASK) * pageSize + address % pageSize;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// openReserved() - Maps a region reserved with "memmap=" on the kernel command line
+//
+// Passed: node = the NUMA node we'd like the region to be on, or -1 if we don't care.  If no
+//                region is on that node, we use the first one
+//=================================================================================================
+void DmaPool::openReserved(int node)
+{
+    const char* filename = "/dev/mem";
+
+    // If we already have memory, get rid of it
+    close();
+
+    // Find the reserved regions
+    auto regions = findContigRegions();
+    if (regions.empty()) throwRuntime("No reserved contiguous buffer found!");
+
+    // Use the first one on the node the caller asked for
+    auto region = regions[0];
+    for (auto& candidate : regions)
+    {
+        if (node >= 0 && numaNodeOfAddress(candidate.physAddr) == node)
+        {
+            region = candidate;
+            break;
+        }
+    }
+    uint64_t physAddr = region.physAddr;
+    uint64_t size     = region.size;
+
+    // Map it.  We don't ask for O_SYNC because this is ordinary RAM that we want the CPU to be
+    // able to cache, just like any other DMA buffer
+    int fd = ::open(filename, O_RDWR);
+    if (fd < 0) throwRuntime("Can't open %s", filename);
+    void* ptr = ::mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, physAddr);
+    ::close(fd);
+    if (ptr == MAP_FAILED) throwRuntime("mmap failed on 0x%lx for size 0x%lx", physAddr, size);
+
+    // The entire reserved region is one physically contiguous segment
+    mapAddr_ = (uint8_t*)ptr;
+    mapSize_ = size;
+    source_  = RESERVED;
+    node_    = numaNodeOfAddress(physAddr);
+    addSegment(mapAddr_, physAddr, size);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// openHugepages() - Allocates hugepages and adds them to the pool.  We try for 1 GB pages first,
+//                   since a single one holds any buffer we're likely to need, and settle for
+//                   2 MB pages if there aren't enough of those
+//
+// Passed: size = the number of bytes we need
+//         node = the NUMA node the hugepages must come from, or -1 if we don't care
+//=================================================================================================
+void DmaPool::openHugepages(size_t size, int node)
+{
+    const size_t ONE_GIG = 1ULL << 30;
+    const size_t TWO_MEG = 2ULL << 20;
+    void*        ptr = MAP_FAILED;
+    size_t       pageSize;
+
+    // If we already have memory, get rid of it
+    close();
+
+    // If the caller wants memory from a particular node, that's the only place hugepages may
+    // come from while we allocate them
+    if (node >= 0 && !bindMemoryToNode(node)) throwRuntime("Can't allocate memory on NUMA node %d", node);
+
+    // Try 1 GB pages, then 2 MB pages.  MAP_POPULATE makes sure they exist before we look up
+    // their physical addresses, and hugepages are never swapped or migrated
+    for (size_t candidate : {ONE_GIG, TWO_MEG})
+    {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE
+                  | (candidate == ONE_GIG ? MAP_HUGE_1GB : MAP_HUGE_2MB);
+        pageSize  = candidate;
+        mapSize_  = (size + pageSize - 1) & ~(pageSize - 1);
+        ptr = ::mmap(0, mapSize_, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (ptr != MAP_FAILED) break;
+    }
+
+    // Anything else we allocate can come from anywhere
+    if (node >= 0) bindMemoryToNode(-1);
+
+    // If we couldn't get any hugepages, tell the caller
+    if (ptr == MAP_FAILED)
+    {
+        mapSize_ = 0;
+        if (node >= 0) throwRuntime("Can't allocate 0x%lx bytes of hugepages on NUMA node %d", size, node);
+        throwRuntime("Can't allocate 0x%lx bytes of hugepages.  Check /proc/sys/vm/nr_hugepages", size);
+    }
+    mapAddr_ = (uint8_t*)ptr;
+    source_  = HUGEPAGES;
+
+    // We need pagemap to find out where each hugepage is in physical memory
+    int fd = ::open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0)
+    {
+        close();
+        throwRuntime("Can't open /proc/self/pagemap");
+    }
+
+    // Each hugepage is physically contiguous, and neighbors that happen to be physically
+    // adjacent become a single segment
+    for (size_t offset = 0; offset < mapSize_; offset += pageSize)
+    {
+        uint64_t physAddr = physicalAddress(fd, mapAddr_ + offset);
+        if (physAddr == 0)
+        {
+            ::close(fd);
+            close();
+            throwRuntime("Can't find the physical address of a hugepage.  Must be root.");
+        }
+        addSegment(mapAddr_ + offset, physAddr, pageSize);
+    }
+
+    ::close(fd);
+
+    // If we didn't ask for a node, find out which one the kernel gave us
+    node_ = (node >= 0) ? node : numaNodeOfAddress(segment_[0].physAddr);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// open() - Uses a region reserved at boot time if there is one, and hugepages otherwise.  The
+//          caller's node is a preference: if it can't be met, the memory comes from elsewhere
+//
+// Passed: hugepageSize = how many bytes of hugepages to allocate if there's no reserved region
+//         node         = the NUMA node we'd like the memory to be on, or -1 if we don't care
+//
+// Returns: where the pool's memory came from
+//=================================================================================================
+DmaPool::source_t DmaPool::open(size_t hugepageSize, int node)
+{
+    try
+    {
+        openReserved(node);
+    }
+    catch(const exception& e)
+    {
+        // If the node we asked for has no hugepages to spare, settle for any node
+        try
+        {
+            openHugepages(hugepageSize, node);
+        }
+        catch(const exception& e)
+        {
+            if (node < 0) throw;
+            openHugepages(hugepageSize);
+        }
+    }
+
+    return source_;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// addSegment() - Adds a physically contiguous piece of memory to the pool.  If it directly
+//                follows the previous segment both virtually and physically, the two merge
+//=================================================================================================
+void DmaPool::addSegment(uint8_t* virtAddr, uint64_t physAddr, size_t size)
+{
+    if (!segment_.empty())
+    {
+        segment_t& prior = segment_.back();
+        if (prior.virtAddr + prior.size == virtAddr && prior.physAddr + prior.size == physAddr)
+        {
+            free_[prior.virtAddr] += size;
+            prior.size += size;
+            return;
+        }
+    }
+
+    segment_.push_back({virtAddr, physAddr, size});
+    free_[virtAddr] = size;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// segmentOf() - Returns the segment that contains the specified userspace address
+//=================================================================================================
+const DmaPool::segment_t* DmaPool::segmentOf(const void* virtAddr) const
+{
+    const uint8_t* address = (const uint8_t*)virtAddr;
+
+    for (auto& segment : segment_)
+    {
+        if (address >= segment.virtAddr && address < segment.virtAddr + segment.size) return &segment;
+    }
+
+    return nullptr;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// allocate() - Hands out a physically contiguous buffer, using the first free block it fits in
+//
+// Passed:  size      = the size of the buffer, in bytes
+//          alignment = the physical address of the buffer will be a multiple of this
+//=================================================================================================
+DmaPool::buffer_t DmaPool::allocate(size_t size, size_t alignment)
+{
+    // Every buffer is a whole number of cache lines
+    size = (size + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+    if (alignment < CACHE_LINE) alignment = CACHE_LINE;
+
+    for (auto it = free_.begin(); it != free_.end(); ++it)
+    {
+        uint8_t* start  = it->first;
+        size_t   length = it->second;
+
+        // Figure out how far into this block the first properly aligned address is
+        uint64_t address = physAddr(start);
+        size_t   padding = (alignment - address % alignment) % alignment;
+
+        // If the buffer doesn't fit in this block, go look at the next one
+        if (padding + size > length) continue;
+
+        // Carve the buffer out of the block, leaving whatever is on either side of it free
+        free_.erase(it);
+        if (padding) free_[start] = padding;
+        if (padding + size < length) free_[start + padding + size] = length - padding - size;
+
+        // Hand the caller their buffer
+        return {start + padding, address + padding, size};
+    }
+
+    // If we get here, there's no free block large enough
+    throwRuntime("No room in the DMA pool for a buffer of 0x%lx bytes", size);
+    return {nullptr, 0, 0};
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// release() - Returns a buffer to the pool, merging it with any free neighbors in its segment
+//=================================================================================================
+void DmaPool::release(const buffer_t& buffer)
+{
+    const segment_t* segment = segmentOf(buffer.virtAddr);
+    if (segment == nullptr) throwRuntime("0x%lx isn't a buffer from this DMA pool", (uint64_t)buffer.virtAddr);
+
+    uint8_t* start = buffer.virtAddr;
+    size_t   size  = buffer.size;
+
+    // If the free block that follows us is in the same segment, absorb it
+    auto next = free_.lower_bound(start);
+    if (next != free_.end() && next->first == start + size && segmentOf(next->first) == segment)
+    {
+        size += next->second;
+        next  = free_.erase(next);
+    }
+
+    // If the free block that precedes us is in the same segment, it absorbs us
+    if (next != free_.begin())
+    {
+        auto prior = std::prev(next);
+        if (prior->first + prior->second == start && segmentOf(prior->first) == segment)
+        {
+            prior->second += size;
+            return;
+        }
+    }
+
+    free_[start] = size;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// physAddr() - Converts a userspace address within the pool to a physical address
+//=================================================================================================
+uint64_t DmaPool::physAddr(const void* virtAddr) const
+{
+    const segment_t* segment = segmentOf(virtAddr);
+    if (segment == nullptr) throwRuntime("0x%lx isn't in the DMA pool", (uint64_t)virtAddr);
+    return segment->physAddr + ((const uint8_t*)virtAddr - segment->virtAddr);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// virtAddr() - Converts a physical address within the pool to a userspace address
+//=================================================================================================
+uint8_t* DmaPool::virtAddr(uint64_t physAddr) const
+{
+    for (auto& segment : segment_)
+    {
+        if (physAddr >= segment.physAddr && physAddr < segment.physAddr + segment.size)
+        {
+            return segment.virtAddr + (physAddr - segment.physAddr);
+        }
+    }
+
+    throwRuntime("Physical address 0x%lx isn't in the DMA pool", physAddr);
+    return nullptr;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// size() - Returns the total number of bytes in the pool
+//=================================================================================================
+size_t DmaPool::size() const
+{
+    size_t total = 0;
+    for (auto& segment : segment_) total += segment.size;
+    return total;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// available() - Returns the number of bytes in the pool that haven't been handed out
+//=================================================================================================
+size_t DmaPool::available() const
+{
+    size_t total = 0;
+    for (auto& block : free_) total += block.second;
+    return total;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// largestFree() - Returns the size of the largest free block.  Free blocks never span segments,
+//                 so that's the largest physically contiguous buffer we can hand out
+//=================================================================================================
+size_t DmaPool::largestFree() const
+{
+    size_t largest = 0;
+    for (auto& block : free_) if (block.second > largest) largest = block.second;
+    return largest;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// close() - Unmaps the pool's memory
+//=================================================================================================
+void DmaPool::close()
+{
+    if (mapAddr_) munmap(mapAddr_, mapSize_);
+    mapAddr_ = nullptr;
+    mapSize_ = 0;
+    source_  = NONE;
+    node_    = -1;
+    segment_.clear();
+    free_.clear();
+}
+//=================================================================================================
@@ -0,0 +1,100 @@
+//=================================================================================================
+// DmaPool.h - Defines a pool of physically contiguous host memory that is carved into buffers the
+//             card can DMA into and out of
+//
+// The pool's memory is either the region reserved with "memmap=" on the kernel command line, or
+// (when no region was reserved) hugepages that we allocate and lock ourselves.  On a NUMA machine
+// the caller can ask for memory on a particular node, which should be the card's own node.  Each buffer the
+// pool hands out is physically contiguous, and knows both its userspace and physical address.
+//
+// The physical addresses are what the card must be given, which means an IOMMU (if there is
+// one) must be in passthrough mode or disabled for this PCI device
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <vector>
+
+class DmaPool
+{
+public:
+
+    // One buffer handed out by allocate()
+    struct buffer_t {uint8_t* virtAddr; uint64_t physAddr; size_t size;};
+
+    // Where the pool's memory came from
+    enum source_t {NONE, RESERVED, HUGEPAGES};
+
+    // Default constructor
+    DmaPool() {source_ = NONE; mapAddr_ = nullptr; mapSize_ = 0; node_ = -1;}
+
+    // Destructor
+    ~DmaPool() {close();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    DmaPool (const DmaPool&) = delete;
+    DmaPool& operator= (const DmaPool&) = delete;
+
+    // Maps a region reserved with "memmap=" on the kernel command line, preferring one on "node"
+    void        openReserved(int node = -1);
+
+    // Allocates at least "size" bytes of hugepages (1 GB pages if we can, 2 MB if not) on "node"
+    void        openHugepages(size_t size, int node = -1);
+
+    // Uses a reserved region if there is one, and "hugepageSize" bytes of hugepages if not
+    source_t    open(size_t hugepageSize, int node = -1);
+
+    // Hands out a physically contiguous buffer whose physical address is a multiple of "alignment"
+    buffer_t    allocate(size_t size, size_t alignment = 4096);
+
+    // Returns a buffer to the pool
+    void        release(const buffer_t& buffer);
+
+    // Convert between userspace and physical addresses within the pool
+    uint64_t    physAddr(const void* virtAddr) const;
+    uint8_t*    virtAddr(uint64_t physAddr) const;
+
+    // Fetches where the pool's memory came from
+    source_t    source() const {return source_;}
+
+    // Fetches the NUMA node the pool's memory is on, or -1 if we can't tell
+    int         node() const {return node_;}
+
+    // Returns the total number of bytes in the pool, and the number not handed out
+    size_t      size() const;
+    size_t      available() const;
+
+    // Returns the size of the largest buffer allocate() could hand out right now
+    size_t      largestFree() const;
+
+    // Unmaps the pool's memory.  Every buffer allocated from it becomes invalid
+    void        close();
+
+protected:
+
+    // A physically contiguous piece of the pool
+    struct segment_t {uint8_t* virtAddr; uint64_t physAddr; size_t size;};
+
+    // Returns the segment that contains "virtAddr", or nullptr if it isn't in the pool
+    const segment_t* segmentOf(const void* virtAddr) const;
+
+    // Adds a physically contiguous piece of memory to the pool
+    void        addSegment(uint8_t* virtAddr, uint64_t physAddr, size_t size);
+
+    // Where the pool's memory came from, and which NUMA node it's on
+    source_t    source_;
+    int         node_;
+
+    // The single mapping that holds all of the pool's memory
+    uint8_t*    mapAddr_;
+    size_t      mapSize_;
+
+    // The physically contiguous pieces of the pool, in the order they were mapped
+    std::vector<segment_t> segment_;
+
+    // The blocks that haven't been handed out, keyed by userspace address.  A free block never
+    // spans two segments
+    std::map<uint8_t*, size_t> free_;
+};
+//=================================================================================================
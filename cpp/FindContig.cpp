@@ -1,15 +1,32 @@
 
 //=================================================================================================
-// FindContig.cpp - Finds the reserved contiguous buffer assigned at Linux boot time
+// FindContig.cpp - Finds the reserved contiguous buffers assigned at Linux boot time
+//
+// The kernel accepts any number of "memmap=" options, each holding one or more comma-separated
+// entries of the form "nn<type>ss", where "nn" is a size, "ss" is a physical address, and both
+// are numbers (decimal, or hex with "0x") with an optional K, M, G, T, P or E suffix:
+//
+//    nn$ss  - reserve the region
+//    nn!ss  - treat the region as (legacy) persistent memory
+//    nn#ss  - treat the region as ACPI data
+//    nn@ss  - use the region as ordinary RAM (so it isn't set aside at all)
+//
+// Only '$' regions are handed out as DMA buffers: a '!' region usually belongs to the pmem driver
+// and a '#' region to ACPI.  Each region is cross-checked against /proc/iomem, and a region the
+// kernel is using as System RAM anyway (because the reservation didn't take) is never used
 //=================================================================================================
 #include <unistd.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <sys/mman.h>
 #include <sys/fcntl.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <string>
 #include <fstream>
+#include <vector>
+#include "FindContig.h"
 using namespace std;
 
 
@@ -33,54 +50,87 @@ static void throwRuntime(const char* fmt, ...)
 
 
 //=================================================================================================
-// parseKMG() - Examines a string for a delimeter, and parses the integer immediately after 
-//              the delimeter.  Looks for the character after the digits, expect to find a K, M,
-//              or G (meaning Kilo, Mega, or Giga) and returns the parsed value.
+// parseSize() - Parses a number the way the kernel's memparse() does: decimal (or hex with a
+//               "0x" prefix), optionally followed by K, M, G, T, P or E in either case
+//
+// Passed:  p = points to the number
 //
-//              Example:  4G = 0x1_0000_0000
-//                        2K = 0x400
-//                        3M = 0x30_0000
+// On Exit: p = points to the first character after the number and its suffix
 //
-// If the delimieter is not found or the string is malformed in some way, returns 0;
+// Returns: the value, or 0 if there's no number there
 //=================================================================================================
-static uint64_t parseKMG(const char delimeter, const char* ptr)
+static uint64_t parseSize(const char*& p)
 {
-    // Look for the delimeter in the string the user gave us
-    ptr = strchr(ptr, delimeter);
+    char* end;
+    uint64_t value = strtoull(p, &end, 0);
+    if (end == p) return 0;
+    p = end;
+
+    // Each suffix is another factor of 1024
+    const char* suffixes = "KMGTPE";
+    const char* suffix   = (*p) ? strchr(suffixes, toupper(*p)) : nullptr;
+    if (suffix)
+    {
+        value <<= 10 * (suffix - suffixes + 1);
+        ++p;
+    }
+
+    return value;
+}
+//=================================================================================================
 
-    // If the delimeter didn't exist, tell the caller
-    if (ptr == nullptr) return 0;
 
-    // Point to the character after the delimeter
-    ++ptr;
+//=================================================================================================
+// checkIomem() - Finds out what /proc/iomem says about a region
+//
+// Returns: IOMEM_SYSTEM_RAM if any part of the region is System RAM, IOMEM_RESERVED if the
+//          region shows up as something else, and IOMEM_UNKNOWN if we can't tell
+//=================================================================================================
+static int checkIomem(uint64_t physAddr, uint64_t size)
+{
+    string line;
+    int    result = IOMEM_UNKNOWN;
 
-    // Convert the ASCII digits that follow the delimeter to an integer
-    int64_t value = strtol(ptr, 0, 0);
+    ifstream file("/proc/iomem");
+    if (!file.is_open()) return IOMEM_UNKNOWN;
 
-    // Skip over all of the ASCII digits
-    while (*ptr >= '0' && *ptr <= '9') ++ptr;
+    while (getline(file, line))
+    {
+        // Only the top-level entries matter.  Nested ones (like "Kernel code") are indented
+        if (line.empty() || line[0] == ' ') continue;
 
-    // Return the appropriate scaled integer value
-    if (*ptr == 'K') return value * 1024;
-    if (*ptr == 'M') return value * 1024 * 1024;
-    if (*ptr == 'G') return value * 1024 * 1024 * 1024;
+        // Each line looks like "100000000-13fffffff : System RAM"
+        uint64_t first, last;
+        char     name[128] = "";
+        if (sscanf(line.c_str(), "%lx-%lx : %127[^\n]", &first, &last, name) != 3) continue;
 
-    // If we get here, there wasn't a K, M, or G after the numeric value
-    return 0;
-}
-//=================================================================================================
+        // If /proc/iomem is hiding its addresses from us, we can't tell anything
+        if (first == 0 && last == 0) return IOMEM_UNKNOWN;
 
+        // If this entry doesn't overlap the region, it doesn't matter
+        if (last < physAddr || first >= physAddr + size) continue;
 
+        // If the kernel is using any of the region as RAM, that's all we need to know
+        if (strcmp(name, "System RAM") == 0) return IOMEM_SYSTEM_RAM;
+        result = IOMEM_RESERVED;
+    }
 
+    return result;
+}
+//=================================================================================================
 
 
 //=================================================================================================
-// findContig() - Finds the physical address of a reserved contiguous buffer
+// findMemmapRegions() - Parses every "memmap=" region out of the kernel command line
+//
+// Passed: types = the region types the caller wants, i.e. "$" for just reserved regions
+//
+// Returns: the regions, in command-line order
 //=================================================================================================
-uint64_t findContig()
+vector<memmapRegion_t> findMemmapRegions(const char* types)
 {
+    vector<memmapRegion_t> result;
     string line;
-    const uint64_t ONE_GIG = 1024 * 1024 * 1024;
     const char* filename = "/proc/cmdline";
 
     // Open the specified file.  It will contain a line of ASCII data
@@ -92,26 +142,86 @@ uint64_t findContig()
     // Fetch the first line of the file
     getline(file, line);
 
-    // Look for "memmap=" in the command line
-    const char* p = ::strstr(line.c_str(), "memmap=");
+    // Look at every "memmap=" in the command line
+    for (size_t position = 0; (position = line.find("memmap=", position)) != string::npos;)
+    {
+        // Make sure this is really a "memmap=" option and not the tail of some other option
+        bool isOption = (position == 0 || line[position - 1] == ' ');
+        position += 7;
+        if (!isOption) continue;
+
+        // Walk the comma-separated entries of this option
+        const char* p = line.c_str() + position;
+        while (*p && *p != ' ')
+        {
+            // Fetch "nn", the type, and "ss".  Forms like "memmap=exactmap" or a bare size (which
+            // limits memory rather than describing a region) have no type character
+            uint64_t size = parseSize(p);
+            char     type = *p;
+            uint64_t physAddr = 0;
+            bool     isRegion = (size != 0) && type && strchr("$!#@", type);
+            if (isRegion)
+            {
+                const char* q = ++p;
+                physAddr = parseSize(p);
+                if (p == q) throwRuntime("Malformed memmap= in %s", filename);
+            }
+
+            // Keep the regions the caller is interested in
+            if (isRegion && strchr(types, type))
+            {
+                result.push_back({physAddr, size, type, checkIomem(physAddr, size)});
+            }
+
+            // Skip to the next entry
+            while (*p && *p != ' ' && *p != ',') ++p;
+            if (*p == ',') ++p;
+        }
+    }
+
+    return result;
+}
+//=================================================================================================
 
-    // If we can't find "memmap=", something is awry
-    if (p == nullptr) throwRuntime("Malformed %s", filename);
 
-    // Fetch the value after the '='
-    auto size = parseKMG('=', p);
+//=================================================================================================
+// findContigRegions() - Returns the reserved regions that are safe to use as DMA buffers: the
+//                       '$' regions that the kernel isn't using as System RAM
+//=================================================================================================
+vector<memmapRegion_t> findContigRegions()
+{
+    vector<memmapRegion_t> result;
+
+    for (auto& region : findMemmapRegions("$"))
+    {
+        if (region.iomem == IOMEM_SYSTEM_RAM)
+        {
+            fprintf(stderr, "memmap= region at 0x%lx is System RAM in /proc/iomem, not using it\n",
+                    region.physAddr);
+            continue;
+        }
+        result.push_back(region);
+    }
+
+    return result;
+}
+//=================================================================================================
 
-    // Fetch the value after the '$'
-    auto physAddr = parseKMG('$', p);
 
-    // Warn the user if there's no reserved buffer
-    if (physAddr == 0) throwRuntime("No reserved contiguous buffer found!");
+//=================================================================================================
+// findContig() - Finds the physical address of the first reserved contiguous buffer
+//
+// On Exit: size = the size of the reserved buffer, in bytes (if the caller asked for it)
+//=================================================================================================
+uint64_t findContig(uint64_t* size)
+{
+    auto regions = findContigRegions();
 
-    // If we couldn't parse one of those values, /proc/cmdline is malformed
-    if (size < ONE_GIG) throwRuntime("Reserved buffer size of 0x%lx is too small!", size);
+    // Warn the user if there's no reserved buffer
+    if (regions.empty()) throwRuntime("No reserved contiguous buffer found!");
 
-    // Return the physical address of the reserved contiguous buffer
-    return physAddr;
+    // Return the physical address (and size) of the reserved contiguous buffer
+    if (size) *size = regions[0].size;
+    return regions[0].physAddr;
 }
 //=================================================================================================
-
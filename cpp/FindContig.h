@@ -0,0 +1,34 @@
+//=================================================================================================
+// FindContig.h - Defines routines for finding the memory regions carved out at Linux boot time
+//                with "memmap=" on the kernel command line
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+// This describes one "memmap=nn<type>ss" entry
+struct memmapRegion_t
+{
+    uint64_t physAddr;      // Where the region starts
+    uint64_t size;          // How many bytes it holds
+    char     type;          // '$' = reserved, '!' = legacy persistent memory, '#' = ACPI data
+    int      iomem;         // What /proc/iomem says it is: one of the IOMEM_xxx values
+};
+
+// These are what /proc/iomem can tell us about a region
+enum
+{
+    IOMEM_UNKNOWN,          // /proc/iomem shows no addresses (we're not root) or doesn't mention it
+    IOMEM_RESERVED,         // The kernel isn't using it, as the command line asked
+    IOMEM_SYSTEM_RAM        // Some of it is System RAM: the reservation didn't take effect
+};
+
+// Returns every "memmap=" region of the types in "types", in command-line order
+std::vector<memmapRegion_t> findMemmapRegions(const char* types = "$!#");
+
+// Returns the reserved ('$') regions that are safe to DMA into
+std::vector<memmapRegion_t> findContigRegions();
+
+// Returns the physical address (and size) of the first reserved region, or throws
+uint64_t findContig(uint64_t* size = nullptr);
+//=================================================================================================
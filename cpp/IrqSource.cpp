@@ -0,0 +1,90 @@
+//=================================================================================================
+// IrqSource.cpp - Opens the notification channel for one interrupt source of the userspace
+//                 interrupt driver in "driver"
+//
+// The driver either writes one byte to the FIFO "<dir>/interrupt<N>" each time source N fires,
+// or (when started with -eventfd) bumps an eventfd per source and hands the eventfds to anyone
+// who connects to the Unix socket "<dir>/interrupts.sock".  Either way, the file descriptor
+// becomes readable when the interrupt fires, so callers can poll(), select(), or epoll it
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <string>
+#include "IrqSocket.h"
+using namespace std;
+
+
+//=================================================================================================
+// receiveFD() - Connects to the driver's socket and fetches one of the file descriptors it
+//               hands out, closing the others
+//
+// Passed: dirName = the directory where the userspace interrupt driver creates its FIFOs
+//         flag    = IRQ_MSG_EVENTFDS or IRQ_MSG_RING
+//         irq     = for IRQ_MSG_EVENTFDS, the interrupt source we want the eventfd of
+//
+// Returns: the file descriptor, or -1 if the driver isn't handing out the one we want
+//=================================================================================================
+static int receiveFD(string dirName, int flag, int irq)
+{
+    irqSocketMsg_t message;
+    int            fd[IRQ_SOCKET_MAX_IRQS + 1];
+    int            wanted = -1, result = -1;
+
+    // Fetch the message and its file descriptors from the driver
+    int fdCount = receiveIrqFDs(dirName + "/" + IRQ_SOCKET_NAME, &message, fd);
+    if (fdCount < 0) return -1;
+
+    // The eventfds (if any) come first, followed by the ring (if there is one)
+    int eventFDs = (message.flags & IRQ_MSG_EVENTFDS) ? message.irqCount : 0;
+    if (flag == IRQ_MSG_EVENTFDS && eventFDs && irq < eventFDs) wanted = irq;
+    if (flag == IRQ_MSG_RING && (message.flags & IRQ_MSG_RING))  wanted = eventFDs;
+
+    // Keep the one we want and close the rest
+    for (int i=0; i<fdCount; ++i)
+    {
+        if (i == wanted)
+            result = fd[i];
+        else
+            ::close(fd[i]);
+    }
+
+    // Hand the caller the file descriptor they asked for
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// openIrqSource() - Returns a non-blocking file descriptor that becomes readable when the
+//                   specified interrupt source fires, or -1 if there isn't one
+//
+// Passed: dirName = the directory where the userspace interrupt driver creates its FIFOs
+//         irq     = the interrupt source
+//=================================================================================================
+int openIrqSource(string dirName, int irq)
+{
+    char filename[512];
+
+    // If the driver is handing out eventfds, use one of those
+    int fd = receiveFD(dirName, IRQ_MSG_EVENTFDS, irq);
+    if (fd >= 0) return fd;
+
+    // Otherwise, open the FIFO for this interrupt source
+    sprintf(filename, "%s/interrupt%d", dirName.c_str(), irq);
+    return ::open(filename, O_RDONLY | O_NONBLOCK);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// openIrqRing() - Returns the memfd of the driver's shared-memory event ring, or -1 if the
+//                 driver wasn't started with "-ring"
+//
+// Passed: dirName = the directory where the userspace interrupt driver creates its FIFOs
+//=================================================================================================
+int openIrqRing(string dirName)
+{
+    return receiveFD(dirName, IRQ_MSG_RING, 0);
+}
+//=================================================================================================
@@ -0,0 +1,95 @@
+//=================================================================================================
+// IrqWatch.cpp - Busy-polls the interrupt driver's shared-memory event ring and reports how many
+//                interrupts arrived, how many we missed, and how long each one took to go from
+//                the driver to us
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <stdexcept>
+#include "IrqRing.h"
+#include "Histogram.h"
+using namespace std;
+
+// This is defined in IrqSource.cpp
+int openIrqRing(string dirName);
+
+
+//=================================================================================================
+// throwRuntime() - Throws a runtime exception
+//=================================================================================================
+static void throwRuntime(const char* fmt, ...)
+{
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsprintf(buffer, fmt, ap);
+    va_end(ap);
+
+    throw runtime_error(buffer);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// watchIrqRing() - Consumes events from the driver's event ring for the specified amount of time
+//
+// Passed: dirName = the directory where the userspace interrupt driver creates its FIFOs
+//         seconds = how long to watch for
+//=================================================================================================
+void watchIrqRing(string dirName, int seconds)
+{
+    IrqRingReader    ring;
+    LatencyHistogram latency;
+    irqEvent_t       event;
+    uint64_t         startCount[32];
+
+    // Fetch the ring from the driver and map it
+    int fd = openIrqRing(dirName);
+    if (fd < 0) throwRuntime("No event ring in %s.  Was the driver started with -ring?", dirName.c_str());
+    bool ok = ring.attach(fd);
+    ::close(fd);
+    if (!ok) throwRuntime("The driver's event ring is malformed");
+
+    // Remember how many times each source had fired before we started
+    int irqCount = ring.irqCount();
+    for (int i=0; i<irqCount; ++i) startCount[i] = ring.sourceCount(i);
+
+    printf("Watching the interrupt event ring for %d seconds\n", seconds);
+
+    // Busy-poll the ring until our time is up
+    uint64_t endTime = irqRingTimestamp() + (uint64_t)(seconds * 1e9 * ring.ticksPerNS());
+    while (true)
+    {
+        uint64_t now = irqRingTimestamp();
+        if (now > endTime) break;
+
+        // Record how long each event took to get from the driver to us
+        while (ring.next(&event))
+        {
+            now = irqRingTimestamp();
+            latency.record(now > event.timestamp ? now - event.timestamp : 0);
+        }
+    }
+
+    // Convert timestamp ticks to nanoseconds
+    auto ns = [&](uint64_t ticks) {return ticks / ring.ticksPerNS();};
+
+    // Tell the user what we saw
+    printf("%lu events received, %lu missed\n", latency.count(), ring.lost());
+    if (latency.count())
+    {
+        printf("driver-to-consumer latency (ns): min %.0lf  p50 %.0lf  p99 %.0lf  p99.9 %.0lf  max %.0lf\n",
+               ns(latency.min()), ns(latency.percentile(50)), ns(latency.percentile(99)),
+               ns(latency.percentile(99.9)), ns(latency.max()));
+    }
+
+    for (int i=0; i<irqCount; ++i)
+    {
+        printf("   source %2d: %lu interrupts\n", i, ring.sourceCount(i) - startCount[i]);
+    }
+}
+//=================================================================================================
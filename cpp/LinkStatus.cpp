@@ -0,0 +1,81 @@
+//=================================================================================================
+// LinkStatus.cpp - Reads the current and maximum speed and width of a card's PCIe link
+//
+// Both come from the PCI Express capability in config space: the Link Capabilities register says
+// what the link can do, and the Link Status register says what it trained to.  Reading config
+// space beyond the first 64 bytes requires root
+//=================================================================================================
+#include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <string>
+using namespace std;
+
+// This is the capability ID of the PCI Express capability
+static const int PCIE_CAP_ID = 0x10;
+
+// These are offsets within the PCI Express capability
+static const int LINK_CAPABILITIES = 0x0C;
+static const int LINK_STATUS       = 0x12;
+
+
+//=================================================================================================
+// speedGTs() - Converts a link speed code from LnkCap or LnkSta into GT/sec
+//=================================================================================================
+static double speedGTs(int code)
+{
+    static const double speed[] = {0, 2.5, 5.0, 8.0, 16.0, 32.0, 64.0};
+    return (code > 0 && code < 7) ? speed[code] : 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readPcieLink() - Reads the state of a PCI function's link from its config space
+//
+// Passed:  bdf        = the PCI bus/device/function, i.e. "0000:01:00.0"
+//
+// On Exit: speed      = the speed the link trained to, in GT/sec
+//          width      = the number of lanes the link trained to
+//          maxSpeed   = the fastest speed the function supports, in GT/sec
+//          maxWidth   = the most lanes the function supports
+//
+// Returns: false if the function's config space (or its PCI Express capability) can't be read
+//=================================================================================================
+bool readPcieLink(string bdf, double* speed, int* width, double* maxSpeed, int* maxWidth)
+{
+    uint8_t config[256];
+
+    // Read the standard part of config space, which is where the capability list lives
+    int fd = ::open(("/sys/bus/pci/devices/" + bdf + "/config").c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    int bytesRead = ::pread(fd, config, sizeof config, 0);
+    ::close(fd);
+    if (bytesRead != sizeof config) return false;
+
+    // Walk the capability list looking for the PCI Express capability.  There can't be more
+    // than 48 capabilities in 256 bytes, so a longer list is corrupt
+    int offset = config[0x34] & 0xFC;
+    for (int i = 0; offset && i < 48; ++i, offset = config[offset + 1] & 0xFC)
+    {
+        if (config[offset] != PCIE_CAP_ID) continue;
+        if (offset + LINK_STATUS + 2 > sizeof config) return false;
+
+        // Fetch the Link Capabilities and Link Status registers
+        const uint8_t* cap = config + offset;
+        uint32_t linkCap = cap[LINK_CAPABILITIES] | (cap[LINK_CAPABILITIES + 1] << 8)
+                         | (cap[LINK_CAPABILITIES + 2] << 16) | (cap[LINK_CAPABILITIES + 3] << 24);
+        uint16_t linkSta = cap[LINK_STATUS] | (cap[LINK_STATUS + 1] << 8);
+
+        // In both, speed is in bits 3:0 and width is in bits 9:4
+        *maxSpeed = speedGTs(linkCap & 0xF);
+        *maxWidth = (linkCap >> 4) & 0x3F;
+        *speed    = speedGTs(linkSta & 0xF);
+        *width    = (linkSta >> 4) & 0x3F;
+        return true;
+    }
+
+    // If we get here, this function has no PCI Express capability
+    return false;
+}
+//=================================================================================================
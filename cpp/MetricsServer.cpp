@@ -0,0 +1,111 @@
+//=================================================================================================
+// MetricsServer.cpp - A minimal HTTP server that hands out a page of Prometheus metrics
+//
+// The server doesn't have a thread of its own.  The caller opens a listening socket, and while
+// it has nothing better to do (i.e., between samples) it calls serveMetrics(), which answers
+// every request that arrives with the current page until a deadline passes.  Every request gets
+// the same page regardless of its path, which is all a Prometheus scraper needs
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <string>
+using namespace std;
+
+
+//=================================================================================================
+// openMetricsServer() - Creates a socket that listens for HTTP connections on a TCP port
+//
+// Returns: the listening socket, or -1 if the port can't be opened
+//=================================================================================================
+int openMetricsServer(int port)
+{
+    int one = 1;
+
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (bind(sock, (sockaddr*)&addr, sizeof addr) < 0 || listen(sock, 8) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// answer() - Reads one request from a new connection and replies with the metrics page
+//=================================================================================================
+static void answer(int conn, const string& page)
+{
+    char buffer[2048];
+    char header[256];
+
+    // Wait briefly for the request.  We don't care what it says
+    pollfd pfd = {conn, POLLIN, 0};
+    if (poll(&pfd, 1, 1000) <= 0 || recv(conn, buffer, sizeof buffer, 0) <= 0) return;
+
+    int length = sprintf(header, "HTTP/1.0 200 OK\r\n"
+                                 "Content-Type: text/plain; version=0.0.4\r\n"
+                                 "Content-Length: %zu\r\n"
+                                 "Connection: close\r\n\r\n", page.size());
+
+    if (send(conn, header, length, MSG_NOSIGNAL) == length)
+    {
+        send(conn, page.data(), page.size(), MSG_NOSIGNAL);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// serveMetrics() - Answers HTTP requests with "page" until "seconds" have passed.  With no
+//                  server socket, this just sleeps
+//=================================================================================================
+void serveMetrics(int sock, const string& page, double seconds)
+{
+    timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec  += (time_t)seconds;
+    deadline.tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+    if (deadline.tv_nsec >= 1000000000) deadline.tv_sec++, deadline.tv_nsec -= 1000000000;
+
+    while (true)
+    {
+        // Find out how long we have left
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t ms = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+        if (ms <= 0) return;
+
+        // If there's no server, there's nothing to do but wait
+        if (sock < 0)
+        {
+            usleep(ms * 1000);
+            continue;
+        }
+
+        // Wait for a connection, and answer it
+        pollfd pfd = {sock, POLLIN, 0};
+        if (poll(&pfd, 1, ms) <= 0) continue;
+        int conn = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn < 0) continue;
+        answer(conn, page);
+        close(conn);
+    }
+}
+//=================================================================================================
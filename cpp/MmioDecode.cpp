@@ -0,0 +1,139 @@
+//=================================================================================================
+// MmioDecode.cpp - Prints a trace file written by MmioTrace::dump() in human readable form
+//
+// The decoder knows the register maps of the standard Sidewinder bitstream, so each access is
+// shown with the name of the block and register it touched
+//=================================================================================================
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "MmioTrace.h"
+using namespace std;
+
+// This describes one AXI slave in BAR0, and the names of its 32-bit registers
+struct block_t
+{
+    uint32_t            offset;
+    const char*         name;
+    vector<const char*> reg;
+};
+
+// These are the AXI slaves in BAR0 of the standard bitstream
+static const vector<block_t> blocks =
+{
+    {0x0000, "revision",    {"MAJOR", "MINOR", "BUILD", "DATE", "CLKS", "SLOT1", "SLOT2", "SLOT3"}},
+    {0x1000, "pci_bw",      {"RADDR_H", "RADDR_L", "WADDR_H", "WADDR_L", "BLK_SIZE", "COUNT",
+                             "RRESULT_H", "RRESULT_L", "WRESULT_H", "WRESULT_L", "CTL_STAT"}},
+    {0x2000, "ram_bw",      {"RADDR_H", "RADDR_L", "WADDR_H", "WADDR_L", "BLK_SIZE", "COUNT",
+                             "RRESULT_H", "RRESULT_L", "WRESULT_H", "WRESULT_L", "CTL_STAT"}},
+    {0x3000, "adder",       {"OP1", "OP2", "SUM", "SCRATCH"}},
+    {0x4000, "int_manager", {"IRQ_MAP", "IRQ_CLR"}}
+};
+
+
+//=================================================================================================
+// registerName() - Returns the name of the register at a byte offset in BAR0, and fills in a
+//                  note that says what the access means, if there's anything interesting to say
+//=================================================================================================
+static string registerName(uint64_t offset, bool isWrite, uint64_t value, string* note)
+{
+    char buffer[64];
+
+    for (auto& block : blocks)
+    {
+        if (offset < block.offset || offset >= block.offset + 0x1000) continue;
+        uint32_t index = (offset - block.offset) / 4;
+        string   name  = block.name;
+
+        // If it's not a register we know about, just show where it is within the block
+        if (index >= block.reg.size())
+        {
+            sprintf(buffer, "+0x%lx", offset - block.offset);
+            return name + buffer;
+        }
+        name = name + "." + block.reg[index];
+
+        // The control/status register of a measure_bw core starts reads and writes
+        if (!strcmp(block.reg[index], "CTL_STAT"))
+        {
+            if (value & 1) *note += isWrite ? "start read " : "read busy ";
+            if (value & 2) *note += isWrite ? "start write" : "write busy";
+            if (!isWrite && value == 0) *note = "idle";
+        }
+
+        // Writing a bit into the interrupt manager raises that interrupt source, and writing a bit
+        // into its second register clears it.  That register reads back as the IRQ_ACK count
+        if (block.offset == 0x4000 && index == 1 && !isWrite) name = string(block.name) + ".ACK_COUNT";
+        if (block.offset == 0x4000 && index == 0 && isWrite)  *note = "raise sources";
+        if (block.offset == 0x4000 && index == 1 && isWrite)  *note = "clear sources";
+        if (block.offset == 0x4000 && index == 0 && !isWrite) *note = "pending sources";
+
+        return name;
+    }
+
+    // This isn't in any block we know about
+    sprintf(buffer, "bar0+0x%lx", offset);
+    return buffer;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// decodeMmioTrace() - Reads a trace file and prints one line per register access
+//
+// Returns: false if the file can't be read
+//=================================================================================================
+bool decodeMmioTrace(string filename)
+{
+    mmioTraceHeader_t header;
+    mmioTraceRecord_t record;
+
+    // Open the file and make sure it's a trace
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Can't open %s\n", filename.c_str());
+        return false;
+    }
+    if (fread(&header, sizeof header, 1, file) != 1 || memcmp(header.magic, "MMIOTRC1", 8) != 0)
+    {
+        fprintf(stderr, "%s isn't an MMIO trace\n", filename.c_str());
+        fclose(file);
+        return false;
+    }
+
+    // Tell the user what's in the trace
+    printf("%lu accesses from %u thread(s)", header.recordCount, header.threadCount);
+    if (header.lostCount) printf(", %lu older accesses were overwritten", header.lostCount);
+    printf("\n\n     time (us)  thr  dir  w  register                    value\n");
+
+    // And print each access
+    while (fread(&record, sizeof record, 1, file) == 1)
+    {
+        bool   isWrite = (record.flags & MmioTrace::WRITE) != 0;
+        int    width   = record.flags & MmioTrace::WIDTH_MASK;
+        double us      = (int64_t)(record.tick - header.firstTick) / header.ticksPerNS / 1000;
+        string note, name;
+        char   buffer[64];
+
+        // Accesses to BAR0 are named by register.  Anything else is shown by address
+        if (record.bar == 0)
+            name = registerName(record.offset, isWrite, record.value, &note);
+        else
+        {
+            if (record.bar == 0xFF)
+                sprintf(buffer, "addr 0x%lx", record.offset);
+            else
+                sprintf(buffer, "bar%u+0x%lx", record.bar, record.offset);
+            name = buffer;
+        }
+
+        printf("%14.3lf  %3u  %-3s  %d  %-26s  0x%0*lx  %s\n", us, record.thread, isWrite ? "W" : "R",
+               width, name.c_str(), width * 2, record.value, note.c_str());
+    }
+
+    fclose(file);
+    return true;
+}
+//=================================================================================================
@@ -0,0 +1,181 @@
+//=================================================================================================
+// MmioLatency.cpp - Measures the round-trip latency of single 32-bit register accesses over BAR0
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "Histogram.h"
+#include "RegisterBlock.h"
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+using namespace std;
+
+// These are the base addresses of the AXI slaves we use as latency targets
+static const int AXI_REVISION = 0x0000;
+static const int AXI_ADDER    = 0x3000;
+
+// Register map for the "axi_adder" RTL core
+enum {ADDER_OPERAND1 = 0, ADDER_OPERAND2 = 1, ADDER_SUM = 2, ADDER_SCRATCH = 3};
+
+
+//=================================================================================================
+// readTimer() - Returns the current value of the fastest timer we have available.  On x86 that's
+//               the TSC, fenced so that it can't be reordered around the access being timed
+//=================================================================================================
+static inline uint64_t readTimer()
+{
+#if defined(__x86_64__)
+    _mm_lfence();
+    uint64_t tsc = __rdtsc();
+    _mm_lfence();
+    return tsc;
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// ticksPerNanosecond() - Measures how fast readTimer() ticks
+//=================================================================================================
+static double ticksPerNanosecond()
+{
+#if defined(__x86_64__)
+    timespec t0, t1;
+
+    // Count timer ticks across 100 milliseconds of wall-clock time
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+    uint64_t tick0 = readTimer();
+    usleep(100000);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+    uint64_t tick1 = readTimer();
+
+    // Convert that to ticks per nanosecond
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    return (tick1 - tick0) / ns;
+#else
+    return 1.0;
+#endif
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// timerOverhead() - Returns the smallest number of ticks it takes to take two back-to-back
+//                   readings of the timer.  We subtract this from every sample
+//=================================================================================================
+static uint64_t timerOverhead()
+{
+    uint64_t best = UINT64_MAX;
+
+    for (int i=0; i<100000; ++i)
+    {
+        uint64_t t0 = readTimer();
+        uint64_t t1 = readTimer();
+        if (t1 - t0 < best) best = t1 - t0;
+    }
+
+    return best;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// report() - Displays the percentiles of a latency histogram
+//=================================================================================================
+static void report(const char* name, const LatencyHistogram& h, double ticksPerNS)
+{
+    auto ns = [&](uint64_t ticks) {return ticks / ticksPerNS;};
+
+    printf("%-28s %8.0lf %8.0lf %8.0lf %8.0lf %8.0lf %8.0lf\n", name, ns(h.min()),
+           ns(h.percentile(50)), ns(h.percentile(99)), ns(h.percentile(99.9)),
+           ns(h.percentile(99.99)), ns(h.max()));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// measureMmioLatency() - Times single, uncached register reads and writes over BAR0 and reports
+//                        a percentile histogram for each kind of access
+//
+// Passed: bar0       = userspace address where BAR0 is mapped
+//         iterations = the number of samples to take for each kind of access
+//=================================================================================================
+void measureMmioLatency(uint8_t* bar0, int iterations)
+{
+    LatencyHistogram h;
+    uint64_t t0, t1;
+    uint32_t errors = 0;
+
+    // These are the registers of the two cores we're going to talk to
+    RegisterBlockAt<AXI_REVISION> revision(bar0);
+    RegisterBlockAt<AXI_ADDER>    adder(bar0);
+
+    // Find out how fast our timer runs and how much it costs to read it
+    double   ticksPerNS = ticksPerNanosecond();
+    uint64_t overhead   = timerOverhead();
+
+    // Subtracts the cost of reading the timer from a sample
+    auto elapsed = [&](uint64_t start, uint64_t end)
+                   {return (end - start > overhead) ? end - start - overhead : 0;};
+
+    printf("MMIO latency over BAR0, %d samples per access type (nanoseconds)\n", iterations);
+    printf("%-28s %8s %8s %8s %8s %8s %8s\n", "access", "min", "p50", "p99", "p99.9", "p99.99", "max");
+
+    // Time single reads of the revision core
+    for (int i=0; i<iterations; ++i)
+    {
+        t0 = readTimer();
+        revision.read<0>();
+        t1 = readTimer();
+        h.record(elapsed(t0, t1));
+    }
+    report("read  axi_revision", h, ticksPerNS);
+
+    // Time single reads of the adder's computed sum
+    h.reset();
+    for (int i=0; i<iterations; ++i)
+    {
+        t0 = readTimer();
+        adder.read<ADDER_SUM>();
+        t1 = readTimer();
+        h.record(elapsed(t0, t1));
+    }
+    report("read  axi_adder sum", h, ticksPerNS);
+
+    // Time single posted writes to the adder's scratchpad.  This is the cost to the CPU of
+    // issuing the write, not the time it takes for the write to land
+    h.reset();
+    for (int i=0; i<iterations; ++i)
+    {
+        t0 = readTimer();
+        adder.write<ADDER_SCRATCH>(i);
+        t1 = readTimer();
+        h.record(elapsed(t0, t1));
+    }
+    report("write axi_adder (posted)", h, ticksPerNS);
+
+    // Time a write followed by a read that depends on it.  This is the round trip that a
+    // "write a command, then check the result" control-plane transaction costs
+    h.reset();
+    adder.write<ADDER_OPERAND2>(1);
+    for (int i=0; i<iterations; ++i)
+    {
+        t0 = readTimer();
+        adder.write<ADDER_OPERAND1>(i);
+        uint32_t sum = adder.read<ADDER_SUM>();
+        t1 = readTimer();
+        h.record(elapsed(t0, t1));
+        if (sum != (uint32_t)i + 1) ++errors;
+    }
+    report("write + read-back axi_adder", h, ticksPerNS);
+
+    // If the adder ever gave us the wrong answer, the latencies above can't be trusted
+    if (errors) printf("WARNING: axi_adder returned %u incorrect sums\n", errors);
+}
+//=================================================================================================
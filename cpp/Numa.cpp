@@ -0,0 +1,174 @@
+//=================================================================================================
+// Numa.cpp - Routines for finding out which NUMA node a PCI device or a piece of physical memory
+//            belongs to, and for keeping ourselves (and our memory) on a node
+//
+// Everything here comes from sysfs and procfs, so none of it needs libnuma.  On a machine that
+// isn't NUMA (or a kernel built without NUMA support), everything is on node 0
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <string>
+#include <vector>
+#include <fstream>
+using namespace std;
+
+
+//=================================================================================================
+// parseCpuList() - Parses a sysfs CPU list such as "0-7,16-23" into a cpu_set_t
+//
+// Returns: the number of CPUs in the list
+//=================================================================================================
+static int parseCpuList(const string& list, cpu_set_t* cpuSet)
+{
+    const char* p = list.c_str();
+    int         count = 0;
+
+    CPU_ZERO(cpuSet);
+
+    while (*p >= '0' && *p <= '9')
+    {
+        // Fetch the first CPU of this range, and the last one if it's a range
+        char* end;
+        int first = strtol(p, &end, 10);
+        int last  = (*end == '-') ? strtol(end + 1, &end, 10) : first;
+
+        // Add every CPU in the range to the set
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu, ++count) CPU_SET(cpu, cpuSet);
+
+        // Skip over the comma to the next range
+        p = (*end == ',') ? end + 1 : end;
+    }
+
+    return count;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// numaNodeCount() - Returns the number of NUMA nodes that have CPUs or memory
+//=================================================================================================
+int numaNodeCount()
+{
+    dirent* entry;
+    int     count = 0;
+
+    // Each node has a "nodeN" directory
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (dir == nullptr) return 1;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        if (strncmp(entry->d_name, "node", 4) == 0 && isdigit(entry->d_name[4])) ++count;
+    }
+    closedir(dir);
+
+    return count ? count : 1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// numaNodeOfDevice() - Returns the NUMA node that a PCI device is attached to
+//
+// Returns: the node number, or -1 if the platform doesn't say
+//=================================================================================================
+int numaNodeOfDevice(string bdf)
+{
+    int node = -1;
+
+    ifstream file("/sys/bus/pci/devices/" + bdf + "/numa_node");
+    if (file.is_open()) file >> node;
+    return node;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// numaNodeOfAddress() - Returns the NUMA node that a physical address belongs to
+//
+// /proc/zoneinfo gives the page-frame range that each zone of each node spans.  An address
+// reserved with "memmap=" isn't RAM as far as the kernel is concerned, so if it was carved from
+// the top of a node's memory it can fall just past that node's span.  In that case it belongs to
+// the node whose memory starts closest below it
+//
+// Returns: the node number, or -1 if the address isn't anywhere we know about
+//=================================================================================================
+int numaNodeOfAddress(uint64_t physAddr)
+{
+    string   line;
+    int      node = -1, bestNode = -1;
+    uint64_t spanned = 0, bestStart = 0;
+    uint64_t pfn = physAddr / getpagesize();
+
+    ifstream file("/proc/zoneinfo");
+    if (!file.is_open()) return -1;
+
+    while (getline(file, line))
+    {
+        const char* p = line.c_str();
+        while (*p == ' ') ++p;
+
+        // "Node 1, zone   Normal" starts the description of a zone
+        if (sscanf(p, "Node %d,", &node) == 1) spanned = 0;
+
+        // The number of pages the zone spans comes before the first page it spans
+        else if (strncmp(p, "spanned ", 8) == 0)
+            spanned = strtoull(p + 8, nullptr, 10);
+
+        else if (strncmp(p, "start_pfn:", 10) == 0 && spanned)
+        {
+            uint64_t start = strtoull(p + 10, nullptr, 10);
+            if (pfn >= start && pfn < start + spanned) return node;
+            if (start <= pfn && (bestNode < 0 || start > bestStart)) bestNode = node, bestStart = start;
+        }
+    }
+
+    return bestNode;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// pinToNode() - Restricts the calling thread (and any threads it creates afterwards) to the CPUs
+//               of a NUMA node
+//
+// Returns: true if it worked
+//=================================================================================================
+bool pinToNode(int node)
+{
+    string    list;
+    cpu_set_t cpuSet;
+
+    ifstream file("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+    if (!file.is_open() || !getline(file, list) || parseCpuList(list, &cpuSet) == 0) return false;
+
+    return sched_setaffinity(0, sizeof cpuSet, &cpuSet) == 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// bindMemoryToNode() - Makes the calling thread's future memory allocations come from a single
+//                      NUMA node, or (with node = -1) go back to the default policy
+//
+// Returns: true if it worked
+//=================================================================================================
+bool bindMemoryToNode(int node)
+{
+    unsigned long mask = 0;
+
+    if (node < 0) return syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0) == 0;
+
+    // The kernel reads one bit fewer than "maxnode"
+    if (node >= 8 * (int)sizeof mask) return false;
+    mask = 1UL << node;
+    return syscall(SYS_set_mempolicy, MPOL_BIND, &mask, 8 * sizeof mask + 1) == 0;
+}
+//=================================================================================================
@@ -0,0 +1,259 @@
+//=================================================================================================
+// Verify.cpp - Checks the data that a bandwidth measurement actually moved
+//
+// A measure_bw core writes a counter into the top 32 bits (bytes 60-63) of every 64-byte beat
+// and zeros into the rest; the counter starts at 0 with each measurement and goes up by one per
+// beat.  So beat N of a write that started at address A lives at A + 64*N and must hold N.
+//
+// For data the host writes, we use a pseudo-random pattern in which every 64-bit word is a hash
+// of its own offset and a seed.  Any piece of it can be generated (or checked) without knowing
+// the rest, which lets us spread the work across threads.  Everything here is memory-bound, so
+// each kernel makes one pass, accumulates mismatches without branching, and only goes back to
+// look for the exact failing beat when a chunk is bad
+//=================================================================================================
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "PciDevice.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+// Everything is checked in units of one 64-byte beat
+static const size_t BEAT = 64;
+
+// Each kernel call handles a chunk of this many beats (256 KB)
+static const size_t CHUNK_BEATS = 4096;
+
+// This is the signature of a kernel that checks "count" beats, the first of which is beat "first"
+// of the whole region.  It returns true if every beat is good
+typedef bool (*checker_t)(const uint8_t* beat, uint64_t first, size_t count, uint64_t seed);
+
+
+//=================================================================================================
+// prbsWord() - Returns the pseudo-random 64-bit word that belongs at word-offset "index" for the
+//              specified seed.  This is splitmix64, which is cheap and has no short cycles
+//=================================================================================================
+static inline uint64_t prbsWord(uint64_t seed, uint64_t index)
+{
+    uint64_t z = seed + (index + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// checkCounterPlain() - Checks beats written by a measure_bw core, using ordinary 64-bit loads
+//=================================================================================================
+static bool checkCounterPlain(const uint8_t* beat, uint64_t first, size_t count, uint64_t)
+{
+    uint64_t bad = 0;
+
+    for (size_t i=0; i<count; ++i, beat += BEAT)
+    {
+        const uint64_t* w = (const uint64_t*)beat;
+        uint64_t expected = (uint64_t)(uint32_t)(first + i) << 32;
+        bad |= w[0] | w[1] | w[2] | w[3] | w[4] | w[5] | w[6] | (w[7] ^ expected);
+    }
+
+    return bad == 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// checkPrbsPlain() - Checks beats of the host's pseudo-random pattern
+//=================================================================================================
+static bool checkPrbsPlain(const uint8_t* beat, uint64_t first, size_t count, uint64_t seed)
+{
+    const uint64_t* w     = (const uint64_t*)beat;
+    uint64_t        index = first * (BEAT / 8);
+    uint64_t        bad   = 0;
+
+    for (size_t i=0; i<count * (BEAT / 8); ++i) bad |= w[i] ^ prbsWord(seed, index + i);
+
+    return bad == 0;
+}
+//=================================================================================================
+
+
+#if defined(__x86_64__)
+//=================================================================================================
+// checkCounterAvx2() - Checks beats written by a measure_bw core, 32 bytes at a time.  The
+//                      expected upper half of each beat is kept in a register and incremented
+//=================================================================================================
+__attribute__((target("avx2")))
+static bool checkCounterAvx2(const uint8_t* beat, uint64_t first, size_t count, uint64_t)
+{
+    const __m256i increment = _mm256_set_epi32(1, 0, 0, 0, 0, 0, 0, 0);
+    __m256i       expected  = _mm256_set_epi32((int)(uint32_t)first, 0, 0, 0, 0, 0, 0, 0);
+    __m256i       bad       = _mm256_setzero_si256();
+
+    for (size_t i=0; i<count; ++i, beat += BEAT)
+    {
+        __m256i lower = _mm256_loadu_si256((const __m256i*)beat);
+        __m256i upper = _mm256_loadu_si256((const __m256i*)(beat + 32));
+        bad      = _mm256_or_si256(bad, _mm256_or_si256(lower, _mm256_xor_si256(upper, expected)));
+        expected = _mm256_add_epi32(expected, increment);
+    }
+
+    return _mm256_testz_si256(bad, bad);
+}
+//=================================================================================================
+#endif
+
+
+//=================================================================================================
+// bestCounterChecker() - Returns the fastest counter-pattern checker this CPU can run
+//=================================================================================================
+static checker_t bestCounterChecker()
+{
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) return checkCounterAvx2;
+#endif
+    return checkCounterPlain;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// checkRegion() - Splits a region into chunks and checks them across threads
+//
+// Passed:  region      = the start of the region (must be 64-byte aligned)
+//          length      = the length of the region in bytes.  A partial beat at the end is ignored
+//          threadCount = the number of threads to spread the work across
+//          checker     = the kernel that checks a chunk
+//          seed        = handed to the kernel
+//
+// On Exit: firstBad    = the offset of the first bad beat (if there is one)
+//
+// Returns: the number of bad beats
+//=================================================================================================
+static uint64_t checkRegion(const uint8_t* region, size_t length, int threadCount,
+                            checker_t checker, uint64_t seed, uint64_t* firstBad)
+{
+    size_t           beats = length / BEAT;
+    size_t           chunks = (beats + CHUNK_BEATS - 1) / CHUNK_BEATS;
+    atomic<size_t>   nextChunk(0);
+    atomic<uint64_t> badBeats(0);
+    atomic<uint64_t> firstBadBeat(UINT64_MAX);
+    vector<thread>   threads;
+
+    // Each thread claims the next unchecked chunk until there aren't any
+    auto worker = [&]()
+    {
+        size_t chunk;
+        while ((chunk = nextChunk++) < chunks)
+        {
+            uint64_t first = chunk * CHUNK_BEATS;
+            size_t   count = (beats - first) < CHUNK_BEATS ? (beats - first) : CHUNK_BEATS;
+
+            // In the usual case, the whole chunk is good
+            if (checker(region + first * BEAT, first, count, seed)) continue;
+
+            // Otherwise, check each beat to find out exactly which ones are bad
+            for (size_t i=0; i<count; ++i)
+            {
+                uint64_t n = first + i;
+                if (checker(region + n * BEAT, n, 1, seed)) continue;
+                ++badBeats;
+                uint64_t prior = firstBadBeat;
+                while (n < prior && !firstBadBeat.compare_exchange_weak(prior, n));
+            }
+        }
+    };
+
+    // Spread the work across threads
+    if (threadCount < 1) threadCount = 1;
+    for (int i=0; i<threadCount; ++i) threads.push_back(thread(worker));
+    for (auto& t : threads) t.join();
+
+    // Tell the caller where the first bad beat was, and how many there were
+    if (firstBad) *firstBad = (firstBadBeat == UINT64_MAX) ? 0 : firstBadBeat * BEAT;
+    return badBeats;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// fillRegion() - Fills a region across threads.  If "prbs" is true the region gets the host's
+//                pseudo-random pattern, otherwise every byte is 0xFF.  Stores to a write-combining
+//                mapping are flushed at the end
+//=================================================================================================
+static void fillRegion(uint8_t* region, size_t length, int threadCount, bool prbs, uint64_t seed)
+{
+    size_t         beats  = length / BEAT;
+    size_t         chunks = (beats + CHUNK_BEATS - 1) / CHUNK_BEATS;
+    atomic<size_t> nextChunk(0);
+    vector<thread> threads;
+
+    auto worker = [&]()
+    {
+        size_t chunk;
+        while ((chunk = nextChunk++) < chunks)
+        {
+            uint64_t  first = chunk * CHUNK_BEATS;
+            size_t    count = (beats - first) < CHUNK_BEATS ? (beats - first) : CHUNK_BEATS;
+            uint64_t* w     = (uint64_t*)(region + first * BEAT);
+            uint64_t  index = first * (BEAT / 8);
+
+            for (size_t i=0; i<count * (BEAT / 8); ++i) w[i] = prbs ? prbsWord(seed, index + i) : ~0ULL;
+        }
+        PciDevice::flushWC();
+    };
+
+    if (threadCount < 1) threadCount = 1;
+    for (int i=0; i<threadCount; ++i) threads.push_back(thread(worker));
+    for (auto& t : threads) t.join();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// poisonRegion() - Fills a region with 0xFF so that data left over from an earlier measurement
+//                  can't pass for data written by the next one
+//=================================================================================================
+void poisonRegion(uint8_t* region, size_t length, int threadCount)
+{
+    fillRegion(region, length, threadCount, false, 0);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// checkEnginePattern() - Checks a region written by a measure_bw core
+//
+// Returns: the number of bad 64-byte beats.  "firstBad" gets the offset of the first one
+//=================================================================================================
+uint64_t checkEnginePattern(const uint8_t* region, size_t length, int threadCount, uint64_t* firstBad)
+{
+    return checkRegion(region, length, threadCount, bestCounterChecker(), 0, firstBad);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// fillPrbs() - Fills a region with the host's pseudo-random pattern
+//=================================================================================================
+void fillPrbs(uint8_t* region, size_t length, uint64_t seed, int threadCount)
+{
+    fillRegion(region, length, threadCount, true, seed);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// checkPrbs() - Checks a region that was filled by fillPrbs()
+//
+// Returns: the number of bad 64-byte beats.  "firstBad" gets the offset of the first one
+//=================================================================================================
+uint64_t checkPrbs(const uint8_t* region, size_t length, uint64_t seed, int threadCount, uint64_t* firstBad)
+{
+    return checkRegion(region, length, threadCount, checkPrbsPlain, seed, firstBad);
+}
+//=================================================================================================
@@ -0,0 +1,310 @@
+//=================================================================================================
+// bench.cpp - Microbenchmarks of the host library's hot paths that run without a Sidewinder
+//
+// Build with "make bench" and run "./measure_bw_bench.x86".  No hardware or root is needed:
+//   - PCI discovery and PciDevice::open() are timed against a mock sysfs tree in a scratch
+//     directory, in which one of the functions is a Sidewinder whose BARs are ordinary files
+//   - the RegisterBlock accessors are timed against a mock BAR backed by anonymous memory, next
+//     to the raw volatile accesses they're supposed to compile down to
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <string>
+#include <filesystem>
+#include <stdexcept>
+#include "PciDevice.h"
+#include "PciDiscovery.h"
+#include "RegisterBlock.h"
+
+using namespace std;
+
+void benchDiscovery(int functionCount);
+void benchSysfs();
+void benchRegisters();
+void parseCommandLine(const char** argv);
+
+// Configuration parameters from the command line
+struct conf_t
+{
+    int iterations;
+} conf;
+
+// These are the PCI IDs of a Sidewinder, and of the functions that surround it in the mock tree
+static const int SW_VENDOR = 0x10ee, SW_DEVICE = 0x903f;
+static const int NOT_VENDOR = 0x8086, NOT_DEVICE = 0x1234;
+
+// These are the sizes of the mock Sidewinder's BARs
+static const size_t MOCK_BAR0_SIZE = 0x10000;
+static const size_t MOCK_BAR1_SIZE = 0x400000;
+
+// These are the numbers of PCI functions the mock sysfs tree is built with
+static const int treeSize[] = {16, 64, 256};
+
+// Each timing is repeated this many times, and the fastest one is reported
+static const int REPEATS = 5;
+
+// This is a place to throw away values
+static volatile uint64_t bitBucket;
+
+
+//=================================================================================================
+// main() - Runs every benchmark and prints one line per result
+//=================================================================================================
+int main(int argc, const char** argv)
+{
+    try
+    {
+        parseCommandLine(argv);
+
+        for (int functionCount : treeSize) benchDiscovery(functionCount);
+        benchSysfs();
+        benchRegisters();
+    }
+    catch (const exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        exit(1);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// parseCommandLine() - Parses the command line parameters
+//=================================================================================================
+void parseCommandLine(const char** argv)
+{
+    int i = 0;
+
+    // Set up defaults
+    conf.iterations = 200;
+
+    while (argv[++i])
+    {
+        const char* arg = argv[i];
+
+        if (strcmp(arg, "-iterations") == 0 && argv[i+1])
+        {
+            conf.iterations = atoi(argv[++i]);
+            if (conf.iterations < 1) throw runtime_error("-iterations must be at least 1");
+            continue;
+        }
+
+        fprintf(stderr, "Usage: measure_bw_bench [-iterations <count>]\n");
+        exit(1);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// nanoTime() - Returns the current time in nanoseconds
+//=================================================================================================
+static uint64_t nanoTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// nsPerCall() - Calls "op" "count" times, REPEATS times over, and returns the fastest average
+//               time per call in nanoseconds.  "op" is a template parameter so that it inlines,
+//               which matters when what's being timed is a single load or store
+//=================================================================================================
+template <class F> static double nsPerCall(int count, F op)
+{
+    double best = 0;
+
+    for (int repeat = 0; repeat < REPEATS; ++repeat)
+    {
+        uint64_t startTime = nanoTime();
+        for (int i=0; i<count; ++i) op();
+        double ns = (double)(nanoTime() - startTime) / count;
+        if (repeat == 0 || ns < best) best = ns;
+    }
+
+    return best;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// writeFile() - Creates a file with the specified contents
+//=================================================================================================
+static void writeFile(string name, const void* data, size_t length)
+{
+    int fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    bool ok = (fd >= 0) && ::write(fd, data, length) == length;
+    if (fd >= 0) ::close(fd);
+    if (!ok) throw runtime_error("Can't write " + name);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// makeFunction() - Creates the sysfs directory of one mock PCI function
+//
+// Every function gets a "config" file with its IDs in it.  The Sidewinder also gets a "resource"
+// file describing BAR0 and BAR1, and sparse "resource0" and "resource1" files to map them through
+//=================================================================================================
+static void makeFunction(string dir, int vendorID, int deviceID)
+{
+    uint8_t config[256] = {0};
+    char    resource[1024], *p = resource;
+
+    if (mkdir(dir.c_str(), 0777) != 0) throw runtime_error("Can't create " + dir);
+
+    config[0] = vendorID & 0xFF;
+    config[1] = vendorID >> 8;
+    config[2] = deviceID & 0xFF;
+    config[3] = deviceID >> 8;
+    writeFile(dir + "/config", config, sizeof config);
+
+    if (vendorID != SW_VENDOR || deviceID != SW_DEVICE) return;
+
+    // One line per potential resource: start, end, flags.  Unused resources are all zeros
+    const uint64_t bar0 = 0xf0000000, bar1 = 0xe0000000;
+    p += sprintf(p, "0x%016lx 0x%016lx 0x%016lx\n", bar0, bar0 + MOCK_BAR0_SIZE - 1, 0x40200UL);
+    p += sprintf(p, "0x%016lx 0x%016lx 0x%016lx\n", bar1, bar1 + MOCK_BAR1_SIZE - 1, 0x4220cUL);
+    for (int i=2; i<13; ++i) p += sprintf(p, "0x%016x 0x%016x 0x%016x\n", 0, 0, 0);
+    writeFile(dir + "/resource", resource, p - resource);
+
+    writeFile(dir + "/resource0", "", 0);
+    writeFile(dir + "/resource1", "", 0);
+    if (truncate((dir + "/resource0").c_str(), MOCK_BAR0_SIZE) != 0
+    ||  truncate((dir + "/resource1").c_str(), MOCK_BAR1_SIZE) != 0)
+        throw runtime_error("Can't size the mock BARs in " + dir);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// makeMockSysfs() - Creates a mock "/sys/bus/pci/devices" in a scratch directory, with a single
+//                   Sidewinder in the middle of "functionCount" PCI functions
+//
+// Returns: the name of the directory
+//=================================================================================================
+static string makeMockSysfs(int functionCount)
+{
+    char name[] = "/tmp/measure_bw_bench.XXXXXX";
+    if (mkdtemp(name) == nullptr) throw runtime_error("Can't create a scratch directory in /tmp");
+
+    for (int i=0; i<functionCount; ++i)
+    {
+        char bdf[32];
+        sprintf(bdf, "0000:%02x:%02x.%d", i / 32, i % 32, 0);
+        bool isCard = (i == functionCount / 2);
+        makeFunction(string(name) + "/" + bdf, isCard ? SW_VENDOR : NOT_VENDOR, isCard ? SW_DEVICE : NOT_DEVICE);
+    }
+
+    return name;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// benchDiscovery() - Times finding and opening a Sidewinder in a mock sysfs tree
+//=================================================================================================
+void benchDiscovery(int functionCount)
+{
+    PciDevice device;
+    char      title[64];
+
+    string dir = makeMockSysfs(functionCount);
+
+    double scanNS = nsPerCall(conf.iterations, [&]() {scanPciBus(dir);});
+    double findNS = nsPerCall(conf.iterations, [&]() {findPciDevices(SW_VENDOR, SW_DEVICE, dir);});
+    double openNS = nsPerCall(conf.iterations, [&]() {device.open(SW_VENDOR, SW_DEVICE, dir); device.close();});
+
+    sprintf(title, "(mock sysfs, %d functions)", functionCount);
+    printf("%-20s %-28s %10.1f usec\n", "scanPciBus",       title, scanNS / 1e3);
+    printf("%-20s %-28s %10.1f usec\n", "findPciDevices",   title, findNS / 1e3);
+    printf("%-20s %-28s %10.1f usec\n", "PciDevice::open",  title, openNS / 1e3);
+
+    filesystem::remove_all(dir);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// benchSysfs() - Times a scan of this machine's real PCI bus, if it has one we can see
+//=================================================================================================
+void benchSysfs()
+{
+    char title[64];
+
+    if (access("/sys/bus/pci/devices", R_OK) != 0) return;
+    size_t functionCount = scanPciBus().size();
+    double scanNS = nsPerCall(conf.iterations, []() {scanPciBus();});
+
+    sprintf(title, "(this host, %zu functions)", functionCount);
+    printf("%-20s %-28s %10.1f usec\n", "scanPciBus", title, scanNS / 1e3);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// benchRegisters() - Times the RegisterBlock accessors against a mock BAR in anonymous memory
+//
+// Each accessor is timed next to the raw volatile access it replaces.  Without MMIO_TRACE the two
+// should be indistinguishable; with it ("make TRACE=1") the accessors are also timed recording
+//=================================================================================================
+void benchRegisters()
+{
+    // Each of these is one access, so time a lot of them
+    const int count = conf.iterations * 50000;
+
+    void* bar = mmap(0, MOCK_BAR0_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bar == MAP_FAILED) throw runtime_error("Can't map the mock BAR");
+
+    RegisterBlockAt<0x1000> regs((uint8_t*)bar);
+    volatile uint32_t* raw32 = regs.address(0);
+    volatile uint64_t* raw64 = (volatile uint64_t*)regs.address(2);
+    uint32_t           reg   = 1;
+
+    // The accessors, traced and untraced
+    auto run = [&](const char* suffix)
+    {
+        char name[64];
+
+        auto show = [&](const char* what, double ns)
+        {
+            sprintf(name, "%s%s", what, suffix);
+            printf("%-49s %10.2f ns\n", name, ns);
+        };
+
+        show("RegisterBlock::read<>",      nsPerCall(count, [&]() {bitBucket = regs.read<0>();}));
+        show("RegisterBlock::read(reg)",   nsPerCall(count, [&]() {bitBucket = regs.read(reg);}));
+        show("RegisterBlock::read64<>",    nsPerCall(count, [&]() {bitBucket = regs.read64<2>();}));
+        show("RegisterBlock::readHiLo<>",  nsPerCall(count, [&]() {bitBucket = regs.readHiLo<1, 0>();}));
+        show("RegisterBlock::write<>",     nsPerCall(count, [&]() {regs.write<0>(count);}));
+        show("RegisterBlock::write(reg)",  nsPerCall(count, [&]() {regs.write(reg, count);}));
+        show("RegisterBlock::writeHiLo<>", nsPerCall(count, [&]() {regs.writeHiLo<1, 0>(count);}));
+    };
+
+    printf("%-49s %10.2f ns\n", "raw volatile 32-bit read",  nsPerCall(count, [&]() {bitBucket = *raw32;}));
+    printf("%-49s %10.2f ns\n", "raw volatile 64-bit read",  nsPerCall(count, [&]() {bitBucket = *raw64;}));
+    printf("%-49s %10.2f ns\n", "raw volatile 32-bit write", nsPerCall(count, [&]() {*raw32 = count;}));
+    run("");
+
+    // If the tracer was compiled in, time what it costs while it's recording
+    if (MmioTrace::compiledIn())
+    {
+        MmioTrace::enable();
+        run(" (tracing)");
+        MmioTrace::disable();
+    }
+
+    munmap(bar, MOCK_BAR0_SIZE);
+}
+//=================================================================================================
@@ -6,211 +6,1754 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sched.h>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <functional>
+#include <random>
 #include "PciDevice.h"
-
-// Extract the high and low 32-bits of a 64-bit word
-#define HI32(x) ((x >> 32) & 0xFFFFFFFF)
-#define LO32(x) (x & 0xFFFFFFFF)
+#include "BandwidthEngine.h"
+#include "RegisterBlock.h"
+#include "DmaPool.h"
+#include "Broker.h"
+using namespace std;
 
 // This maps PCI resources into user-space
 PciDevice PCI;
 
+// These are the PCI vendor ID and device ID of a Sidewinder
+const int SIDEWINDER_VENDOR = 0x10ee;
+const int SIDEWINDER_DEVICE = 0x903f;
+
 // This defines which PCI resource (i.e., BAR) has the AXI slave registers mapped
 const int AXIREG_RESOURCE = 0;
 
-// This is defined in FindContig.cpp
-uint64_t findContig();
-
-// These are the base addresses of the "Measure Bandwidth" AXI slaves
-const int MBW_PCI = 0x1000;
-const int MBW_DDR = 0x2000;
-
-// The clock speeds (in MHz) at which the "Measure Bandwidth" AXI slaves are being driven
-const double PCI_CLOCK_SPEED = 250.0;
-const double DDR_CLOCK_SPEED = 266.5;
-
-// Register map for the "measure_bw" RTL core
-enum 
-{
-   REG_RADDR_H   = 0,
-   REG_RADDR_L   = 1,
-   REG_WADDR_H   = 2,
-   REG_WADDR_L   = 3,
-   REG_BLK_SIZE  = 4,
-   REG_COUNT     = 5,
-   REG_RRESULT_H = 6,
-   REG_RRESULT_L = 7,
-   REG_WRESULT_H = 8,
-   REG_WRESULT_L = 9,
-   REG_CTL_STAT  = 10
+// This defines which PCI resource (i.e., BAR) is the window into the card's DDR
+const int DDR_RESOURCE = 1;
+
+// This is defined in MmioDecode.cpp
+bool decodeMmioTrace(string filename);
+
+// This is defined in MmioLatency.cpp
+void measureMmioLatency(uint8_t* bar0, int iterations);
+
+// This is defined in IrqWatch.cpp
+void watchIrqRing(string dirName, int seconds);
+
+// These are defined in Verify.cpp
+void     poisonRegion(uint8_t* region, size_t length, int threadCount);
+uint64_t checkEnginePattern(const uint8_t* region, size_t length, int threadCount, uint64_t* firstBad);
+void     fillPrbs(uint8_t* region, size_t length, uint64_t seed, int threadCount);
+uint64_t checkPrbs(const uint8_t* region, size_t length, uint64_t seed, int threadCount, uint64_t* firstBad);
+
+// This is defined in CpuStream.cpp
+void measureCpuBandwidth(uint8_t* bar1, size_t bar1Size, bool bar1WC, uint8_t* hostBuffer,
+                         size_t hostSize, int threadCount);
+
+// These are defined in BrokerClient.cpp
+int  brokerConnect(string socketName);
+int  brokerFindCard(int sock, string bdf);
+void brokerOpenDevice(int sock, int card, PciDevice& pci, uint32_t wcMask);
+int  brokerIrqFD(int sock, int card, int irq);
+bool brokerLockEngines(int sock, int card, uint64_t engines, bool wait);
+
+// This is our connection to the broker (or -1), and the broker's index for our card
+int brokerSock = -1, brokerCard = 0;
+
+// This is defined in LinkStatus.cpp
+bool readPcieLink(string bdf, double* speed, int* width, double* maxSpeed, int* maxWidth);
+
+// These are defined in MetricsServer.cpp
+int  openMetricsServer(int port);
+void serveMetrics(int sock, const string& page, double seconds);
+
+// These are defined in Numa.cpp
+int  numaNodeCount();
+int  numaNodeOfDevice(string bdf);
+bool pinToNode(int node);
+
+// This is the host memory the card DMAs into and out of
+DmaPool DMA;
+
+// These are the NUMA nodes the card and the host buffer the engines stream through are on
+int cardNode = -1, bufferNode = -1;
+
+// Engines that target host memory stream through a buffer this large, if the DMA pool has room
+// for it.  If it doesn't, they use the largest buffer it can give us, but never one this small
+const size_t HOST_BUFFER_SIZE = 1ULL << 30;
+const size_t MIN_HOST_BUFFER  = 16 << 20;
+
+// This is the size of the buffer the host-memory engines actually stream through
+size_t hostBufferSize = HOST_BUFFER_SIZE;
+
+// This is the base address of the "axi_revision" AXI slave
+const int AXI_REVISION = 0x0000;
+
+// Register map for the "axi_revision" RTL core
+enum {REV_MAJOR = 0, REV_MINOR = 1, REV_BUILD = 2, REV_DATE = 3, REV_CLKS = 4, REV_SLOT1 = 5};
+
+// When REV_CLKS reads as this ("CLKS"), register REV_SLOT1 + N - 1 holds the clock rate (in kHz)
+// of the core at BAR0 offset N * 0x1000, for N = 1 thru 3
+const uint32_t REV_CLOCK_MAGIC = 0x434C4B53;
+
+// If an engine's measured clock differs from its configured clock by more than this, we warn
+const double CLOCK_TOLERANCE = 0.01;
+
+// The smallest AXI burst the engines support is one beat of their 512-bit data bus
+const uint32_t MIN_BURST_SIZE = 64;
+
+// The card's DDR4 controller maps addresses ROW_COLUMN_BANK: bits [5:0] are the 64 bytes of one
+// BL8 burst, [7:6] are the bank group, [9:8] the bank, [16:10] the upper column bits, [32:17]
+// the row, and bit 33 the rank (see ddr4/custom_parts_KSM24SED8.csv and the ddr4 IP)
+const uint64_t DDR_BURST_BYTES = 64;
+const int      DDR_BANK_COUNT  = 16;
+const uint64_t DDR_ROW_STRIDE  = 1ULL << 17;
+
+// These are the formats we can report results in
+enum format_t {FMT_TEXT, FMT_CSV, FMT_JSON};
+
+// Configuration parameters from the command line
+struct conf_t
+{
+   bool     sweep;
+   bool     concurrent;
+   bool     parallel;
+   int      repeat;
+   format_t format;
+   int      irq;
+   string   dirName;
+   int      latency;
+   int      cpu;
+   string   engineFile;
+   int      cpuStream;
+   bool     wc;
+   string   bdf;
+   int      card;
+   bool     list;
+   int      irqRing;
+   int      verify;
+   uint32_t pipeline;
+   int      depth;
+   string   broker;
+   string   traceFile;
+   string   decodeFile;
+   string   planFile;
+   int      warmup;
+   int      settleMS;
+   uint32_t patterns;
+   bool     numa;
+   double   monitor;
+   double   budgetMB;
+   int      port;
+   string   metricsFile;
+   bool     calibrate;
+} conf;
+
+// This describes the parameters and result of a single bandwidth measurement
+struct measurement_t
+{
+   const char* engine;
+   bool        isWrite;
+   uint64_t    axiAddress;
+   uint32_t    blockSize;
+   uint32_t    blockCount;
+   uint64_t    cycles;
+   double      clockMHz;
+   double      gbPerSec;
+   const char* scenario;
+   double      hostUS;
+   int64_t     badBeats;        // Beats that failed verification, or -1 if the data wasn't checked
+   uint64_t    firstBad;        // Offset of the first beat that failed verification
 };
 
-// These are the constants to write to the CTL_STAT register 
-const int START_READ  = 1;
-const int START_WRITE = 2;
+// These identify the machine and bitstream that produced a set of measurements
+string hostName, fpgaRevision;
+
+// These are the bandwidth measurement engines in the bitstream
+vector<BandwidthEngine> engines;
+
+
 
+//=================================================================================================
+// nanoTime() - Returns a timestamp in nanoseconds from a clock that never jumps
+//=================================================================================================
+uint64_t nanoTime()
+{
+   timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// xferLimit() - Returns how much of a transfer an engine can perform.  Engines that target host
+//               memory can't run past the end of the host buffer
+//=================================================================================================
+uint64_t xferLimit(BandwidthEngine& engine, uint64_t xferSize)
+{
+   bool isHost = engine.config().target == BandwidthEngine::HOST_MEMORY;
+   return (isHost && xferSize > hostBufferSize) ? hostBufferSize : xferSize;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// verifyRegion() - Returns the userspace address where the host can see the memory that an engine
+//                  writes at "axiAddress", or nullptr if the host can't see it
+//
+// Passed:  engine     = the engine that is going to write
+//          axiAddress = the address it's going to write to
+//          length     = the number of bytes it's going to write
+//
+// On Exit: length     = the number of those bytes the host can see
+//
+// Engines that target host memory write into the DMA pool.  The DDR engine and BAR1 both start
+// at the bottom of the card's DDR, so the host can see as much of it as fits in BAR1
+//=================================================================================================
+uint8_t* verifyRegion(BandwidthEngine& engine, uint64_t axiAddress, size_t* length)
+{
+   if (engine.config().target == BandwidthEngine::HOST_MEMORY)
+   {
+      uint8_t* first = DMA.virtAddr(axiAddress);
+      uint8_t* last  = DMA.virtAddr(axiAddress + *length - 1);
+      return (last - first == *length - 1) ? first : nullptr;
+   }
 
+   // If there's no BAR1, or the write is entirely beyond it, we can't see it
+   auto& resource = PCI.resourceList();
+   if (resource.size() <= DDR_RESOURCE || axiAddress >= resource[DDR_RESOURCE].size) return nullptr;
 
+   // Clip the length to the part of the write that falls inside BAR1
+   auto&  bar1    = PCI.resource(DDR_RESOURCE);
+   size_t visible = bar1.size - axiAddress;
+   if (*length > visible) *length = visible;
+   return bar1.baseAddr + axiAddress;
+}
 //=================================================================================================
-// measureReadBandwidth() - Returns the number of clock-cycles it took to perform the requested
-//                          bandwidth measurement
+
+
+//=================================================================================================
+// measure() - Performs a single bandwidth measurement and returns the result
 //
-// Passed: deviceAddress = The AXI address of the bandwidth measurement core
-//         axiAddress    = The first address to read or write from
-//         blockSize     = The number of bytes in one AXI burst
-//         blockCount    = The total number of bursts to perform
+// Passed: engine     = The bandwidth measurement engine to use
+//         isWrite    = true to measure write bandwidth, false to measure read bandwidth
+//         axiAddress = The first address to read or write from
+//         blockSize  = The number of bytes in one AXI burst
+//         blockCount = The total number of bursts to perform
 //=================================================================================================
-uint64_t measureReadBandwidth(uint32_t deviceAddress, uint64_t axiAddress, uint32_t blockSize,
-                              uint32_t blockCount)
+measurement_t measure(BandwidthEngine& engine, bool isWrite, uint64_t axiAddress,
+                      uint32_t blockSize, uint32_t blockCount)
 {
+   measurement_t m = {engine.name(), isWrite, axiAddress, blockSize, blockCount, 0,
+                      engine.clockMHz(), 0, "single", 0, -1, 0};
 
-   // Get a pointer to our measurement engine's AXI registers
-   volatile uint32_t* engine = (uint32_t*) (PCI.resourceList()[AXIREG_RESOURCE].baseAddr + deviceAddress);
+   // If we're going to check what a write measurement wrote, find out where we can see it, and
+   // make sure that nothing left over from an earlier measurement can pass the check
+   size_t   length = (size_t)blockSize * blockCount;
+   uint8_t* region = (conf.verify > 0 && isWrite) ? verifyRegion(engine, axiAddress, &length) : nullptr;
+   if (region) poisonRegion(region, length, conf.verify);
 
-   // Configure the bandwith measurement core
-   engine[REG_RADDR_H ] = HI32(axiAddress);
-   engine[REG_RADDR_L ] = LO32(axiAddress);
-   engine[REG_BLK_SIZE] = blockSize;
-   engine[REG_COUNT   ] = blockCount;
+   // Find out what time it is on the host before the measurement starts
+   uint64_t startTime = nanoTime();
 
-   // Start the bandwidth measurement
-   engine[REG_CTL_STAT] = START_READ;
+   // Measure the number of clock cycles required to perform the transfer
+   m.cycles = engine.measure(isWrite, axiAddress, blockSize, blockCount);
 
-   // Wait for the measurement to complete
-   while (engine[REG_CTL_STAT]) usleep(10000);
+   // This is how long the host saw the measurement take, including completion latency
+   m.hostUS = (nanoTime() - startTime) / 1000.0;
 
-   // Fetch the number of clock cycles the measurement took
-   uint64_t result_hi = engine[REG_RRESULT_H];
-   uint64_t result_lo = engine[REG_RRESULT_L];
+   // Compute the bandwidth in GB/sec
+   m.gbPerSec = engine.bandwidth((uint64_t)blockSize * blockCount, m.cycles);
 
-   // And return the elapsed number of clock cycles to the caller
-   return (result_hi << 32) | result_lo;
+   // Check that the engine wrote what it was supposed to
+   if (region) m.badBeats = checkEnginePattern(region, length, conf.verify, &m.firstBad);
+
+   // And hand the result to the caller
+   return m;
 }
 //=================================================================================================
 
 
 //=================================================================================================
-// measureWriteBandwidth() - Returns the number of clock-cycles it took to perform the requested
-//                           bandwidth measurement
+// readRevision() - Returns the version of the FPGA bitstream as reported by "axi_revision"
+//=================================================================================================
+string readRevision()
+{
+   char buffer[64];
+
+   // These are the revision core's AXI registers
+   RegisterBlockAt<AXI_REVISION> rev(PCI.resourceList()[AXIREG_RESOURCE]);
+
+   // The build date is encoded as 0xMMDDYYYY
+   uint32_t date = rev.read<REV_DATE>();
+
+   // Format the version as "major.minor.build (yyyy-mm-dd)"
+   sprintf(buffer, "%u.%u.%u (%04u-%02u-%02u)", rev.read<REV_MAJOR>(), rev.read<REV_MINOR>(),
+           rev.read<REV_BUILD>(), date & 0xFFFF, (date >> 24) & 0xFF, (date >> 16) & 0xFF);
+
+   // And hand the caller the version string
+   return buffer;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// reportMeasurement() - Reports a single measurement in whatever format the user asked for
+//=================================================================================================
+void reportMeasurement(const measurement_t& m)
+{
+   char timestamp[32];
+   static bool csvHeaderPrinted = false;
+
+   // Fetch the direction as a printable string
+   const char* direction = m.isWrite ? "write" : "read";
+
+   // In text mode, this is a simple human readable line
+   if (conf.format == FMT_TEXT)
+   {
+      printf("%5.1lf Mhz %s %-5s time = %9lu cycles (%4.1lf GB/sec)", m.clockMHz, m.engine,
+             direction, m.cycles, m.gbPerSec);
+      if (m.badBeats == 0) printf("  data verified");
+      if (m.badBeats > 0)  printf("  %ld BAD BEATS, first at offset 0x%lx", m.badBeats, m.firstBad);
+      printf("\n");
+      return;
+   }
+
+   // Create an ISO-8601 timestamp (in UTC) for this record
+   time_t now = time(nullptr);
+   strftime(timestamp, sizeof timestamp, "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+   // Fetch some constant strings
+   string      pciBDF = PCI.bdf();
+   const char* host   = hostName.c_str();
+   const char* bdf    = pciBDF.c_str();
+   const char* rev    = fpgaRevision.c_str();
+
+   // Emit a CSV record, preceded by a header line the first time through
+   if (conf.format == FMT_CSV)
+   {
+      if (!csvHeaderPrinted)
+      {
+         printf("timestamp,host,bdf,fpga_revision,engine,direction,address,block_size,"
+                "block_count,cycles,clock_mhz,gb_per_sec,scenario,host_us,bad_beats,card_node,"
+                "buffer_node\n");
+         csvHeaderPrinted = true;
+      }
+
+      printf("%s,%s,%s,%s,%s,%s,0x%lx,%u,%u,%lu,%.3lf,%.4lf,%s,%.1lf,%ld,%d,%d\n", timestamp, host, bdf,
+             rev, m.engine, direction, m.axiAddress, m.blockSize, m.blockCount, m.cycles,
+             m.clockMHz, m.gbPerSec, m.scenario, m.hostUS, m.badBeats, cardNode, bufferNode);
+   }
+
+   // Emit a JSON record, one object per line
+   if (conf.format == FMT_JSON)
+   {
+      printf("{\"timestamp\":\"%s\",\"host\":\"%s\",\"bdf\":\"%s\",\"fpga_revision\":\"%s\","
+             "\"engine\":\"%s\",\"direction\":\"%s\",\"address\":%lu,\"block_size\":%u,"
+             "\"block_count\":%u,\"cycles\":%lu,\"clock_mhz\":%.3lf,\"gb_per_sec\":%.4lf,"
+             "\"scenario\":\"%s\",\"host_us\":%.1lf,\"bad_beats\":%ld,\"card_node\":%d,"
+             "\"buffer_node\":%d}\n",
+             timestamp, host, bdf, rev, m.engine, direction, m.axiAddress, m.blockSize,
+             m.blockCount, m.cycles, m.clockMHz, m.gbPerSec, m.scenario, m.hostUS, m.badBeats,
+             cardNode, bufferNode);
+   }
+
+   // Make sure that a consumer reading from a pipe sees every record promptly
+   fflush(stdout);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// sweepOne() - Measures one engine in one direction across every burst size and transfer size,
+//              repeating each data point "conf.repeat" times and reporting min/median/max GB/sec
 //
-// Passed: deviceAddress = The AXI address of the bandwidth measurement core
-//         axiAddress    = The first address to read or write from
-//         blockSize     = The number of bytes in one AXI burst
-//         blockCount    = The total number of bursts to perform
+// Passed: engine  = The bandwidth measurement engine to use
+//         isWrite = true to measure write bandwidth, false to measure read bandwidth
 //=================================================================================================
-uint64_t measureWriteBandwidth(uint32_t deviceAddress, uint64_t axiAddress, uint32_t blockSize,
-                               uint32_t blockCount)
+void sweepOne(BandwidthEngine& engine, bool isWrite)
 {
-   // Get a pointer to our measurement engine's AXI registers
-   volatile uint32_t* engine = (uint32_t*) (PCI.resourceList()[AXIREG_RESOURCE].baseAddr + deviceAddress);
+   // These are the total transfer sizes we're going to measure at each burst size
+   const uint64_t xferSizes[] = {1 << 20, 16 << 20, 256 << 20, 1024 << 20};
 
-   // Configure the bandwith measurement core
-   engine[REG_WADDR_H ] = HI32(axiAddress);
-   engine[REG_WADDR_L ] = LO32(axiAddress);
-   engine[REG_BLK_SIZE] = blockSize;
-   engine[REG_COUNT   ] = blockCount;
+   // Fetch the address this engine starts at and the largest burst it supports
+   uint64_t axiAddress = engine.config().baseAddress;
+   uint32_t maxBurst   = engine.config().maxBurst;
 
-   // Start the bandwidth measurement
-   engine[REG_CTL_STAT] = START_WRITE;
+   // Print a header for this set of measurements
+   if (conf.format == FMT_TEXT)
+   {
+      printf("\n%s %s bandwidth (GB/sec), %d runs per point\n", engine.name(), isWrite ? "write" : "read", conf.repeat);
+      printf("%10s %12s %8s %8s %8s\n", "burst", "xfer size", "min", "median", "max");
+   }
+
+   // Loop through each burst size, in powers of two
+   for (uint32_t burstSize = MIN_BURST_SIZE; burstSize <= maxBurst; burstSize *= 2)
+   {
+      // Loop through each total transfer size
+      for (uint64_t xferSize : xferSizes)
+      {
+         vector<double> result;
 
-   // Wait for the measurement to complete
-   while (engine[REG_CTL_STAT]) usleep(10000);
+         // A host-memory engine can only measure sizes that fit in the host buffer
+         if (xferLimit(engine, xferSize) < xferSize) continue;
 
-   // Fetch the number of clock cycles the measurement took
-   uint64_t result_hi = engine[REG_WRESULT_H];
-   uint64_t result_lo = engine[REG_WRESULT_L];
+         // Perform this measurement as many times as the user asked for
+         for (int i=0; i<conf.repeat; ++i)
+         {
+            auto m = measure(engine, isWrite, axiAddress, burstSize, xferSize / burstSize);
+            m.scenario = "sweep";
+            result.push_back(m.gbPerSec);
 
-   // And return the elapsed number of clock cycles to the caller
-   return (result_hi << 32) | result_lo;
+            // Machine-readable output gets one record per measurement
+            if (conf.format != FMT_TEXT) reportMeasurement(m);
+         }
+
+         // Everything after this point is for human consumption
+         if (conf.format != FMT_TEXT) continue;
+
+         // Sort the results so we can find the min, median, and max
+         sort(result.begin(), result.end());
+
+         // And report this data point
+         printf("%10u %10luMB %8.2lf %8.2lf %8.2lf\n", burstSize, xferSize >> 20,
+                result.front(), result[result.size()/2], result.back());
+      }
+   }
 }
 //=================================================================================================
 
 
+//=================================================================================================
+// sweep() - Measures every engine in every direction across a range of burst and transfer sizes
+//=================================================================================================
+void sweep()
+{
+   for (auto& engine : engines) sweepOne(engine, true);
+   for (auto& engine : engines) sweepOne(engine, false);
+}
+//=================================================================================================
 
 
 //=================================================================================================
-// process() - Take the bandwidth measurements and report the results
+// This describes one stream of traffic (i.e., one direction on one engine) in a concurrent test
+//=================================================================================================
+struct stream_t
+{
+   BandwidthEngine* engine;
+   uint64_t         axiAddress;
+   bool             isWrite;
+};
+//=================================================================================================
+
+
+//=================================================================================================
+// runConcurrent() - Starts several streams of traffic back-to-back, waits for all of them to
+//                   complete, and reports per-stream and aggregate throughput alongside the
+//                   throughput each stream achieves when running by itself
+//
+// Passed: scenario   = A human readable name for this combination of streams
+//         streams    = The streams of traffic to run simultaneously
+//         blockSize  = The number of bytes in one AXI burst
+//         blockCount = The total number of bursts each stream performs
+//=================================================================================================
+void runConcurrent(string scenario, const vector<stream_t>& streams, uint32_t blockSize,
+                   uint32_t blockCount)
+{
+   vector<BandwidthEngine*> engineList;
+   vector<uint32_t>         ctlList;
+   vector<uint64_t>         readAddr, writeAddr;
+   vector<double>           alone;
+
+   // This is the number of bytes each stream transfers
+   uint64_t xferSize = (uint64_t)blockSize * blockCount;
+
+   // Measure each stream by itself so we have something to compare against
+   for (auto& stream : streams)
+   {
+      auto m = measure(*stream.engine, stream.isWrite, stream.axiAddress, blockSize, blockCount);
+      alone.push_back(m.gbPerSec);
+   }
+
+   // Figure out which engines are involved, and which direction(s) each one runs in
+   for (auto& stream : streams)
+   {
+      // Find out whether we've already seen another stream on this engine
+      auto it = find(engineList.begin(), engineList.end(), stream.engine);
+      if (it == engineList.end())
+      {
+         engineList.push_back(stream.engine);
+         ctlList.push_back(0);
+         readAddr.push_back(0);
+         writeAddr.push_back(0);
+         it = engineList.end() - 1;
+      }
+
+      // Keep track of the starting address and start bit for this stream's direction
+      int idx = it - engineList.begin();
+      if (stream.isWrite)
+      {
+         writeAddr[idx] = stream.axiAddress;
+         ctlList[idx]  |= BandwidthEngine::START_WRITE;
+      }
+      else
+      {
+         readAddr[idx]  = stream.axiAddress;
+         ctlList[idx]  |= BandwidthEngine::START_READ;
+      }
+   }
+
+   // Arm every engine that's involved
+   for (int i=0; i<engineList.size(); ++i)
+   {
+      engineList[i]->arm(readAddr[i], writeAddr[i], blockSize, blockCount);
+   }
+
+   // Start every engine as close together in time as we can
+   uint64_t startTime = nanoTime();
+   for (int i=0; i<engineList.size(); ++i) engineList[i]->start(ctlList[i]);
+
+   // Wait for all of them to finish
+   for (auto engine : engineList) engine->wait();
+   double hostUS = (nanoTime() - startTime) / 1000.0;
+
+   // Tell the user which scenario this is
+   if (conf.format == FMT_TEXT) printf("\n%s\n", scenario.c_str());
+
+   // Report the result of each individual stream, and keep track of the longest running one
+   double longestNS = 0;
+   for (int i=0; i<streams.size(); ++i)
+   {
+      auto& stream = streams[i];
+      auto  engine = stream.engine;
+      auto  cycles = engine->cycles(stream.isWrite);
+
+      measurement_t m = {engine->name(), stream.isWrite, stream.axiAddress, blockSize, blockCount,
+                         cycles, engine->clockMHz(), engine->bandwidth(xferSize, cycles),
+                         scenario.c_str(), hostUS, -1, 0};
+
+      // Keep track of how long the slowest stream took
+      double ns = cycles * 1000 / engine->clockMHz();
+      if (ns > longestNS) longestNS = ns;
+
+      if (conf.format == FMT_TEXT)
+         printf("   %-8s %-5s %6.2lf GB/sec  (%6.2lf alone)\n", m.engine, m.isWrite ? "write" : "read",
+                m.gbPerSec, alone[i]);
+      else
+         reportMeasurement(m);
+   }
+
+   // The aggregate throughput is all of the data moved over the time it took to move it
+   if (conf.format == FMT_TEXT)
+   {
+      double aloneTotal = 0;
+      for (auto gbPerSec : alone) aloneTotal += gbPerSec;
+      printf("   aggregate      %6.2lf GB/sec  (%6.2lf alone)\n", xferSize * streams.size() / longestNS, aloneTotal);
+   }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// concurrent() - Measures the engines (and the read and write halves of each) while they
+//                compete with each other for the interconnect
+//=================================================================================================
+void concurrent()
+{
+   vector<stream_t> reads, writes, everything;
+
+   // Each stream moves 512 MB so that reads and writes fit in separate halves of the buffer
+   const uint64_t xferSize  = min((size_t)512 << 20, hostBufferSize / 2);
+   const uint32_t burstSize = 2048;
+   const uint32_t count     = xferSize / burstSize;
+
+   // Build a read stream and a write stream for each engine
+   for (auto& engine : engines)
+   {
+      uint64_t base = engine.config().baseAddress;
+      reads.push_back ({&engine, base,            false});
+      writes.push_back({&engine, base + xferSize, true });
+   }
+
+   // Every engine writing at once, then every engine reading at once
+   runConcurrent("All engines writing", writes, burstSize, count);
+   runConcurrent("All engines reading", reads,  burstSize, count);
+
+   // Each engine reading and writing at the same time
+   for (int i=0; i<engines.size(); ++i)
+   {
+      string scenario = string(engines[i].name()) + " read + write";
+      runConcurrent(scenario, {reads[i], writes[i]}, burstSize, count);
+   }
+
+   // And finally, every engine reading and writing at the same time
+   everything = reads;
+   everything.insert(everything.end(), writes.begin(), writes.end());
+   runConcurrent("All engines reading and writing", everything, burstSize, count);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// parallel() - Runs the standard measurement on every engine at once, each from its own thread,
+//              and reports per-engine and aggregate throughput
+//=================================================================================================
+void parallel()
+{
+   vector<thread> threads;
+
+   // We're going to transfer 1 GB of data through each engine, in 2K bursts
+   const uint64_t xferSize  = 1024 * 1024 * 1024;
+   const uint32_t burstSize = 2048;
+
+   // Do all the writes, then do all the reads
+   for (bool isWrite : {true, false})
+   {
+      vector<measurement_t> result(engines.size());
+
+      // Launch one thread per engine
+      for (int i=0; i<engines.size(); ++i)
+      {
+         threads.emplace_back([&, i]()
+         {
+            auto& engine = engines[i];
+            result[i] = measure(engine, isWrite, engine.config().baseAddress, burstSize,
+                                xferLimit(engine, xferSize) / burstSize);
+            result[i].scenario = "parallel";
+         });
+      }
+
+      // Wait for them all to finish
+      for (auto& t : threads) t.join();
+      threads.clear();
+
+      // Report the per-engine results and add up the aggregate
+      double aggregate = 0;
+      for (auto& m : result)
+      {
+         reportMeasurement(m);
+         aggregate += m.gbPerSec;
+      }
+
+      // In text mode, tell the user how much bandwidth all of the engines achieved together
+      if (conf.format == FMT_TEXT) printf("%s aggregate = %.1lf GB/sec\n", isWrite ? "write" : "read", aggregate);
+   }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// pipeline() - Streams data from the host buffer through the card's DDR and back, with several
+//              chunks in flight at once, and reports the sustained end-to-end throughput
+//
+// Every chunk goes through four stages:
+//
+//    1) The host engine reads it from the source half of the host buffer
+//    2) The card engine writes it into a DDR staging buffer
+//    3) The card engine reads it back out of that staging buffer
+//    4) The host engine writes it into the destination half of the host buffer
+//
+// Each engine's read and write channels have their own address registers, so all four stages
+// run at once on different chunks.  There are "conf.depth" staging buffers in DDR, which is how
+// many steps a chunk waits between being written into DDR and being read back out.  Each step
+// ends when every active stage has signaled completion.
+//
+// The measure_bw cores don't actually pass data from their read channel to their write channel,
+// so this measures the traffic pattern of a copy pipeline rather than copying real data
+//=================================================================================================
+void pipeline()
+{
+   BandwidthEngine *host = nullptr, *card = nullptr;
+
+   // We stream half the host buffer so that the source and destination fit in separate halves
+   const uint64_t xferSize  = hostBufferSize / 2;
+   const uint32_t burstSize = 2048;
+   const uint32_t chunkSize = conf.pipeline;
+   const int      depth     = conf.depth;
+
+   // Find an engine that can reach host memory, and one that can reach card memory
+   for (auto& engine : engines)
+   {
+      if (engine.config().target == BandwidthEngine::HOST_MEMORY && !host) host = &engine;
+      if (engine.config().target == BandwidthEngine::CARD_MEMORY && !card) card = &engine;
+   }
+   if (!host || !card) throw runtime_error("The pipeline needs a host-memory engine and a card-memory engine");
+
+   // Make sure the chunks divide evenly into bursts and into the data we're streaming
+   if (chunkSize < burstSize || chunkSize % burstSize || xferSize % chunkSize)
+   {
+      throw runtime_error("The pipeline chunk size must be a multiple of the " + to_string(burstSize)
+                          + "-byte burst size that divides evenly into " + to_string(xferSize)
+                          + " bytes (half the host buffer)");
+   }
+
+   // This is how many chunks we're streaming, and how many bursts are in each one
+   const uint64_t chunkCount = xferSize / chunkSize;
+   const uint32_t blockCount = chunkSize / burstSize;
+
+   // These are the base addresses of the source, destination, and DDR staging buffers
+   const uint64_t source  = host->config().baseAddress;
+   const uint64_t dest    = source + xferSize;
+   const uint64_t staging = card->config().baseAddress;
+
+   // Find out how fast each stage is by itself, moving all of the data in one shot
+   double alone[4] =
+   {
+      measure(*host, false, source,  burstSize, xferSize / burstSize).gbPerSec,
+      measure(*card, true,  staging, burstSize, xferSize / burstSize).gbPerSec,
+      measure(*card, false, staging, burstSize, xferSize / burstSize).gbPerSec,
+      measure(*host, true,  dest,    burstSize, xferSize / burstSize).gbPerSec
+   };
+
+   // Keep track of how many clock cycles each stage spent busy
+   uint64_t stageCycles[4] = {0, 0, 0, 0};
+
+   // Chunk "n" is read from the host at step n, written to DDR at step n+1, read back out of DDR
+   // at step n+depth, and written to the host at step n+depth+1
+   uint64_t startTime = nanoTime();
+   for (uint64_t step = 0; step < chunkCount + depth + 1; ++step)
+   {
+      uint32_t hostCtl = 0, cardCtl = 0;
+      uint64_t hostRead = 0, hostWrite = 0, cardRead = 0, cardWrite = 0;
+
+      // Figure out which chunk (if any) each stage is working on during this step
+      int64_t chunk[4] = {(int64_t)step, (int64_t)step - 1, (int64_t)step - depth, (int64_t)step - depth - 1};
+      bool    active[4];
+      for (int i=0; i<4; ++i) active[i] = chunk[i] >= 0 && chunk[i] < (int64_t)chunkCount;
+
+      if (active[0])
+      {
+         hostRead = source + chunk[0] * chunkSize;
+         hostCtl |= BandwidthEngine::START_READ;
+      }
+      if (active[1])
+      {
+         cardWrite = staging + (chunk[1] % depth) * chunkSize;
+         cardCtl  |= BandwidthEngine::START_WRITE;
+      }
+      if (active[2])
+      {
+         cardRead = staging + (chunk[2] % depth) * chunkSize;
+         cardCtl |= BandwidthEngine::START_READ;
+      }
+      if (active[3])
+      {
+         hostWrite = dest + chunk[3] * chunkSize;
+         hostCtl  |= BandwidthEngine::START_WRITE;
+      }
+
+      // Start every stage that has a chunk to work on, and wait for all of them to complete
+      host->arm(hostRead, hostWrite, burstSize, blockCount);
+      card->arm(cardRead, cardWrite, burstSize, blockCount);
+      if (hostCtl) host->start(hostCtl);
+      if (cardCtl) card->start(cardCtl);
+      host->wait();
+      card->wait();
+
+      // Keep track of how busy each stage was
+      if (active[0]) stageCycles[0] += host->cycles(false);
+      if (active[1]) stageCycles[1] += card->cycles(true);
+      if (active[2]) stageCycles[2] += card->cycles(false);
+      if (active[3]) stageCycles[3] += host->cycles(true);
+   }
+   double hostUS = (nanoTime() - startTime) / 1000.0;
+
+   // This is the rate at which data made the whole trip, and what it would be if we ran the
+   // stages one after another with no overlap
+   double sustained = xferSize / (hostUS * 1000);
+   double serial    = 1 / (1/alone[0] + 1/alone[1] + 1/alone[2] + 1/alone[3]);
+
+   // Report each stage
+   BandwidthEngine* stageEngine[4] = {host, card, card, host};
+   bool             stageWrite[4]  = {false, true, false, true};
+   uint64_t         stageAddr[4]   = {source, staging, staging, dest};
+   const char*      stageName[4]   = {"host -> card", "card -> DDR", "DDR -> card", "card -> host"};
+
+   if (conf.format == FMT_TEXT) printf("\npipeline: %u byte chunks, %d DDR buffers\n", chunkSize, depth);
+
+   for (int i=0; i<4; ++i)
+   {
+      auto engine = stageEngine[i];
+      measurement_t m = {engine->name(), stageWrite[i], stageAddr[i], burstSize,
+                         (uint32_t)(xferSize / burstSize), stageCycles[i], engine->clockMHz(),
+                         engine->bandwidth(xferSize, stageCycles[i]), "pipeline", hostUS, -1, 0};
+
+      if (conf.format == FMT_TEXT)
+         printf("   %-12s %-8s %-5s %6.2lf GB/sec  (%6.2lf alone)\n", stageName[i], m.engine,
+                m.isWrite ? "write" : "read", m.gbPerSec, alone[i]);
+      else
+         reportMeasurement(m);
+   }
+
+   // And the end-to-end throughput
+   if (conf.format == FMT_TEXT)
+   {
+      printf("   end-to-end            %6.2lf GB/sec  (%6.2lf one stage at a time)\n", sustained, serial);
+   }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// planEntry_t - One test in a test plan
+//=================================================================================================
+struct planEntry_t
+{
+   BandwidthEngine* engine;
+   bool             isWrite;
+   uint64_t         offset;        // Where the test starts, relative to the engine's base address
+   uint32_t         blockSize;
+   uint32_t         blockCount;
+   int              repeat;
+   int              warmup;        // Untimed runs before the measured ones
+   int              settleMS;      // How long to let the system settle before the test starts
+   string           scenario;      // "plan:<line number>"
+};
+//=================================================================================================
+
+
+//=================================================================================================
+// loadPlan() - Reads a test plan file
+//
+// Each non-blank line that doesn't start with '#' describes one test:
+//
+//    <engine> <read|write> <offset> <block size> <block count> [repeat] [warmup] [settle ms]
+//
+// For example:   PCI  write  0  2048  524288  5  1  100
+//
+// The offset is relative to the engine's base address.  The optional fields default to the
+// "-repeat", "-warmup" and "-settle" values from the command line
+//=================================================================================================
+vector<planEntry_t> loadPlan(string filename)
+{
+   string              line, engineName, direction, offset, extra;
+   vector<planEntry_t> result;
+   int                 lineNumber = 0;
+
+   // Open the specified file
+   ifstream file(filename);
+
+   // If we couldn't open the file, complain
+   if (!file.is_open()) throw runtime_error("Can't open " + filename);
+
+   // Loop through each line of the file...
+   while (getline(file, line))
+   {
+      planEntry_t entry = {nullptr, false, 0, 0, 0, conf.repeat, conf.warmup, conf.settleMS, ""};
+      ++lineNumber;
+
+      // Ignore blank lines and comments
+      auto first = line.find_first_not_of(" \t");
+      if (first == string::npos || line[first] == '#') continue;
+
+      // Parse the mandatory fields on this line
+      istringstream fields(line);
+      fields >> engineName >> direction >> offset >> entry.blockSize >> entry.blockCount;
+      if (!fields) throw runtime_error("Malformed test in " + filename + ": " + line);
+      entry.offset   = stoull(offset, 0, 0);
+      entry.scenario = "plan:" + to_string(lineNumber);
+
+      // Parse the optional fields, if they're present
+      if (fields >> extra) entry.repeat   = stoi(extra, 0, 0);
+      if (fields >> extra) entry.warmup   = stoi(extra, 0, 0);
+      if (fields >> extra) entry.settleMS = stoi(extra, 0, 0);
+
+      // Find the engine this test runs on
+      for (auto& engine : engines) if (engineName == engine.name()) entry.engine = &engine;
+      if (entry.engine == nullptr) throw runtime_error("Unknown engine '" + engineName + "' in " + filename);
+
+      // Find out which direction the test runs in
+      if (direction == "read")
+         entry.isWrite = false;
+      else if (direction == "write")
+         entry.isWrite = true;
+      else
+         throw runtime_error("Unknown direction '" + direction + "' in " + filename);
+
+      // Make sure the test is sane
+      uint64_t xferSize = (uint64_t)entry.blockSize * entry.blockCount;
+      if (entry.blockSize < MIN_BURST_SIZE || entry.blockSize > entry.engine->config().maxBurst
+      ||  entry.blockCount == 0 || entry.repeat < 1)
+      {
+         throw runtime_error("Invalid test on line " + to_string(lineNumber) + " of " + filename);
+      }
+
+      // An engine that targets host memory must stay inside the host buffer
+      if (entry.engine->config().target == BandwidthEngine::HOST_MEMORY
+      &&  entry.offset + xferSize > hostBufferSize)
+      {
+         throw runtime_error("The test on line " + to_string(lineNumber) + " runs past the end of the host buffer");
+      }
+
+      // Add this test to the plan
+      result.push_back(entry);
+   }
+
+   // If there are no tests in the file, something is awry
+   if (result.empty()) throw runtime_error("No tests in " + filename);
+
+   // Hand the caller the test plan
+   return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// runPlan() - Runs every test in a test plan file, with the device opened just once
+//=================================================================================================
+void runPlan()
+{
+   // Read the entire plan up front, so a typo on the last line doesn't waste a long run
+   auto plan = loadPlan(conf.planFile);
+
+   if (conf.format == FMT_TEXT)
+   {
+      printf("\n%-10s %-8s %-5s %12s %8s %10s %8s %8s %8s\n", "test", "engine", "dir", "offset",
+             "burst", "xfer size", "min", "median", "max");
+   }
+
+   for (auto& test : plan)
+   {
+      vector<double> result;
+      uint64_t       axiAddress = test.engine->config().baseAddress + test.offset;
+
+      // Let whatever ran before this test settle down
+      if (test.settleMS > 0) usleep(test.settleMS * 1000);
+
+      // Get caches, TLBs, and the DDR controller into a steady state
+      for (int i=0; i<test.warmup; ++i)
+      {
+         test.engine->measure(test.isWrite, axiAddress, test.blockSize, test.blockCount);
+      }
+
+      // Perform the measured runs
+      for (int i=0; i<test.repeat; ++i)
+      {
+         auto m = measure(*test.engine, test.isWrite, axiAddress, test.blockSize, test.blockCount);
+         m.scenario = test.scenario.c_str();
+         result.push_back(m.gbPerSec);
+
+         // Machine-readable output gets one record per measurement
+         if (conf.format != FMT_TEXT) reportMeasurement(m);
+      }
+
+      // Everything after this point is for human consumption
+      if (conf.format != FMT_TEXT) continue;
+
+      // Sort the results so we can find the min, median, and max
+      sort(result.begin(), result.end());
+
+      // And report this test
+      uint64_t xferSize = (uint64_t)test.blockSize * test.blockCount;
+      printf("%-10s %-8s %-5s %#12lx %8u %8luKB %8.2lf %8.2lf %8.2lf\n", test.scenario.c_str(),
+             test.engine->name(), test.isWrite ? "write" : "read", test.offset, test.blockSize,
+             xferSize >> 10, result.front(), result[result.size()/2], result.back());
+   }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// patterns() - Measures card memory with scattered access patterns, and reports the effective
+//              bandwidth of each next to that of streaming linearly
+//
+// A measure_bw core can only stream through consecutive addresses, so each pattern is a long
+// series of short engine runs at addresses that we compute.  Effective bandwidth is the data
+// moved over the total time the engine was busy; the host's time, which includes setting up
+// each run, is reported too.  The patterns are:
 //
-// Passed: contigAddress = physical address of a reserved contiguous buffer on this computer
-//                         that is at least 1 GB in size
+//    linear      - blocks back to back, for comparison
+//    strided     - one block every 1 MB
+//    random      - blocks at random (block aligned) addresses within 1 GB
+//    row-miss    - 64-byte bursts that all hit the same bank, each in a different row
+//    bank-spread - 64-byte bursts in a different row each time, rotating through all 16 banks
 //=================================================================================================
-void process(uint64_t contigAddress)
+void patterns()
 {
-   double nanoseconds, gbPerSec;
-   uint64_t cycles;
+   // Each pattern is this many engine runs, and scatters them over this much memory
+   const int      RUNS   = 4096;
+   const uint64_t RANGE  = 1ULL << 30;
+   const uint64_t STRIDE = 1ULL << 20;
+
+   // The block size that the linear, strided, and random patterns use
+   const uint32_t blockSize = conf.patterns;
+
+   // This describes one pattern: its name, block size, and the address of run "i"
+   struct pattern_t {const char* name; uint32_t blockSize; function<uint64_t(uint64_t)> address;};
+
+   mt19937_64 random(1);
+   vector<pattern_t> patternList =
+   {
+      {"linear",      blockSize,       [&](uint64_t i) {return (i * blockSize) % RANGE;}},
+      {"strided",     blockSize,       [&](uint64_t i) {return (i * STRIDE) % RANGE;}},
+      {"random",      blockSize,       [&](uint64_t)   {return random() % (RANGE / blockSize) * blockSize;}},
+      {"row-miss",    DDR_BURST_BYTES, [&](uint64_t i) {return (i * DDR_ROW_STRIDE) % RANGE;}},
+      {"bank-spread", DDR_BURST_BYTES, [&](uint64_t i) {return (i % DDR_BANK_COUNT) * DDR_BURST_BYTES
+                                                             + (i * DDR_ROW_STRIDE) % RANGE;}}
+   };
+
+   for (auto& engine : engines)
+   {
+      // These patterns are about the card's DDR4
+      if (engine.config().target != BandwidthEngine::CARD_MEMORY) continue;
+
+      uint64_t base = engine.config().baseAddress;
+
+      if (conf.format == FMT_TEXT)
+      {
+         printf("\n%s access patterns, %d runs each\n", engine.name(), RUNS);
+         printf("%-12s %-5s %8s %12s %16s\n", "pattern", "dir", "block", "GB/sec", "host GB/sec");
+      }
+
+      for (bool isWrite : {true, false})
+      {
+         for (auto& pattern : patternList)
+         {
+            // A block is carried out in bursts as large as the engine allows
+            uint32_t burstSize  = min(pattern.blockSize, engine.config().maxBurst);
+            uint32_t blockCount = pattern.blockSize / burstSize;
+            uint64_t cycles     = 0;
+
+            // Every direction of every pattern sees the same sequence of random addresses
+            random.seed(1);
+
+            // Perform the runs, adding up how long the engine was busy
+            uint64_t startTime = nanoTime();
+            for (uint64_t i=0; i<RUNS; ++i)
+            {
+               cycles += engine.measure(isWrite, base + pattern.address(i), burstSize, blockCount);
+            }
+            double hostUS = (nanoTime() - startTime) / 1000.0;
+
+            // Compute the effective bandwidth
+            uint64_t xferSize = (uint64_t)pattern.blockSize * RUNS;
+            string   scenario = string("pattern:") + pattern.name;
+            measurement_t m = {engine.name(), isWrite, base, burstSize, blockCount * RUNS, cycles,
+                               engine.clockMHz(), engine.bandwidth(xferSize, cycles), scenario.c_str(),
+                               hostUS, -1, 0};
+
+            if (conf.format == FMT_TEXT)
+               printf("%-12s %-5s %8u %12.2lf %16.2lf\n", pattern.name, isWrite ? "write" : "read",
+                      pattern.blockSize, m.gbPerSec, xferSize / (hostUS * 1000));
+            else
+               reportMeasurement(m);
+         }
+      }
+   }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// numaCompare() - Measures the host-memory engines against a buffer on each NUMA node in turn, so
+//                 that DMA into memory local to the card can be compared with DMA that crosses
+//                 the socket interconnect.  We stay on the card's node throughout; only the
+//                 buffer moves, and it's the same size as the main one
+//
+// Passed: hostBuffer = the buffer the engines normally stream through
+//=================================================================================================
+void numaCompare(const DmaPool::buffer_t& hostBuffer)
+{
+   const uint32_t burstSize  = 2048;
+   const uint32_t blockCount = hostBufferSize / burstSize;
+   int            homeNode   = bufferNode;
+
+   if (conf.format == FMT_TEXT)
+   {
+      printf("Card is on NUMA node %d\n", cardNode);
+      printf("%-6s %-8s %-10s %12s %12s\n", "node", "", "engine", "write GB/s", "read GB/s");
+   }
+
+   for (int node = 0; node < numaNodeCount(); ++node)
+   {
+      // The main buffer is already on a node.  For the others we need a buffer of our own, from
+      // a region reserved on that node if there is one, and from hugepages if there isn't
+      DmaPool  pool;
+      uint64_t physAddr = hostBuffer.physAddr;
+      if (node != homeNode)
+      {
+         try
+         {
+            if (pool.open(hostBufferSize, node) != DmaPool::RESERVED || pool.node() != node)
+            {
+               pool.openHugepages(hostBufferSize, node);
+            }
+            physAddr = pool.allocate(hostBufferSize).physAddr;
+         }
+         catch(const exception& e)
+         {
+            fprintf(stderr, "Skipping NUMA node %d: %s\n", node, e.what());
+            continue;
+         }
+      }
+
+      // Records and text both say which node the buffer is on, and whether that's the card's
+      bufferNode = node;
+      string scenario = (cardNode < 0) ? "numa:unknown" : (node == cardNode) ? "numa:local" : "numa:remote";
+
+      for (auto& engine : engines)
+      {
+         if (engine.config().target != BandwidthEngine::HOST_MEMORY) continue;
+         engine.setBaseAddress(physAddr);
+
+         // Measure this engine writing to the buffer, then reading from it
+         measurement_t result[2];
+         for (bool isWrite : {true, false})
+         {
+            uint64_t cycles = engine.measure(isWrite, physAddr, burstSize, blockCount);
+            result[isWrite] = {engine.name(), isWrite, physAddr, burstSize, blockCount, cycles,
+                               engine.clockMHz(), engine.bandwidth(hostBufferSize, cycles),
+                               scenario.c_str(), 0, -1, 0};
+            if (conf.format != FMT_TEXT) reportMeasurement(result[isWrite]);
+         }
 
+         if (conf.format == FMT_TEXT)
+         {
+            printf("%-6d %-8s %-10s %12.2lf %12.2lf\n", node, scenario.c_str() + 5, engine.name(),
+                   result[true].gbPerSec, result[false].gbPerSec);
+         }
+
+         // Put the engine back on the main buffer
+         engine.setBaseAddress(hostBuffer.physAddr);
+      }
+   }
+
+   bufferNode = homeNode;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// promLabel() - Escapes a string for use as a Prometheus label value.  Engine names come from
+//               the user's "-engines" file, so they can hold anything
+//=================================================================================================
+static string promLabel(const string& value)
+{
+   string result;
+   for (char c : value)
+   {
+      if (c == '\\')
+         result += "\\\\";
+      else if (c == '"')
+         result += "\\\"";
+      else if (c == '\n')
+         result += "\\n";
+      else
+         result += c;
+   }
+   return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// monitor() - Watches the health of the card's PCIe link and its bandwidth until we're killed
+//
+// Every "-monitor" seconds we read the link's trained speed and width, time a few register reads,
+// and take one short read and one short write measurement with each engine.  The measurements
+// are sized so that, averaged over time, we move no more than "-budget" MB/sec, which lets us
+// run alongside real traffic; if even the smallest sample would exceed the budget, we sample less
+// often instead.  The results go to a Prometheus page (served on "-port", and/or written to
+// "-metrics" for a textfile collector), and in text mode one line is printed per sample.
+//
+// A link is flagged as degraded if it trained below its maximum speed or width, and an engine is
+// flagged if its rolling average falls below 80% of the best rolling average it has had
+//=================================================================================================
+void monitor()
+{
+   const uint64_t MIN_SAMPLE = 64 * 1024;
+   const uint64_t MAX_SAMPLE = 64 * 1024 * 1024;
+   const uint32_t burstSize  = 2048;
+   const size_t   WINDOW     = 6;
+   const double   THRESHOLD  = 0.8;
+   const int      MMIO_READS = 64;
+
+   // This is the rolling history of one engine in one direction
+   struct history_t {vector<double> gbPerSec; double best; double last; double overheadUS;};
+   vector<history_t> history(engines.size() * 2, {{}, 0, 0, 0});
+
+   // Size each measurement so that a whole sample stays within the budget
+   double   interval = conf.monitor;
+   uint64_t budget   = (uint64_t)(conf.budgetMB * 1e6 * interval);
+   uint64_t xferSize = budget / (2 * engines.size()) & ~(MIN_SAMPLE - 1);
+   if (xferSize < MIN_SAMPLE)
+   {
+      xferSize = MIN_SAMPLE;
+      interval = 2 * engines.size() * MIN_SAMPLE / (conf.budgetMB * 1e6);
+   }
+   if (xferSize > MAX_SAMPLE) xferSize = MAX_SAMPLE;
+
+   // If we're serving metrics over HTTP, open the port
+   int server = -1;
+   if (conf.port > 0)
+   {
+      server = openMetricsServer(conf.port);
+      if (server < 0) throw runtime_error("Can't listen on port " + to_string(conf.port));
+   }
+
+   if (conf.format == FMT_TEXT)
+   {
+      printf("Monitoring %s every %.1lf seconds, %lu bytes per measurement\n", PCI.bdf().c_str(),
+             interval, xferSize);
+   }
+
+   // These are the register-read latency stats and running totals
+   RegisterBlockAt<AXI_REVISION> rev(PCI.resourceList()[AXIREG_RESOURCE]);
+   uint64_t samples = 0, bytesMoved = 0;
+
+   while (true)
+   {
+      // Find out what the link trained to
+      double speed = 0, maxSpeed = 0;
+      int    width = 0, maxWidth = 0;
+      bool   haveLink = readPcieLink(PCI.bdf(), &speed, &width, &maxSpeed, &maxWidth);
+      bool   linkDegraded = haveLink && (speed < maxSpeed || width < maxWidth);
+
+      // Time some register reads
+      double mmioTotal = 0, mmioMax = 0;
+      for (int i=0; i<MMIO_READS; ++i)
+      {
+         uint64_t start = nanoTime();
+         rev.read<REV_MAJOR>();
+         double ns = nanoTime() - start;
+         mmioTotal += ns;
+         if (ns > mmioMax) mmioMax = ns;
+      }
+
+      // Take a short measurement with each engine in each direction
+      for (int e=0; e<engines.size(); ++e)
+      {
+         for (bool isWrite : {true, false})
+         {
+            auto& engine = engines[e];
+            auto& h      = history[e * 2 + isWrite];
+            measurement_t m = measure(engine, isWrite, engine.config().baseAddress, burstSize,
+                                      xferLimit(engine, xferSize) / burstSize);
+            m.scenario = "monitor";
+            if (conf.format != FMT_TEXT) reportMeasurement(m);
+
+            // Keep the rolling window up to date
+            h.last       = m.gbPerSec;
+            h.overheadUS = m.hostUS - m.cycles / m.clockMHz;
+            h.gbPerSec.push_back(m.gbPerSec);
+            if (h.gbPerSec.size() > WINDOW) h.gbPerSec.erase(h.gbPerSec.begin());
+            bytesMoved += xferLimit(engine, xferSize);
+         }
+      }
+      ++samples;
+
+      // Build the metrics page.  Engine names come from the user, so nothing here has a fixed
+      // length, and each line is formatted into a string of its own size
+      string page, status;
+      auto   format = [](const char* fmt, auto... args)
+      {
+         string result(snprintf(nullptr, 0, fmt, args...) + 1, '\0');
+         snprintf(&result[0], result.size(), fmt, args...);
+         result.pop_back();
+         return result;
+      };
+      auto   add = [&](const char* fmt, auto... args) {page += format(fmt, args...);};
+
+      add("# HELP sidewinder_link_speed_gts Speed the PCIe link trained to, in GT/sec\n");
+      add("# TYPE sidewinder_link_speed_gts gauge\nsidewinder_link_speed_gts %.1lf\n", speed);
+      add("# HELP sidewinder_link_width Number of lanes the PCIe link trained to\n");
+      add("# TYPE sidewinder_link_width gauge\nsidewinder_link_width %d\n", width);
+      add("# TYPE sidewinder_link_max_speed_gts gauge\nsidewinder_link_max_speed_gts %.1lf\n", maxSpeed);
+      add("# TYPE sidewinder_link_max_width gauge\nsidewinder_link_max_width %d\n", maxWidth);
+      add("# HELP sidewinder_link_degraded 1 if the link trained below its maximum speed or width\n");
+      add("# TYPE sidewinder_link_degraded gauge\nsidewinder_link_degraded %d\n", linkDegraded);
+      add("# HELP sidewinder_mmio_read_ns Round-trip time of a BAR0 register read\n");
+      add("# TYPE sidewinder_mmio_read_ns gauge\n");
+      add("sidewinder_mmio_read_ns{stat=\"avg\"} %.0lf\n", mmioTotal / MMIO_READS);
+      add("sidewinder_mmio_read_ns{stat=\"max\"} %.0lf\n", mmioMax);
+
+      // Work out each engine's rolling average in each direction, and whether it has degraded
+      vector<double> average(history.size());
+      vector<bool>   degraded(history.size());
+      for (int i=0; i<history.size(); ++i)
+      {
+         auto& h = history[i];
+         for (double sample : h.gbPerSec) average[i] += sample;
+         average[i] /= h.gbPerSec.size();
+
+         // Only a full window counts towards the best average, so start-up noise can't set it
+         if (h.gbPerSec.size() == WINDOW && average[i] > h.best) h.best = average[i];
+         degraded[i] = h.best > 0 && average[i] < THRESHOLD * h.best;
+
+         status += format("  %s %s %.2lf%s", engines[i / 2].name(), (i & 1) ? "write" : "read", h.last,
+                          degraded[i] ? " (DEGRADED)" : "");
+      }
+
+      // Each family's samples have to follow its own HELP and TYPE lines, all in one group
+      auto family = [&](const char* name, const string& help, function<string(int)> value)
+      {
+         add("# HELP %s %s\n# TYPE %s gauge\n", name, help.c_str(), name);
+         for (int i=0; i<history.size(); ++i)
+         {
+            add("%s{engine=\"%s\",direction=\"%s\"} %s\n", name, promLabel(engines[i / 2].name()).c_str(),
+                (i & 1) ? "write" : "read", value(i).c_str());
+         }
+      };
+
+      family("sidewinder_bandwidth_gbps", "Most recent bandwidth sample",
+             [&](int i) {return format("%.4lf", history[i].last);});
+      family("sidewinder_bandwidth_avg_gbps", format("Average of the last %zu bandwidth samples", WINDOW),
+             [&](int i) {return format("%.4lf", average[i]);});
+      family("sidewinder_completion_overhead_us", "Host-observed time beyond the engine's own",
+             [&](int i) {return format("%.2lf", history[i].overheadUS);});
+      family("sidewinder_bandwidth_degraded",
+             format("1 if the average fell below %.0lf%% of its best", THRESHOLD * 100),
+             [&](int i) {return string(degraded[i] ? "1" : "0");});
+
+      add("# TYPE sidewinder_samples_total counter\nsidewinder_samples_total %lu\n", samples);
+      add("# TYPE sidewinder_bytes_moved_total counter\nsidewinder_bytes_moved_total %lu\n", bytesMoved);
+
+      // If the user wants the metrics in a file, write a temporary file and rename it, so that
+      // readers never see a half-written page
+      if (!conf.metricsFile.empty())
+      {
+         string tempName = conf.metricsFile + ".tmp";
+         FILE*  ofile    = fopen(tempName.c_str(), "w");
+         if (ofile)
+         {
+            fputs(page.c_str(), ofile);
+            fclose(ofile);
+            rename(tempName.c_str(), conf.metricsFile.c_str());
+         }
+      }
+
+      // In text mode, print a one-line summary of this sample
+      if (conf.format == FMT_TEXT)
+      {
+         time_t now = time(nullptr);
+         char   timestamp[32];
+         strftime(timestamp, sizeof timestamp, "%H:%M:%S", localtime(&now));
+         printf("%s  link %.1lf GT/s x%d%s  mmio %.0lf ns%s\n", timestamp, speed, width,
+                linkDegraded ? " (DEGRADED)" : "", mmioTotal / MMIO_READS, status.c_str());
+         fflush(stdout);
+      }
+
+      // And serve the page until it's time for the next sample
+      serveMetrics(server, page, interval);
+   }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// process() - Take the bandwidth measurements and report the results
+//=================================================================================================
+void process()
+{
    // We're going to transfer 1 GB of data
    uint64_t xferSize  = 1024 * 1024 * 1024;
-   
+
    // Define the size of each AXI burst (in bytes)
    uint32_t burstSize = 2048;
 
-   //-----------------------------------------------------------------------
-   // >>>>>>>>>>>>>>>>>>>>  Measure PCI write bandwidth  <<<<<<<<<<<<<<<<<<<<
-   //-----------------------------------------------------------------------
+   // Measure and report the write bandwidth of each engine, then the read bandwidth of each
+   for (bool isWrite : {true, false})
+   {
+      for (auto& engine : engines)
+      {
+         // This is the number of bursts it takes to transfer all of the data this engine can
+         uint32_t blockCount = xferLimit(engine, xferSize) / burstSize;
+         reportMeasurement(measure(engine, isWrite, engine.config().baseAddress, burstSize, blockCount));
+      }
+   }
+}
+//=================================================================================================
 
-   // Measure the number of clock cycles required to read the data from the PCI bus
-   cycles = measureWriteBandwidth(MBW_PCI, contigAddress, burstSize, xferSize / burstSize);
 
-   // Translate the measured number of clock cycles into nanoseconds
-   nanoseconds = cycles * 1000 / PCI_CLOCK_SPEED;
-   
-   // Compute the bandwidth in GB/sec
-   gbPerSec = xferSize / nanoseconds;
+//=================================================================================================
+// createEngines() - Builds the list of bandwidth measurement engines and makes sure that each
+//                   one is really present in the bitstream
+//
+// Passed: hostAddress = physical address of a contiguous host DMA buffer that is at least
+//                       hostBufferSize bytes long
+//=================================================================================================
+void createEngines(uint64_t hostAddress)
+{
+   // Fetch the list of engines from the user's file, or use the built-in list
+   auto configList = conf.engineFile.empty() ? BandwidthEngine::defaultConfig()
+                                             : BandwidthEngine::loadConfig(conf.engineFile);
 
-   // Tell the user the bandwidth for writing to the PCI bus
-   printf("%5.1lf Mhz PCI write time = %9lu cycles (%4.1lf GB/sec)\n", PCI_CLOCK_SPEED, cycles, gbPerSec);
+   // Fetch the userspace address of the AXI registers
+   uint8_t* bar0 = PCI.resourceList()[AXIREG_RESOURCE].baseAddr;
 
-   //-----------------------------------------------------------------------
-   // >>>>>>>>>>>>>>>>>>>>  Measure DDR write bandwidth  <<<<<<<<<<<<<<<<<<<<
-   //-----------------------------------------------------------------------
+   // These are the interrupt sources that engines have claimed so far
+   vector<int> usedIrqs;
+   bool        cmdIrqTaken = false;
 
-   // Measure the number of clock cycles required to read the data from the PCI bus
-   cycles = measureWriteBandwidth(MBW_DDR, 0, burstSize, xferSize / burstSize);
+   for (auto config : configList)
+   {
+      // Engines that target host memory measure against the host DMA buffer
+      if (config.target == BandwidthEngine::HOST_MEMORY) config.baseAddress = hostAddress;
 
-   // Translate the measured number of clock cycles into nanoseconds
-   nanoseconds = cycles * 1000 / DDR_CLOCK_SPEED;
-   
-   // Compute the bandwidth in GB/sec
-   gbPerSec = xferSize / nanoseconds;
+      // If there's no engine at that address, warn the user and skip it
+      if (!BandwidthEngine(config, bar0).probe())
+      {
+         fprintf(stderr, "No measure_bw core found for %s at 0x%x, skipping it\n",
+                 config.name.c_str(), config.regOffset);
+         continue;
+      }
 
-   // Tell the user the bandwidth for writing to DDR RAM
-   printf("%5.1lf Mhz DDR write time = %9lu cycles (%4.1lf GB/sec)\n", DDR_CLOCK_SPEED, cycles, gbPerSec);
+      // The first engine with no interrupt of its own uses the one from the command line
+      if (config.irq < 0 && !cmdIrqTaken)
+      {
+         config.irq  = conf.irq;
+         cmdIrqTaken = true;
+      }
 
-   //-----------------------------------------------------------------------
-   // >>>>>>>>>>>>>>>>>>>>  Measure PCI read bandwidth  <<<<<<<<<<<<<<<<<<<<
-   //-----------------------------------------------------------------------
+      // Engines that shared an interrupt source would consume each other's notifications, so
+      // only the first engine to claim a source gets it
+      if (config.irq >= 0 && find(usedIrqs.begin(), usedIrqs.end(), config.irq) != usedIrqs.end())
+      {
+         fprintf(stderr, "%s shares interrupt %d with another engine, polling for completion instead\n",
+                 config.name.c_str(), config.irq);
+         config.irq = -1;
+      }
+      if (config.irq >= 0) usedIrqs.push_back(config.irq);
 
-   // Measure the number of clock cycles required to read the data from the PCI bus
-   cycles = measureReadBandwidth(MBW_PCI, contigAddress, burstSize, xferSize / burstSize);
+      // Create the engine
+      BandwidthEngine engine(config, bar0);
 
-   // Translate the measured number of clock cycles into nanoseconds
-   nanoseconds = cycles * 1000 / PCI_CLOCK_SPEED;
-   
-   // Compute the bandwidth in GB/sec
-   gbPerSec = xferSize / nanoseconds;
+      // If this engine has a completion interrupt, open the FIFO (or broker eventfd) it arrives on
+      if (brokerSock < 0)
+         engine.openIrq(conf.dirName);
+      else if (config.irq >= 0)
+      {
+         int fd = brokerIrqFD(brokerSock, brokerCard, config.irq);
+         if (fd < 0) fprintf(stderr, "The broker has no interrupt %d, polling for completion instead\n", config.irq);
+         engine.setIrqFD(fd);
+      }
 
-   // Tell the user the bandwidth for reading from the PCI bus
-   printf("%5.1lf Mhz PCI read time  = %9lu cycles (%4.1lf GB/sec)\n", PCI_CLOCK_SPEED, cycles, gbPerSec);
+      // Add this engine to our list
+      engines.push_back(engine);
+   }
 
-   //-----------------------------------------------------------------------
-   // >>>>>>>>>>>>>>>>>>>>  Measure DDR read bandwidth  <<<<<<<<<<<<<<<<<<<<
-   //-----------------------------------------------------------------------
-   
-   // Measure the number of clock cycles required to read the data from the PCI bus
-   cycles = measureReadBandwidth(MBW_DDR, 0, burstSize, xferSize / burstSize);
+   // If there are no engines, there's nothing we can measure
+   if (engines.empty()) throw runtime_error("No bandwidth measurement engines found");
 
-   // Translate the measured number of clock cycles into nanoseconds
-   nanoseconds = cycles * 1000 / DDR_CLOCK_SPEED;
-   
-   // Compute the bandwidth in GB/sec
-   gbPerSec = xferSize / nanoseconds;
+   // If we're sharing the card through the broker, wait until nobody else is using our engines
+   if (brokerSock >= 0)
+   {
+      uint64_t mask = 0;
+      for (auto& engine : engines) mask |= 1ULL << (engine.config().regOffset >> 12);
+      if (!brokerLockEngines(brokerSock, brokerCard, mask, true))
+      {
+         throw runtime_error("The broker wouldn't give us the bandwidth measurement engines");
+      }
+   }
+}
+//=================================================================================================
+
+
+
+//=================================================================================================
+// readEngineClocks() - If the bitstream reports the clock rate of each measure_bw core in its
+//                      axi_revision registers, uses those rates in place of the built-in ones.
+//                      Rates from an engine definition file are left alone, but we say so if
+//                      they disagree with the bitstream
+//=================================================================================================
+void readEngineClocks()
+{
+   RegisterBlockAt<AXI_REVISION> rev(PCI.resourceList()[AXIREG_RESOURCE]);
+
+   // Older bitstreams don't have the clock-rate registers
+   if (rev.read<REV_CLKS>() != REV_CLOCK_MAGIC) return;
+
+   for (auto& engine : engines)
+   {
+      uint32_t slot = engine.config().regOffset >> 12;
+      if (slot < 1 || slot > 3) continue;
+
+      // A rate of zero means the bitstream doesn't know this core's clock
+      double clockMHz = rev.read(REV_SLOT1 + slot - 1) / 1000.0;
+      if (clockMHz == 0) continue;
+
+      if (conf.engineFile.empty())
+         engine.setClockMHz(clockMHz);
+      else if (fabs(clockMHz - engine.clockMHz()) > CLOCK_TOLERANCE * clockMHz)
+      {
+         fprintf(stderr, "%s is configured for %.3lf MHz, but the bitstream says its clock is %.3lf MHz\n",
+                 engine.name(), engine.clockMHz(), clockMHz);
+      }
+   }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// rawTime() - Returns a timestamp in nanoseconds from a clock that NTP doesn't adjust the rate of
+//=================================================================================================
+uint64_t rawTime()
+{
+   timespec ts;
+   clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// calibrateClocks() - Finds out how fast each engine's clock really runs, by comparing the cycles
+//                     it counts during a long read against the host's raw monotonic clock, and
+//                     computes GB/sec figures from the measured clock from then on
+//
+// Starting a run and noticing it has finished take a fixed amount of host time that the engine
+// doesn't count, so we time a short run and a long one and use the difference between them,
+// which cancels that out.  Any engine whose measured clock is out of tolerance is flagged
+//=================================================================================================
+void calibrateClocks()
+{
+   const uint64_t LONG_RUN  = 512 << 20;
+   const int      RATIO     = 8;
+
+   if (conf.format == FMT_TEXT)
+   {
+      printf("%-10s %14s %14s %9s\n", "engine", "configured MHz", "measured MHz", "error");
+   }
+
+   for (auto& engine : engines)
+   {
+      uint32_t burstSize = min(engine.config().maxBurst, (uint32_t)4096);
+      uint64_t longSize  = xferLimit(engine, LONG_RUN);
+      uint64_t address   = engine.config().baseAddress;
+      uint64_t cycles[2], ns[2];
+
+      // Time a short read and a long read
+      for (int i=0; i<2; ++i)
+      {
+         uint32_t blockCount = (i == 0 ? longSize / RATIO : longSize) / burstSize;
+         uint64_t startTime  = rawTime();
+         cycles[i] = engine.measure(false, address, burstSize, blockCount);
+         ns[i]     = rawTime() - startTime;
+      }
+
+      // The extra cycles over the extra time is the clock rate
+      if (cycles[1] <= cycles[0] || ns[1] <= ns[0]) continue;
+      double measured   = (double)(cycles[1] - cycles[0]) * 1000 / (ns[1] - ns[0]);
+      double configured = engine.clockMHz();
+      double error      = (configured - measured) / measured;
+
+      if (conf.format == FMT_TEXT)
+      {
+         printf("%-10s %14.3lf %14.3lf %8.2lf%%%s\n", engine.name(), configured, measured, error * 100,
+                fabs(error) > CLOCK_TOLERANCE ? "  <-- out of tolerance" : "");
+      }
+
+      // Whatever the output format, say so when this changes the engine's GB/sec figures
+      if (fabs(error) > CLOCK_TOLERANCE)
+      {
+         fprintf(stderr, "%s is configured for %.3lf MHz, but its clock measures %.3lf MHz; using the measured clock\n",
+                 engine.name(), configured, measured);
+      }
+      engine.setClockMHz(measured);
+   }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// verifyCardMemory() - Writes a pseudo-random pattern into the card's DDR through BAR1, reads it
+//                      back, and reports whether it survived the round trip
+//=================================================================================================
+void verifyCardMemory()
+{
+   auto& resource = PCI.resourceList();
+   uint64_t firstBad;
+
+   // If there's no BAR1, there's nothing the host can write
+   if (resource.size() <= DDR_RESOURCE) return;
+   uint8_t* bar1 = PCI.resource(DDR_RESOURCE).baseAddr;
+   size_t   size = resource[DDR_RESOURCE].size;
+
+   // Every run uses a different seed, so a stale pattern from an earlier run can't pass
+   uint64_t seed = nanoTime();
 
-   // Tell the user the bandwidth for reading from DDR RAM
-   printf("%5.1lf Mhz DDR read time  = %9lu cycles (%4.1lf GB/sec)\n", DDR_CLOCK_SPEED, cycles, gbPerSec);
+   // Write the pattern, and read it back
+   fillPrbs(bar1, size, seed, conf.verify);
+   uint64_t badBeats = checkPrbs(bar1, size, seed, conf.verify, &firstBad);
 
+   // Tell the user how it went
+   if (badBeats)
+      fprintf(stderr, "Host pattern in DDR: %lu BAD BEATS, first at offset 0x%lx\n", badBeats, firstBad);
+   else if (conf.format == FMT_TEXT)
+      printf("Host pattern in DDR: 0x%lx bytes verified\n", size);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// dumpTrace() - Writes the MMIO trace to a file when we exit
+//=================================================================================================
+void dumpTrace()
+{
+   int64_t count = MmioTrace::dump(conf.traceFile.c_str());
+   if (count < 0)
+      fprintf(stderr, "Can't write MMIO trace %s\n", conf.traceFile.c_str());
+   else
+      fprintf(stderr, "Wrote %ld register accesses to %s\n", count, conf.traceFile.c_str());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// showHelp() - Displays help text to the user
+//=================================================================================================
+void showHelp()
+{
+   printf("options:\n");
+   printf(" -sweep\n");
+   printf(" -concurrent\n");
+   printf(" -parallel\n");
+   printf(" -repeat <# of runs per sweep point>\n");
+   printf(" -csv\n");
+   printf(" -json\n");
+   printf(" -irq <completion interrupt source>\n");
+   printf(" -dir <interrupt fifo_directory_name>\n");
+   printf(" -latency [# of samples]\n");
+   printf(" -cpu <cpu to run on>\n");
+   printf(" -engines <engine definition file>\n");
+   printf(" -cpustream [# of threads]\n");
+   printf(" -wc\n");
+   printf(" -bdf <PCI bus:device.function>\n");
+   printf(" -card <index of card>\n");
+   printf(" -list\n");
+   printf(" -irqring [seconds]\n");
+   printf(" -verify [# of threads]\n");
+   printf(" -pipeline [chunk size]\n");
+   printf(" -depth <# of DDR buffers in the pipeline>\n");
+   printf(" -broker [socket name]\n");
+   printf(" -trace [MMIO trace file]\n");
+   printf(" -decode <MMIO trace file>\n");
+   printf(" -plan <test plan file>\n");
+   printf(" -patterns [block size]\n");
+   printf(" -numa\n");
+   printf(" -calibrate\n");
+   printf(" -monitor [seconds between samples]\n");
+   printf(" -budget <MB/sec the monitor may use>\n");
+   printf(" -port <TCP port to serve Prometheus metrics on>\n");
+   printf(" -metrics <Prometheus metrics file>\n");
+   printf(" -warmup <# of untimed runs before each test>\n");
+   printf(" -settle <milliseconds to wait before each test>\n");
+   exit(1);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// parseCommandLine() - Parses the command line, filling in the "conf" structure
+//=================================================================================================
+void parseCommandLine(const char** argv)
+{
+   int idx = 0;
+
+   while (true)
+   {
+      // Fetch the next command-line token
+      const char* token = argv[++idx];
+
+      // If we've hit the end of the list, we're done
+      if (token == nullptr) break;
+
+      // For convenience, convert that token to a string
+      string option = token;
+
+      // Assume for a moment that this option has no argument
+      string arg = "";
+
+      // If there's an argument available fetch it
+      if (argv[idx+1] && *argv[idx+1] != '-') arg = argv[++idx];
+
+      if (option == "-sweep")
+         conf.sweep = true;
+      else if (option == "-concurrent")
+         conf.concurrent = true;
+      else if (option == "-parallel")
+         conf.parallel = true;
+      else if (option == "-repeat" && !arg.empty())
+         conf.repeat = stoi(arg, 0, 0);
+      else if (option == "-csv")
+         conf.format = FMT_CSV;
+      else if (option == "-json")
+         conf.format = FMT_JSON;
+      else if (option == "-irq" && !arg.empty())
+         conf.irq = stoi(arg, 0, 0);
+      else if (option == "-dir" && !arg.empty())
+         conf.dirName = arg;
+      else if (option == "-latency")
+         conf.latency = arg.empty() ? 1000000 : stoi(arg, 0, 0);
+      else if (option == "-cpu" && !arg.empty())
+         conf.cpu = stoi(arg, 0, 0);
+      else if (option == "-engines" && !arg.empty())
+         conf.engineFile = arg;
+      else if (option == "-cpustream")
+         conf.cpuStream = arg.empty() ? thread::hardware_concurrency() : stoi(arg, 0, 0);
+      else if (option == "-wc")
+         conf.wc = true;
+      else if (option == "-bdf" && !arg.empty())
+         conf.bdf = arg;
+      else if (option == "-card" && !arg.empty())
+         conf.card = stoi(arg, 0, 0);
+      else if (option == "-list")
+         conf.list = true;
+      else if (option == "-irqring")
+         conf.irqRing = arg.empty() ? 10 : stoi(arg, 0, 0);
+      else if (option == "-pipeline")
+         conf.pipeline = arg.empty() ? 4 << 20 : stoul(arg, 0, 0);
+      else if (option == "-depth" && !arg.empty())
+         conf.depth = stoi(arg, 0, 0);
+      else if (option == "-monitor")
+         conf.monitor = arg.empty() ? 10 : stod(arg);
+      else if (option == "-budget" && !arg.empty())
+         conf.budgetMB = stod(arg);
+      else if (option == "-port" && !arg.empty())
+         conf.port = stoi(arg, 0, 0);
+      else if (option == "-metrics" && !arg.empty())
+         conf.metricsFile = arg;
+      else if (option == "-calibrate")
+         conf.calibrate = true;
+      else if (option == "-numa")
+         conf.numa = true;
+      else if (option == "-patterns")
+         conf.patterns = arg.empty() ? 4096 : stoul(arg, 0, 0);
+      else if (option == "-plan" && !arg.empty())
+         conf.planFile = arg;
+      else if (option == "-warmup" && !arg.empty())
+         conf.warmup = stoi(arg, 0, 0);
+      else if (option == "-settle" && !arg.empty())
+         conf.settleMS = stoi(arg, 0, 0);
+      else if (option == "-trace")
+         conf.traceFile = arg.empty() ? "mmio.trace" : arg;
+      else if (option == "-decode" && !arg.empty())
+         conf.decodeFile = arg;
+      else if (option == "-broker")
+         conf.broker = arg.empty() ? BROKER_SOCKET : arg;
+      else if (option == "-verify")
+         conf.verify = arg.empty() ? thread::hardware_concurrency() : stoi(arg, 0, 0);
+      else
+         showHelp();
+   }
+
+   // We always need at least one run per measurement
+   if (conf.repeat < 1) showHelp();
+
+   // A pipeline needs at least two DDR buffers so that writing one overlaps reading another
+   if (conf.depth < 2) showHelp();
+
+   // The monitor can't run without a bandwidth budget
+   if (conf.monitor < 0 || conf.budgetMB <= 0) showHelp();
 }
 //=================================================================================================
 
@@ -219,18 +1762,204 @@ void process(uint64_t contigAddress)
 //=================================================================================================
 // main() - Execution begins here
 //=================================================================================================
-int main()
+int main(int argc, const char** argv)
 {
+   // Set some default configuration parameters
+   conf.sweep      = false;
+   conf.concurrent = false;
+   conf.parallel   = false;
+   conf.repeat     = 5;
+   conf.format     = FMT_TEXT;
+   conf.irq        = -1;
+   conf.dirName    = ".";
+   conf.latency    = 0;
+   conf.cpu        = -1;
+   conf.cpuStream  = 0;
+   conf.wc         = false;
+   conf.card       = 0;
+   conf.list       = false;
+   conf.irqRing    = 0;
+   conf.verify     = 0;
+   conf.pipeline   = 0;
+   conf.depth      = 2;
+   conf.warmup     = 0;
+   conf.patterns   = 0;
+   conf.numa       = false;
+   conf.calibrate  = false;
+   conf.monitor    = 0;
+   conf.budgetMB   = 10;
+   conf.port       = 0;
+   conf.settleMS   = 0;
+
+   // Parse configuration parameters from the command line
+   parseCommandLine(argv);
+
+   // Decoding an MMIO trace doesn't need the card
+   if (!conf.decodeFile.empty()) return decodeMmioTrace(conf.decodeFile) ? 0 : 1;
+
+   // If the user wants a record of our register traffic, start recording
+   if (!conf.traceFile.empty())
+   {
+      if (!MmioTrace::compiledIn())
+         fprintf(stderr, "MMIO tracing isn't compiled in.  Rebuild with \"make TRACE=1\"\n");
+      else
+      {
+         MmioTrace::enable();
+         atexit(dumpTrace);
+      }
+   }
+
+   // If the user wants us to run on a specific CPU, make it so
+   if (conf.cpu >= 0)
+   {
+      cpu_set_t cpuSet;
+      CPU_ZERO(&cpuSet);
+      CPU_SET(conf.cpu, &cpuSet);
+      if (sched_setaffinity(0, sizeof cpuSet, &cpuSet) != 0)
+      {
+         fprintf(stderr, "Can't run on CPU %d\n", conf.cpu);
+         exit(1);
+      }
+   }
+
    try
    {
-      // Map the Sidewinder's PCI resources into userspace
-      PCI.open(0x10ee, 0x903f);
+      // If the user wants the DDR window mapped write-combining, tell the PCI driver
+      if (conf.wc) PCI.setWriteCombining(DDR_RESOURCE);
+
+      // Only a few modes touch the DDR window, so it isn't mapped until one of them does.  It's
+      // mapped up front if it's to be write-combining (which we check for below), or if the
+      // measurement threads will verify through it.  Whoever maps it sweeps it end to end, so its
+      // page tables are filled in as it's mapped
+      if (!conf.wc && conf.verify == 0) PCI.setLazy(DDR_RESOURCE);
+      PCI.setPopulate(DDR_RESOURCE);
+
+      // Watching the interrupt driver's event ring doesn't need the card
+      if (conf.irqRing > 0)
+      {
+         watchIrqRing(conf.dirName, conf.irqRing);
+         return 0;
+      }
+
+      // If the user just wants to know which cards are installed, tell them
+      if (conf.list)
+      {
+         auto cards = findPciDevices(SIDEWINDER_VENDOR, SIDEWINDER_DEVICE);
+         for (int i=0; i<cards.size(); ++i) printf("card %d: %s\n", i, cards[i].bdf.c_str());
+         if (cards.empty()) printf("No Sidewinder cards found\n");
+         return 0;
+      }
+
+      // Map the Sidewinder's PCI resources into userspace, either ourselves or through the broker
+      if (!conf.broker.empty())
+      {
+         brokerSock = brokerConnect(conf.broker);
+         if (brokerSock < 0) throw runtime_error("Can't connect to the broker at " + conf.broker);
+         brokerCard = conf.bdf.empty() ? conf.card : brokerFindCard(brokerSock, conf.bdf);
+         brokerOpenDevice(brokerSock, brokerCard, PCI, conf.wc ? (1 << DDR_RESOURCE) : 0);
+      }
+      else if (conf.bdf.empty())
+         PCI.open(SIDEWINDER_VENDOR, SIDEWINDER_DEVICE, conf.card);
+      else
+         PCI.open(conf.bdf);
+
+      // Unless the user picked a CPU, run on the card's own NUMA node.  Every thread we start
+      // from here on (including the ones that wait for interrupts) inherits this
+      cardNode = numaNodeOfDevice(PCI.bdf());
+      if (conf.cpu < 0 && cardNode >= 0 && numaNodeCount() > 1 && !pinToNode(cardNode))
+      {
+         fprintf(stderr, "Can't run on the CPUs of NUMA node %d\n", cardNode);
+      }
+
+      // Let the user know if they asked for write-combining and couldn't get it
+      auto& resource = PCI.resourceList();
+      if (conf.wc && (resource.size() <= DDR_RESOURCE || !resource[DDR_RESOURCE].isWC))
+      {
+         fprintf(stderr, "Write-combining mapping of the DDR window is unavailable, using uncached\n");
+      }
+
+      // Find out which machine and which bitstream these measurements come from
+      char buffer[256] = "";
+      gethostname(buffer, sizeof buffer - 1);
+      hostName     = buffer;
+      fpgaRevision = readRevision();
+
+      // Register latency doesn't need the reserved buffer
+      if (conf.latency > 0)
+      {
+         measureMmioLatency(PCI.resourceList()[AXIREG_RESOURCE].baseAddr, conf.latency);
+         return 0;
+      }
+
+      // Map the host memory the card will DMA into: a region reserved at boot time (on the
+      // card's node, if one is) if there is one, and hugepages on the card's node if there isn't
+      if (DMA.open(HOST_BUFFER_SIZE, cardNode) == DmaPool::HUGEPAGES && conf.format == FMT_TEXT)
+      {
+         printf("No memmap= reservation, using hugepages for host DMA buffers\n");
+      }
+
+      // On a NUMA machine, tell the user where the card and its buffer are
+      bufferNode = DMA.node();
+      if (numaNodeCount() > 1 && conf.format == FMT_TEXT && !conf.numa)
+      {
+         printf("Card %s is on NUMA node %d, host DMA buffer is on node %d%s\n", PCI.bdf().c_str(),
+                cardNode, bufferNode, (cardNode >= 0 && bufferNode != cardNode) ? " (remote)" : "");
+      }
+
+      // Carve out the buffer the engines (or the CPU) stream through.  If the pool is smaller than
+      // we'd like, every host-memory transfer shrinks to fit
+      hostBufferSize = min(HOST_BUFFER_SIZE, DMA.largestFree() & ~((size_t)(1 << 20) - 1));
+      if (hostBufferSize < MIN_HOST_BUFFER)
+      {
+         throw runtime_error("The DMA pool has no room for a " + to_string(MIN_HOST_BUFFER >> 20) + " MB buffer");
+      }
+      if (hostBufferSize < HOST_BUFFER_SIZE && conf.format == FMT_TEXT)
+      {
+         printf("Host DMA buffer is %lu MB, host-memory transfers are limited to that\n", hostBufferSize >> 20);
+      }
+      auto hostBuffer = DMA.allocate(hostBufferSize);
+
+      // CPU-initiated throughput doesn't need the bandwidth measurement engines
+      if (conf.cpuStream > 0)
+      {
+         bool     found = resource.size() > DDR_RESOURCE;
+         uint8_t* bar1  = found ? PCI.resource(DDR_RESOURCE).baseAddr : nullptr;
+         size_t   size  = found ? resource[DDR_RESOURCE].size : 0;
+         bool     isWC  = found ? resource[DDR_RESOURCE].isWC : false;
+         measureCpuBandwidth(bar1, size, isWC, hostBuffer.virtAddr, hostBuffer.size, conf.cpuStream);
+         return 0;
+      }
+
+      // Find the bandwidth measurement engines in the bitstream
+      createEngines(hostBuffer.physAddr);
+
+      // Find out what clock each engine runs at.  Measuring it against the host's clock takes
+      // half a gigabyte of transfers per engine, so that only happens when we're asked to
+      readEngineClocks();
+      if (conf.calibrate) calibrateClocks();
 
-      // Find the address of the reserved contiguous buffer
-      uint64_t contigAddress = findContig();
+      // If we're verifying data, make sure the host can get data to the card's DDR intact first
+      if (conf.verify > 0) verifyCardMemory();
 
-      // And go measure and report our bandwidth 
-      process(contigAddress);
+      // And go measure and report our bandwidth
+      if (!conf.planFile.empty())
+         runPlan();
+      else if (conf.patterns)
+         patterns();
+      else if (conf.numa)
+         numaCompare(hostBuffer);
+      else if (conf.monitor > 0)
+         monitor();
+      else if (conf.sweep)
+         sweep();
+      else if (conf.concurrent)
+         concurrent();
+      else if (conf.parallel)
+         parallel();
+      else if (conf.pipeline)
+         pipeline();
+      else
+         process();
    }
 
    catch(const std::exception& e)
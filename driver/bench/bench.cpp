@@ -0,0 +1,310 @@
+//=================================================================================================
+// bench.cpp - Microbenchmarks of the driver's hot paths that run without a Sidewinder installed
+//
+// Build with "make bench" and run "./poc_bench.x86".  No hardware, root, or UIO device is needed:
+//   - distribute() is timed writing into real FIFOs (in a scratch directory) and real eventfds,
+//     with 1 to 32 sources active per call, so the fan-out cost per source is visible
+//   - UIO wakeup latency is measured in loopback: an eventfd stands in for /dev/uioN, and a
+//     thread blocked on it plays the role of monitorInterrupts()
+//   - the same loopback is then carried through distribute() to a consumer blocked on its FIFO,
+//     which is the path "-selftest" measures with a card
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+#include "../distributor.h"
+#include "Histogram.h"
+
+using namespace std;
+
+void benchDistribute(CDistributor::notify_t mode, bool useRing);
+void benchWakeup();
+void benchDelivery();
+void parseCommandLine(const char** argv);
+
+// Configuration parameters from the command line
+struct conf_t
+{
+    int iterations;
+} conf;
+
+// These are the numbers of active sources that distribute() is timed with
+static const int fanout[] = {1, 2, 4, 8, 16, 32};
+
+// A FIFO holds 64K bytes, so this many notifications per source always fit between drains
+static const int DISTRIBUTE_BATCH = 4096;
+
+
+//=================================================================================================
+// main() - Runs every benchmark and prints one line per result
+//=================================================================================================
+int main(int argc, const char** argv)
+{
+    try
+    {
+        parseCommandLine(argv);
+
+        benchDistribute(CDistributor::FIFO_MODE,    false);
+        benchDistribute(CDistributor::EVENTFD_MODE, false);
+        benchDistribute(CDistributor::EVENTFD_MODE, true);
+        benchWakeup();
+        benchDelivery();
+    }
+    catch (const exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        exit(1);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// parseCommandLine() - Parses the command line parameters
+//=================================================================================================
+void parseCommandLine(const char** argv)
+{
+    int i = 0;
+
+    // Set up defaults
+    conf.iterations = 100000;
+
+    while (argv[++i])
+    {
+        const char* arg = argv[i];
+
+        if (strcmp(arg, "-iterations") == 0 && argv[i+1])
+        {
+            conf.iterations = atoi(argv[++i]);
+            if (conf.iterations < 1) throw runtime_error("-iterations must be at least 1");
+            continue;
+        }
+
+        fprintf(stderr, "Usage: poc_bench [-iterations <count>]\n");
+        exit(1);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// nanoTime() - Returns the current time in nanoseconds
+//=================================================================================================
+static uint64_t nanoTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// scratchDir() - Creates an empty directory for FIFOs and sockets, and returns its name
+//=================================================================================================
+static string scratchDir()
+{
+    char name[] = "/tmp/poc_bench.XXXXXX";
+    if (mkdtemp(name) == nullptr) throw runtime_error("Can't create a scratch directory in /tmp");
+    return name;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// openReaders() - Opens the read end of each FIFO that a distributor created in "dir"
+//=================================================================================================
+static void openReaders(string dir, int count, int* fd)
+{
+    for (int i=0; i<count; ++i)
+    {
+        string name = dir + "/interrupt" + to_string(i);
+        fd[i] = open(name.c_str(), O_RDONLY | O_NONBLOCK);
+        if (fd[i] < 0) throw runtime_error("Can't open " + name);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// drain() - Reads everything that's waiting in a set of FIFOs
+//=================================================================================================
+static void drain(const int* fd, int count)
+{
+    char buffer[65536];
+    for (int i=0; i<count; ++i) while (read(fd[i], buffer, sizeof buffer) > 0);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// printLatency() - Prints the summary of a latency histogram that was recorded in nanoseconds
+//=================================================================================================
+static void printLatency(const char* name, const LatencyHistogram& h)
+{
+    printf("%-36s min %6.1f  p50 %6.1f  p99 %6.1f  p99.9 %7.1f  max %8.1f usec\n", name,
+           h.min() / 1e3, h.percentile(50) / 1e3, h.percentile(99) / 1e3,
+           h.percentile(99.9) / 1e3, h.max() / 1e3);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// benchDistribute() - Times distribute() with increasing numbers of active sources
+//
+// In FIFO mode the consumers' ends of the FIFOs are drained between batches (outside the timed
+// region) so that no notification is dropped; a dropped notification skips the write() and would
+// make distribute() look cheaper than it is
+//=================================================================================================
+void benchDistribute(CDistributor::notify_t mode, bool useRing)
+{
+    CDistributor distributor;
+    int          reader[32];
+    const int    irqCount = 32;
+
+    string dir = scratchDir();
+    if (!distributor.init(dir, irqCount, mode, useRing))
+        throw runtime_error("Can't initialize the distributor in " + dir);
+    if (mode == CDistributor::FIFO_MODE) openReaders(dir, irqCount, reader);
+
+    string title = (mode == CDistributor::FIFO_MODE) ? "fifo" : "eventfd";
+    if (useRing) title += "+ring";
+
+    for (int sources : fanout)
+    {
+        uint32_t mask = (sources == 32) ? 0xFFFFFFFF : (1u << sources) - 1;
+        uint64_t elapsed = 0;
+
+        // Time the calls in batches, draining the FIFOs in between
+        for (int done = 0; done < conf.iterations; done += DISTRIBUTE_BATCH)
+        {
+            int count = min(DISTRIBUTE_BATCH, conf.iterations - done);
+            uint64_t startTime = nanoTime();
+            for (int i=0; i<count; ++i) distributor.distribute(mask, i, startTime);
+            elapsed += nanoTime() - startTime;
+            if (mode == CDistributor::FIFO_MODE) drain(reader, irqCount);
+        }
+
+        // Make sure every notification really went out
+        uint64_t dropped = 0;
+        for (int i=0; i<sources; ++i) dropped += distributor.dropped(i);
+
+        double ns = (double)elapsed / conf.iterations;
+        printf("distribute %-12s %2d source%s  %9.1f ns/call  %7.1f ns/source%s\n", title.c_str(),
+               sources, sources == 1 ? " " : "s", ns, ns / sources, dropped ? "  (notifications dropped!)" : "");
+    }
+
+    if (mode == CDistributor::FIFO_MODE) for (int i=0; i<irqCount; ++i) close(reader[i]);
+    distributor.cleanup();
+    rmdir(dir.c_str());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// benchWakeup() - Measures how long a thread blocked on a mock UIO device takes to wake up
+//
+// monitorInterrupts() sleeps in a blocking read() of /dev/uioN, which the kernel completes from
+// the interrupt handler.  Here, a blocking eventfd plays /dev/uioN and an eventfd_write() plays
+// the interrupt, so the measurement covers the same wakeup and scheduling path minus the hardware
+//=================================================================================================
+void benchWakeup()
+{
+    LatencyHistogram     histogram;
+    atomic<uint64_t>     sentTime(0);
+    int                  uio = eventfd(0, EFD_CLOEXEC);
+    int                  ack = eventfd(0, EFD_CLOEXEC);
+
+    if (uio < 0 || ack < 0) throw runtime_error("Can't create an eventfd");
+
+    // This plays the part of the driver's monitor thread
+    thread waiter([&]()
+    {
+        eventfd_t count;
+        for (int i=0; i<conf.iterations; ++i)
+        {
+            eventfd_read(uio, &count);
+            histogram.record(nanoTime() - sentTime.load(memory_order_acquire));
+            eventfd_write(ack, 1);
+        }
+    });
+
+    // Raise one mock interrupt at a time, and wait for the waiter to handle it
+    for (int i=0; i<conf.iterations; ++i)
+    {
+        eventfd_t count;
+        sentTime.store(nanoTime(), memory_order_release);
+        eventfd_write(uio, 1);
+        eventfd_read(ack, &count);
+    }
+
+    waiter.join();
+    close(uio);
+    close(ack);
+
+    printLatency("uio wakeup (eventfd loopback)", histogram);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// benchDelivery() - Measures mock interrupt to consumer latency through distribute()
+//
+// This is the loopback version of "-selftest": the monitor thread wakes up on a mock UIO device,
+// distributes the interrupt to a FIFO, and a consumer blocked in poll() on that FIFO wakes up
+//=================================================================================================
+void benchDelivery()
+{
+    CDistributor         distributor;
+    LatencyHistogram     histogram;
+    int                  reader;
+    char                 byte;
+    int                  uio = eventfd(0, EFD_CLOEXEC);
+
+    if (uio < 0) throw runtime_error("Can't create an eventfd");
+
+    string dir = scratchDir();
+    if (!distributor.init(dir, 1)) throw runtime_error("Can't initialize the distributor in " + dir);
+    openReaders(dir, 1, &reader);
+
+    // This plays the part of the driver's monitor thread
+    thread monitor([&]()
+    {
+        eventfd_t count;
+        for (int i=0; i<conf.iterations; ++i)
+        {
+            eventfd_read(uio, &count);
+            distributor.distribute(1, (uint32_t)count);
+        }
+    });
+
+    // Raise one mock interrupt at a time, and wait on the FIFO like a consumer does
+    for (int i=0; i<conf.iterations; ++i)
+    {
+        pollfd pfd = {reader, POLLIN, 0};
+        uint64_t sentTime = nanoTime();
+        eventfd_write(uio, 1);
+        poll(&pfd, 1, -1);
+        histogram.record(nanoTime() - sentTime);
+        while (read(reader, &byte, 1) > 0);
+    }
+
+    monitor.join();
+    close(uio);
+    close(reader);
+    distributor.cleanup();
+    rmdir(dir.c_str());
+
+    printLatency("uio -> distribute -> fifo consumer", histogram);
+}
+//=================================================================================================
@@ -5,10 +5,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
 #include <thread>
 #include "distributor.h"
+#include "Histogram.h"
 
 // We want the entire std:: namespace
 using namespace std;
@@ -36,8 +43,9 @@ static int createPipe(const char* path, int n)
         return -1;
     }
 
-    // Open the FIFO
-    int fd = open(name, O_RDWR);
+    // Open the FIFO.  Writes to a full FIFO fail rather than block, so a consumer that isn't
+    // keeping up can't stall interrupt distribution
+    int fd = open(name, O_RDWR | O_NONBLOCK);
     if (fd < 0)
     {
         fprintf(stderr, "Failed to open fifo %s\n", name);
@@ -51,7 +59,7 @@ static int createPipe(const char* path, int n)
 
 
 //==========================================================================================================
-// openPipe() - Opens a FIFO for reading
+// openPipe() - Opens a FIFO for non-blocking reads
 //==========================================================================================================
 static int openPipe(const char* path, int n)
 {
@@ -61,7 +69,7 @@ static int openPipe(const char* path, int n)
     sprintf(name, "%s%i", path, n);
 
     // Open the FIFO
-    int fd = open(name, O_RDONLY);
+    int fd = open(name, O_RDONLY | O_NONBLOCK);
     if (fd < 0)
     {
         fprintf(stderr, "Failed to open fifo %s\n", name);
@@ -80,11 +88,22 @@ static int openPipe(const char* path, int n)
 //==========================================================================================================
 CDistributor::CDistributor()
 {
-    // Initialize all the file descriptors to "not open"
-    for (int i=0; i<MAX_IRQS; ++i) fd_[i] = -1;
+    // Initialize all the file descriptors to "not open" and zero the counters
+    for (int i=0; i<MAX_IRQS; ++i)
+    {
+        fd_[i]        = -1;
+        notified_[i]  = 0;
+        dropped_[i]   = 0;
+        coalesced_[i] = 0;
+    }
 
     // And there are no file descriptors open
-    irqCount_ = 0;
+    irqCount_   = 0;
+    listenFD_   = -1;
+    mode_       = FIFO_MODE;
+    useRing_    = false;
+    shardCount_ = 0;
+    stopping_   = false;
 }
 //==========================================================================================================
 
@@ -92,35 +111,53 @@ CDistributor::CDistributor()
 //==========================================================================================================
 // init() - Initialize the distribution system (create the FIFOs, etc)
 //
+// Passed: dir      = The directory where the FIFOs (or the eventfd socket) will reside
+//         irqCount = The number of interrupt sources to manage
+//         mode     = FIFO_MODE or EVENTFD_MODE
+//         useRing  = true to also publish every interrupt to a shared-memory event ring
+//
 // On Exit: path_      = The full pathname of the FIFOs (except for the number on the end)
 //          irqCount_  = The number of interrupt sources to manage
-//          fd_[]      = Array of file descriptors for the write-end of our FIFOs
-//          highestFD_ = The largest value in the fd_[] array
+//          fd_[]      = Array of file descriptors for the write-end of our FIFOs, or our eventfds
 //
-// On exit, all FIFOs have been created and opened.             
+// On exit, all FIFOs (or eventfds) have been created and opened.             
 //==========================================================================================================
-bool CDistributor::init(string dir, int irqCount)
+bool CDistributor::init(string dir, int irqCount, notify_t mode, bool useRing)
 {
     // Construct the portion of the FIFO names that isn't a number
     path_ = dir + "/interrupt";
 
-    // Save the IRQ count for posterity
+    // Save the IRQ count and notification mode for posterity
     irqCount_ = irqCount;
-
-    // We don't yet know what our highest file-descriptor is
-    highestFD_ = -1;
+    mode_     = mode;
+    useRing_  = useRing;
 
     // Loop through each interrupt source we need to support...
     for (int i=0; i<irqCount; ++i)
     {
-        // Create and open the FIFO for this interrupt source
-        fd_[i] = createPipe(path_.c_str(), i);
+        // Create and open the FIFO or the eventfd for this interrupt source.   An eventfd is
+        // a counter, so interrupts that arrive before the consumer reads it are never lost
+        if (mode_ == EVENTFD_MODE)
+            fd_[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        else
+            fd_[i] = createPipe(path_.c_str(), i);
 
         // If we couldn't create/open this FIFO, tell the caller
         if (fd_[i] == -1) return false;
+    }
 
-        // Keep track of what our highest file descriptor is
-        if (fd_[i] > highestFD_) highestFD_ = fd_[i];
+    // If we're supposed to publish into an event ring, create it
+    if (useRing_ && !ring_.create(irqCount))
+    {
+        fprintf(stderr, "Failed to create the shared-memory event ring\n");
+        return false;
+    }
+
+    // Consumers fetch the eventfds and the ring from a Unix socket
+    if (mode_ == EVENTFD_MODE || useRing_)
+    {
+        socketName_ = dir + "/" + IRQ_SOCKET_NAME;
+        if (!createSocket()) return false;
     }
 
     // If we get here, tell the caller that all is well
@@ -129,44 +166,243 @@ bool CDistributor::init(string dir, int irqCount)
 //==========================================================================================================
 
 
+//==========================================================================================================
+// createSocket() - Creates the Unix socket that consumers connect to in order to fetch our eventfds
+//                  and event ring, and spawns the thread that serves it
+//==========================================================================================================
+bool CDistributor::createSocket()
+{
+    sockaddr_un addr;
+
+    // Make sure the socket name will fit in a socket address
+    if (socketName_.size() >= sizeof addr.sun_path)
+    {
+        fprintf(stderr, "Socket name %s is too long\n", socketName_.c_str());
+        return false;
+    }
+
+    // Build the address of the socket
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketName_.c_str());
+
+    // If a socket with this name is left over from an earlier run, get rid of it
+    remove(socketName_.c_str());
 
+    // Create the socket, bind it to its name, and start listening for connections
+    listenFD_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFD_ < 0 || bind(listenFD_, (sockaddr*)&addr, sizeof addr) != 0 || listen(listenFD_, 8) != 0)
+    {
+        fprintf(stderr, "Failed to create socket %s\n", socketName_.c_str());
+        return false;
+    }
+
+    // Anyone who can see the directory can fetch the eventfds, just like they can open the FIFOs
+    chmod(socketName_.c_str(), 0666);
+
+    // Serve the socket in its own thread, and let it keep running
+    thread thread(&CDistributor::serveSocket, this);
+    thread.detach();
+
+    // Tell the caller that all is well
+    return true;
+}
 //==========================================================================================================
-// distribute() - Writes one byte to the FIFO of each active interrupt source
+
+
 //==========================================================================================================
-void CDistributor::distribute(int irqSources)
+// serveSocket() - Each time a consumer connects to our socket, send it an irqSocketMsg_t with our
+//                 eventfds and/or the memfd of our event ring attached (via SCM_RIGHTS)
+//==========================================================================================================
+void CDistributor::serveSocket()
 {
-    fd_set wfds;
-    int    i;
+    char           control[CMSG_SPACE(sizeof(int) * (MAX_IRQS + 1))];
+    int            fd[MAX_IRQS + 1];
+    int            fdCount = 0;
+    irqSocketMsg_t message = {(uint32_t)irqCount_, 0};
 
-    // We want our select() statement to return immediately
-    static timeval timeout = {0,0};
+    // Build the list of file descriptors we hand out: the eventfds first, then the ring
+    if (mode_ == EVENTFD_MODE)
+    {
+        message.flags |= IRQ_MSG_EVENTFDS;
+        for (int i=0; i<irqCount_; ++i) fd[fdCount++] = fd_[i];
+    }
 
-    // Clear our file descriptor set
-    FD_ZERO(&wfds);
+    if (useRing_)
+    {
+        message.flags |= IRQ_MSG_RING;
+        fd[fdCount++] = ring_.fd();
+    }
+
+    while (true)
+    {
+        // Wait for a consumer to connect
+        int conn = accept(listenFD_, nullptr, nullptr);
+
+        // If our socket has been closed, we're done
+        if (conn < 0) break;
+
+        // The payload of the message says what's attached
+        iovec  iov = {&message, sizeof message};
+        msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fdCount);
+
+        // The file descriptors ride along as ancillary data
+        cmsghdr* cmsg    = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_RIGHTS;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * fdCount);
+        memcpy(CMSG_DATA(cmsg), fd, sizeof(int) * fdCount);
+
+        // Send the message, and we're done with this consumer
+        bitBucket = sendmsg(conn, &msg, MSG_NOSIGNAL);
+        close(conn);
+    }
+}
+//==========================================================================================================
 
-    // wfds is an fd_set of each file descriptor we're interested in
-    for (i=0; i<irqCount_; ++i) FD_SET(fd_[i], &wfds);
 
-    // Find out which file descriptors can be written to without blocking
-    select(highestFD_+1, NULL, &wfds, NULL, &timeout);
 
-    // Loop through each possible interrupt source...
-    for (i=0; i<irqCount_; ++i)
+//==========================================================================================================
+// distribute() - Notifies the consumers of each active interrupt source
+//
+// The FIFOs and eventfds are both non-blocking, so this costs exactly one write() per active source.
+// Publishing to the event ring doesn't cost a system call at all.  If there are handler threads, the 
+// writes happen there instead, and this just hands each thread the bits it owns.  A source that fires
+// again before its thread gets around to it is only notified once (the ring still counts both)
+//==========================================================================================================
+void CDistributor::distribute(int irqSources, uint32_t uioCount, uint64_t timestamp)
+{
+    // Publish the event to the shared memory ring first, since it's the cheapest notification
+    if (useRing_) ring_.publish(irqSources, uioCount, timestamp);
+
+    // Only look at the sources we're managing
+    uint32_t sources = irqSources;
+    if (irqCount_ < 32) sources &= (1u << irqCount_) - 1;
+
+    // If there are no handler threads, notify the consumers ourselves
+    if (shardCount_ == 0)
     {
-        // Fetch the file descriptor for this interrupt source...
-        int fd = fd_[i];
-        
-        // If we need to distribute this interrupt and the FIFO can be 
-        // writen to without blocking, write a byte to the FIFO
-        if (irqSources & 1 << i)
+        notify(sources);
+        return;
+    }
+
+    // Otherwise, hand each handler thread the sources it owns
+    for (int i=0; i<shardCount_; ++i)
+    {
+        shard_t& shard = shard_[i];
+        uint32_t bits  = sources & shard.mask;
+        if (bits == 0) continue;
+        uint32_t merged;
         {
-            if (FD_ISSET(fd, &wfds)) bitBucket = write(fd, "X", 1);
+            lock_guard<mutex> lock(shard.mutex);
+            merged         = shard.pending & bits;
+            shard.pending |= bits;
         }
+        shard.wakeup.notify_one();
+
+        // Keep track of the sources that were already waiting for this thread
+        for (; merged; merged &= merged - 1) ++coalesced_[__builtin_ctz(merged)];
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// notify() - Writes a notification to the FIFO or eventfd of each source in the bitmap
+//==========================================================================================================
+void CDistributor::notify(uint32_t sources)
+{
+    static const uint64_t one = 1;
+
+    // Loop through each active interrupt source...
+    while (sources)
+    {
+        // Find the lowest numbered active source, and remove it from the bitmap
+        int i = __builtin_ctz(sources);
+        sources &= sources - 1;
+
+        // Bump the eventfd, or write a byte to the FIFO.  If the FIFO is full, the consumer
+        // already has a notification waiting for it, but we count this one as dropped
+        ssize_t written;
+        if (mode_ == EVENTFD_MODE)
+            written = write(fd_[i], &one, sizeof one);
+        else
+            written = write(fd_[i], "X", 1);
+
+        // Keep track of whether the notification made it
+        if (written > 0)
+            ++notified_[i];
+        else
+            ++dropped_[i];
     }    
 }
 //==========================================================================================================
 
 
+//==========================================================================================================
+// spawnShards() - Spawns "count" notification handler threads, and divides the interrupt sources
+//                 between them
+//==========================================================================================================
+void CDistributor::spawnShards(int count)
+{
+    // We never need more handler threads than there are interrupt sources
+    if (count > irqCount_) count = irqCount_;
+    if (count < 2) return;
+
+    // Source N belongs to handler thread (N % count)
+    for (int i=0; i<count; ++i)
+    {
+        shard_[i].mask    = 0;
+        shard_[i].pending = 0;
+    }
+    for (int irq=0; irq<irqCount_; ++irq) shard_[irq % count].mask |= (1u << irq);
+
+    // Spawn the handler threads, and let them keep running
+    for (int i=0; i<count; ++i)
+    {
+        thread thread(&CDistributor::shardThread, this, i);
+        thread.detach();
+    }
+
+    // From now on, "distribute()" hands notifications to the handler threads
+    shardCount_ = count;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// shardThread() - Sits in a loop, waiting for "distribute()" to hand us active sources and
+//                 notifying their consumers
+//==========================================================================================================
+void CDistributor::shardThread(int index)
+{
+    shard_t& shard = shard_[index];
+
+    while (true)
+    {
+        uint32_t sources;
+
+        // Wait for there to be something to do, and claim it
+        {
+            unique_lock<mutex> lock(shard.mutex);
+            shard.wakeup.wait(lock, [&]{return shard.pending || stopping_;});
+            if (stopping_) break;
+            sources       = shard.pending;
+            shard.pending = 0;
+        }
+
+        // And notify the consumers of those sources
+        notify(sources);
+    }
+}
+//==========================================================================================================
+
+
 //==========================================================================================================
 // cleanup() - Closes all of the file descriptors and deletes all of the FIFOs
 //==========================================================================================================
@@ -175,6 +411,17 @@ void CDistributor::cleanup()
     int i;
     char filename[256];
 
+    // Tell the handler threads to stop
+    for (i=0; i<shardCount_; ++i)
+    {
+        {
+            lock_guard<mutex> lock(shard_[i].mutex);
+            stopping_ = true;
+        }
+        shard_[i].wakeup.notify_one();
+    }
+    shardCount_ = 0;
+
     // Close all of the file descriptors
     for (i=0; i<irqCount_; ++i) 
     {
@@ -183,6 +430,14 @@ void CDistributor::cleanup()
         fd = -1;
     }
 
+    // Close and remove the eventfd socket
+    if (listenFD_ != -1) close(listenFD_);
+    listenFD_ = -1;
+    if (!socketName_.empty()) remove(socketName_.c_str());
+
+    // Release the event ring
+    ring_.destroy();
+
     // If there's no FIFO path specified, we're done
     if (path_.empty()) return;
 
@@ -200,16 +455,39 @@ void CDistributor::cleanup()
 
 
 
+//==========================================================================================================
+// nanoseconds() - Returns the current time in nanoseconds
+//==========================================================================================================
+static uint64_t nanoseconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// printLatency() - Displays a one-line summary of a latency histogram (recorded in nanoseconds)
+//==========================================================================================================
+static void printLatency(const char* label, const LatencyHistogram& h)
+{
+    printf("%-24s min %6lu  p50 %6lu  p99 %6lu  p99.9 %6lu  max %7lu ns  (%lu samples)\n", label,
+           h.min(), h.percentile(50), h.percentile(99), h.percentile(99.9), h.max(), h.count());
+}
+//==========================================================================================================
+
+
 //==========================================================================================================
 // launchTest() - Launches "selfTest" in its own thread
 //==========================================================================================================
-void CDistributor::spawnSelfTest(volatile uint32_t* imReg0)
+void CDistributor::spawnSelfTest(RegisterBlock intManager, int iterations)
 {
     // If we haven't been initialized, don't do anything
     if (irqCount_ == 0) return;
 
     // Spawn "selfTest()" in it's own thread
-    thread thread(&CDistributor::selfTest, this, imReg0);
+    thread thread(&CDistributor::selfTest, this, intManager, iterations);
 
     // Let it keep running, even when "thread" goes out of scope
     thread.detach();
@@ -218,54 +496,159 @@ void CDistributor::spawnSelfTest(volatile uint32_t* imReg0)
 
 
 //==========================================================================================================
-// selfTest() - This threads sits in a loop, sending "generate an interrupt" commands (via the AXI/PCIe 
-//              bridge), then doing a blocking read on the appropriate FIFO to confirm that the interrupt
-//              actually occured
+// selfTest() - Benchmarks interrupt delivery by sending "generate an interrupt" commands (via the
+//              AXI/PCIe bridge), then waiting on the appropriate FIFO to confirm that the interrupt 
+//              actually occured.  When the benchmark is done, it prints a summary and exits
+//
+// The IRQn_IN strobes on the interrupt manager are tied off in the block design, so the only way
+// software can raise an interrupt is with an AXI write.  To separate the cost of that write from
+// the cost of delivering the interrupt, we measure the AXI write on its own first
 //==========================================================================================================
-void CDistributor::selfTest(volatile uint32_t* imReg0)
+void CDistributor::selfTest(RegisterBlock intManager, int iterations)
 {
     int fd[MAX_IRQS];
-    char c[1];
-
-    // A counter of how many tests we've done
-    uint32_t counter = 0;
 
     // Get a const char* to the FIFO root name
     const char* path = path_.c_str();
 
-    // Open each FIFO
+    // Open each FIFO, or use our own eventfds
     for (int i=0; i<irqCount_; ++i)
     {
-        fd[i] = openPipe(path, i);
+        fd[i] = (mode_ == EVENTFD_MODE) ? fd_[i] : openPipe(path, i);
     }
 
-    // This is the interrupt source we're going to test
-    int irq = 0;
+    // Give the monitor loop a moment to start waiting for interrupts
+    usleep(100000);
 
-    // We're going to generate interrupts and sense them until the process is killed
-    while (true)
+    printf("Benchmarking %d interrupt source%s\n", irqCount_, irqCount_ == 1 ? "" : "s");
+
+    // How long does it take to get a write to the interrupt manager?
+    measureAxiCost(intManager, iterations);
+
+    // How long does it take from writing the interrupt manager to waking a consumer?
+    measureLatency(intManager, iterations, fd);
+
+    // How many interrupts per second can we sustain with 1, 2, 4 ... sources outstanding?
+    for (int outstanding = 1; outstanding < irqCount_; outstanding *= 2)
     {
-        // Display a constantly changing message
-        printf("Generating interrupt #%d on irq %d\n", ++counter, irq);
+        measureThroughput(intManager, outstanding, fd);
+    }
+    measureThroughput(intManager, irqCount_, fd);
+
+    // The benchmark is done
+    exit(0);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// measureAxiCost() - Measures the cost of an MMIO read of the interrupt manager, and of a write that
+//                    is flushed by reading it back.  Writing 0 to IM_REG0 raises no interrupts
+//==========================================================================================================
+void CDistributor::measureAxiCost(RegisterBlock& intManager, int iterations)
+{
+    LatencyHistogram readCost, writeCost;
+
+    for (int i=0; i<iterations; ++i)
+    {
+        uint64_t t0 = nanoseconds();
+        intManager.read<IM_REG0>();
+        uint64_t t1 = nanoseconds();
+        intManager.write<IM_REG0>(0);
+        intManager.read<IM_REG0>();
+        uint64_t t2 = nanoseconds();
+
+        readCost.record(t1 - t0);
+        writeCost.record(t2 - t1);
+    }
+
+    printLatency("AXI read", readCost);
+    printLatency("AXI write + read back", writeCost);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// measureLatency() - Raises one interrupt at a time, cycling through the sources, and records how
+//                    long each takes to get from the AXI write to a consumer waking up
+//==========================================================================================================
+void CDistributor::measureLatency(RegisterBlock& intManager, int iterations, int* fd)
+{
+    LatencyHistogram latency[MAX_IRQS], overall;
+    char             buffer[64];
+
+    for (int i=0; i<iterations; ++i)
+    {
+        int irq = i % irqCount_;
 
         // Generate the interrupt
-        *imReg0 = (1 << irq);
+        uint64_t t0 = nanoseconds();
+        intManager.write<IM_REG0>(1 << irq);
 
         // Wait for the interrupt notification
-        int bytesRead = read(fd[irq], c, 1);
+        pollfd pfd = {fd[irq], POLLIN, 0};
+        poll(&pfd, 1, -1);
+        uint64_t t1 = nanoseconds();
 
         // If the other side of the pipe was closed, it means the test is done
-        if (bytesRead == 0) break;
+        if (read(fd[irq], buffer, sizeof buffer) <= 0) return;
+
+        latency[irq].record(t1 - t0);
+        overall.record(t1 - t0);
+    }
+
+    // Show the latency for each source, and for all of them together
+    for (int irq=0; irq<irqCount_; ++irq)
+    {
+        sprintf(buffer, "irq %d latency", irq);
+        printLatency(buffer, latency[irq]);
+    }
+    if (irqCount_ > 1) printLatency("overall latency", overall);
+}
+//==========================================================================================================
 
-        // We should <always> read exactly 1 byte
-        if (bytesRead != 1)
+
+//==========================================================================================================
+// measureThroughput() - Keeps "outstanding" sources raised for one second: each time a consumer is
+//                       notified, its source is raised again.  Reports notifications per second
+//==========================================================================================================
+void CDistributor::measureThroughput(RegisterBlock& intManager, int outstanding, int* fd)
+{
+    pollfd   pfd[MAX_IRQS];
+    uint64_t buffer[8];
+    uint64_t notifications = 0;
+
+    // Raise every source we're testing
+    uint32_t mask = (outstanding < 32) ? (1u << outstanding) - 1 : 0xFFFFFFFF;
+    for (int i=0; i<outstanding; ++i) pfd[i] = {fd[i], POLLIN, 0};
+    intManager.write<IM_REG0>(mask);
+
+    uint64_t startTime = nanoseconds();
+    uint64_t endTime   = startTime + 1000000000ULL;
+    while (nanoseconds() < endTime)
+    {
+        // Wait for notifications to arrive
+        if (poll(pfd, outstanding, 100) <= 0) continue;
+
+        // Drain each one that did, and raise its source again
+        uint32_t again = 0;
+        for (int i=0; i<outstanding; ++i)
         {
-            printf("bytesRead was %d!\n", bytesRead);
-            exit(1);            
+            if (!(pfd[i].revents & POLLIN)) continue;
+            int bytesRead = read(fd[i], buffer, sizeof buffer);
+            if (bytesRead <= 0) continue;
+            notifications += (mode_ == EVENTFD_MODE) ? buffer[0] : bytesRead;
+            again |= (1 << i);
         }
-
-        // The next test is for the next interrupt source
-        if (++irq == irqCount_) irq = 0;
+        if (again) intManager.write<IM_REG0>(again);
     }
+
+    // Let the last round of interrupts drain
+    usleep(10000);
+    for (int i=0; i<outstanding; ++i) bitBucket = read(fd[i], buffer, sizeof buffer);
+
+    double seconds = (nanoseconds() - startTime) / 1e9;
+    printf("%2d source%s outstanding: %10.0lf notifications/sec\n", outstanding, 
+           outstanding == 1 ? " " : "s", notifications / seconds);
 }
 //==========================================================================================================
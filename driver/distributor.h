@@ -3,11 +3,27 @@
 // distributor.h - Defines a mechanism for distributing interrupt notifications
 //==========================================================================================================
 #include <string>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "RegisterBlock.h"
+#include "IrqSocket.h"
+#include "IrqRing.h"
+
+// Register map for the "pcie_int_manager" RTL core
+enum {IM_REG0 = 0, IM_REG1 = 1};
 
 class CDistributor
 {
 public:
 
+    // These are the ways we can notify consumers of an interrupt
+    enum notify_t
+    {
+        FIFO_MODE,      // Write one byte to the named FIFO "interrupt<N>"
+        EVENTFD_MODE    // Increment eventfd <N>, which consumers fetch from IRQ_SOCKET_NAME
+    };
+
     // Default constructor
     CDistributor();
     
@@ -15,31 +31,92 @@ public:
     ~CDistributor() {cleanup();}
 
     // Call this to perform all initialization and create the FIFOs
-    bool    init(std::string dir, int irqCount);
+    bool    init(std::string dir, int irqCount, notify_t mode = FIFO_MODE, bool useRing = false);
+
+    // Call this to read an irqSources bitmap and write to the appropriate FIFOs.  "uioCount" and
+    // "timestamp" are recorded in the shared-memory event ring, if there is one
+    void    distribute(int irqSources, uint32_t uioCount = 0, uint64_t timestamp = 0);
 
-    // Call this to read an irqSources bitmap and write to the appropriate FIFOs
-    void    distribute(int irqSources);
+    // Hands notification off to "count" handler threads.  Thread N owns the interrupt sources whose
+    // number modulo "count" is N, so one slow consumer can't delay notifying the others
+    void    spawnShards(int count);
 
-    // Launches a thread that generates interrupts and reads the appropriate
-    // FIFO to ensure that the interrupt made it's way up to our software
-    void    spawnSelfTest(volatile uint32_t* imReg0);
+    // Launches a thread that benchmarks interrupt delivery: it generates interrupts and reads the
+    // appropriate FIFO to ensure that each interrupt made it's way up to our software, then 
+    // prints a latency and throughput summary and exits the program
+    void    spawnSelfTest(RegisterBlock intManager, int iterations = 10000);
 
     // Closes all of the file descriptors and deletes all of the FIFOs
     void    cleanup();
 
+    // The number of interrupt sources we manage
+    int     irqCount() const {return irqCount_;}
+
+    // Per-source counters: notifications delivered to consumers, notifications dropped because a
+    // FIFO was full, and notifications merged into one still waiting for its handler thread
+    uint64_t notified(int irq)  const {return notified_[irq];}
+    uint64_t dropped(int irq)   const {return dropped_[irq];}
+    uint64_t coalesced(int irq) const {return coalesced_[irq];}
+
 protected:
 
     // When "spawnSelfTest()" gets called, this is the routine that gets spawned
-    void    selfTest(volatile uint32_t* imReg0);
+    void    selfTest(RegisterBlock intManager, int iterations);
+
+    // The phases of the self-test benchmark
+    void    measureAxiCost(RegisterBlock& intManager, int iterations);
+    void    measureLatency(RegisterBlock& intManager, int iterations, int* fd);
+    void    measureThroughput(RegisterBlock& intManager, int outstanding, int* fd);
+
+    // Writes a notification to the FIFO or eventfd of each active source
+    void    notify(uint32_t sources);
+
+    // Each handler thread spawned by "spawnShards()" runs this
+    void    shardThread(int shard);
+
+    // Creates the socket that hands our eventfds to consumers
+    bool    createSocket();
+
+    // Sits in a loop, sending our eventfds to every consumer that connects to our socket
+    void    serveSocket();
 
     // Maximum number of interrupt request sources we can support
-    enum {MAX_IRQS = 32};
+    enum {MAX_IRQS = IRQ_SOCKET_MAX_IRQS};
 
     // One potential file descriptor for each interrupt source we support
     int fd_[MAX_IRQS];
 
-    // This is the largest file descriptor;
-    int highestFD_;
+    // The per-source notification counters
+    std::atomic<uint64_t> notified_[MAX_IRQS], dropped_[MAX_IRQS], coalesced_[MAX_IRQS];
+
+    // This is how we notify consumers of an interrupt
+    notify_t mode_;
+
+    // If this is true, every interrupt is also published to the shared-memory event ring
+    bool useRing_;
+
+    // This is the shared-memory event ring
+    IrqRingWriter ring_;
+
+    // In EVENTFD_MODE (or when there's a ring) this is the listening socket that consumers connect to
+    int listenFD_;
+
+    // This is the filename of that socket
+    std::string socketName_;
+
+    // The state of one notification handler thread
+    struct shard_t
+    {
+        std::mutex              mutex;
+        std::condition_variable wakeup;
+        uint32_t                mask;       // The interrupt sources this thread owns
+        uint32_t                pending;    // The sources waiting to be notified
+    };
+
+    // The handler threads, if we have any
+    shard_t shard_[MAX_IRQS];
+    int     shardCount_;
+    bool    stopping_;
 
     // This is the numbef of interrupt sources that are in use
     int irqCount_;
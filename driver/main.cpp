@@ -8,37 +8,88 @@
 #include <stdint.h>
 #include <signal.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
 #include <filesystem>
+#include <thread>
+#include <atomic>
 #include "distributor.h"
+#include "vfio.h"
 #include "PciDevice.h"
+#include "RegisterBlock.h"
 
 using namespace std;
 
 static volatile int bitBucket;
 
 void monitorInterrupts(int uioDevice);
-bool initializePCI();
+void monitorVfioInterrupts(const vfioIrqs_t& vfio);
+void handleSources(uint32_t intSources, uint32_t interruptCount, uint64_t timestamp);
+void pollSources(uint32_t interruptCount);
+void drainSources(uint32_t interruptCount);
+void reportStats();
+void writeStats();
+void spawnStatsWriter();
+void setupRealtime(const pciFunction_t& card);
+void dumpTrace();
+
+// These are defined in realtime.cpp
+bool pinThread(int cpu);
+bool pinToDeviceNode(const pciFunction_t& card);
+bool setRealtime(int priority);
+bool lockMemory();
+int  setIrqAffinity(const pciFunction_t& card, int cpu);
+bool findCard(pciFunction_t* card);
+bool initializePCI(const pciFunction_t& card);
 void parseCommandLine(const char** argv);
 void signalHandler(int sigNumber);
-int  initializeUIO(string device);
+int  initializeUIO(const pciFunction_t& card);
 
 // Configuration parameters from the command line
 struct conf_t
 {
     string   device;
+    string   bdf;
+    int      card;
     string   dirName;
     int      irqCount;
     uint32_t axiAddr;
     bool     selfTest;
+    int      selfTestCount;
     bool     verbose;
+    bool     eventfd;
+    bool     ring;
+    bool     vfio;
+    int      budgetUS;
+    int      cpu;
+    int      rtPriority;
+    bool     mlock;
+    bool     irqAffinity;
+    int      shards;
+    int      statsSeconds;
+    string   traceFile;
 } conf;
 
+// Counters that show how well interrupt batching is working, and whether interrupts are being
+// coalesced or lost on their way from the hardware to our consumers
+struct stats_t
+{
+    atomic<uint64_t> kernelInterrupts;  // Interrupts the kernel (UIO or VFIO) reported to us
+    atomic<uint64_t> interrupts;        // Interrupts we were woken up for
+    atomic<uint64_t> spurious;          // Interrupts where no source was active
+    atomic<uint64_t> events;            // Times we found active sources, whether via interrupt or polling
+    atomic<uint64_t> polled;            // Events we found while polling, without taking an interrupt
+    atomic<uint64_t> notifications;     // Individual source notifications we distributed
+    uint32_t         irqAckBase;        // The interrupt manager's IRQ_ACK count when we started
+    bool             intx;              // True if the card interrupts us with INTx rather than MSI
+} stats;
+
 
 CDistributor Distributor;
 PciDevice    PCI;
 
-volatile uint32_t *imReg0;
-volatile uint32_t *imReg1;
+// These are the control/status registers of the interrupt manager
+RegisterBlock intManager;
 
 
 //=================================================================================================
@@ -52,12 +103,27 @@ int main(int argc, const char** argv)
     conf.irqCount = 1;
     conf.dirName = ".";
     conf.device  = "10ee:903f";
+    conf.card    = 0;
     conf.axiAddr = 0x4000;
     conf.verbose = false;
+    conf.selfTestCount = 10000;
+    conf.eventfd = false;
+    conf.ring    = false;
+    conf.vfio    = false;
+    conf.budgetUS    = 0;
+    conf.cpu         = -1;
+    conf.rtPriority  = 0;
+    conf.mlock       = false;
+    conf.irqAffinity = false;
+    conf.shards      = 0;
+    conf.statsSeconds = 0;
 
     // Tell Linux which signals we'd like to handle
     signal(SIGINT, signalHandler);
 
+    // When we exit, report how many interrupts we took and how many events we handled
+    atexit(reportStats);
+
     // Parse configuration parameters from the command line
     parseCommandLine(argv);
 
@@ -68,20 +134,71 @@ int main(int argc, const char** argv)
         exit(1);        
     }
 
-    // Initialize the Linux UIO subsystem
-    int uioIndex = initializeUIO(conf.device);
+    // If the user wants a record of our register traffic, start recording.  It's written out
+    // when we exit
+    if (!conf.traceFile.empty())
+    {
+        if (!MmioTrace::compiledIn())
+            fprintf(stderr, "MMIO tracing isn't compiled in.  Rebuild with \"make TRACE=1\"\n");
+        else
+        {
+            MmioTrace::enable();
+            atexit(dumpTrace);
+        }
+    }
+
+    // Find the card we're going to drive, and if we can't, bail out
+    pciFunction_t card;
+    if (!findCard(&card)) exit(1);
+
+    // Initialize either VFIO or the Linux UIO subsystem
+    vfioIrqs_t vfio;
+    int uioIndex = -1;
+    if (conf.vfio)
+    {
+        if (!initializeVFIO(card, conf.irqCount, &vfio)) exit(1);
+    }
+    else
+        uioIndex = initializeUIO(card);
 
     // Initalize PCI, and if it fails, bail out
-    if (!initializePCI()) exit(1);
+    if (!initializePCI(card)) exit(1);
+
+    // Remember where the hardware's count of IRQ acknowledgements started, and whether those
+    // acknowledgements can be turned into a count of interrupts
+    stats.irqAckBase = intManager.read<IM_REG1>();
+    stats.intx       = !conf.vfio || !vfioEdgeTriggered(vfio);
+
+    // Keep every thread we spawn on the card's NUMA node, so that the threads that handle its
+    // interrupts are near it.  "-cpu" narrows the monitor thread further
+    pinToDeviceNode(card);
+
+    // Switch to real-time scheduling and lock our memory before we spawn any threads
+    if (conf.rtPriority && !setRealtime(conf.rtPriority)) exit(1);
+    if (conf.mlock && !lockMemory()) exit(1);
 
     // Initialize the interrupt distributor and if it fails, bail out
-    if (!Distributor.init(conf.dirName, conf.irqCount)) exit(1);
+    auto mode = conf.eventfd ? CDistributor::EVENTFD_MODE : CDistributor::FIFO_MODE;
+    if (!Distributor.init(conf.dirName, conf.irqCount, mode, conf.ring)) exit(1);
+
+    // If we're supposed to notify consumers from per-source handler threads, spawn them
+    if (conf.shards) Distributor.spawnShards(conf.shards);
+
+    // If we're supposed to keep a statistics file up to date, start doing so
+    if (conf.statsSeconds) spawnStatsWriter();
 
     // If we're supposed to spawn the self-test thread, make it so
-    if (conf.selfTest) Distributor.spawnSelfTest(imReg0);
+    if (conf.selfTest) Distributor.spawnSelfTest(intManager, conf.selfTestCount);
+
+    // Pin the monitor thread (and optionally the card's interrupts) to a CPU.  This comes after
+    // every other thread has been spawned, so that none of them inherit the monitor's CPU
+    setupRealtime(card);
 
     // Monitor and distribute interrupts
-    monitorInterrupts(uioIndex);
+    if (conf.vfio)
+        monitorVfioInterrupts(vfio);
+    else
+        monitorInterrupts(uioIndex);
 }
 //=================================================================================================
 
@@ -96,6 +213,7 @@ void monitorInterrupts(int uioDevice)
     int      configfd;
     int      err;
     uint32_t interruptCount;
+    uint32_t priorCount = 0;
     uint8_t  commandHigh;
     char     filename[64];
 
@@ -154,48 +272,392 @@ void monitorInterrupts(int uioDevice)
             exit(1);
         }
 
+        // This is when we found out about the interrupt
+        uint64_t timestamp = irqRingTimestamp();
+
+        // UIO counts every interrupt, so it tells us if several arrived since we last looked
+        stats.kernelInterrupts += stats.interrupts ? interruptCount - priorCount : 1;
+        priorCount = interruptCount;
+        ++stats.interrupts;
+
         // Fetch the bitmap of active interrupt sources
-        uint32_t intSources = *imReg0;
+        uint32_t intSources = intManager.read<IM_REG0>();
 
         // If there are no interrupt sources, ignore this interrupt
+        if (intSources == 0)
+        {
+            ++stats.spurious;
+            continue;
+        }
+
+        // Clear and distribute the interrupts from those sources
+        handleSources(intSources, interruptCount, timestamp);
+
+        // Interrupts stay masked while we poll for more events
+        pollSources(interruptCount);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// monitorVfioInterrupts() - Sits in a loop waiting for VFIO to signal the eventfds of our
+//                           interrupt vectors and distributing notifications for each source
+//
+// When every source has a vector of its own, the vectors that fired tell us which sources are
+// active and we never have to read the interrupt manager's status register.  We still clear
+// the sources in the interrupt manager (it latches them until told otherwise), but that's a
+// posted write that doesn't stall us waiting for the device
+//=================================================================================================
+void monitorVfioInterrupts(const vfioIrqs_t& vfio)
+{
+    epoll_event event[32];
+    uint64_t    count;
+    uint32_t    interruptCount = 0;
+
+    // Create an epoll instance that watches the eventfd of every vector
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+    {
+        perror("epoll_create1");
+        exit(1);
+    }
+    for (int i=0; i<vfio.vectorCount; ++i)
+    {
+        epoll_event ev = {EPOLLIN};
+        ev.data.u32 = i;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, vfio.eventFD[i], &ev) < 0)
+        {
+            perror("epoll_ctl");
+            exit(1);
+        }
+    }
+
+    // Give the user an opportunity to see that we've succesfully started
+    printf("Starting VFIO driver with %d %s vector%s%s\n", vfio.vectorCount, vfioIrqName(vfio),
+           vfio.vectorCount == 1 ? "" : "s", vfio.perSource ? ", one per source" : "");
+
+    // Loop forever, monitoring incoming interrupt notifications
+    while (true)
+    {
+        // Wait for one or more vectors to fire
+        int ready = epoll_wait(epfd, event, 32, -1);
+        if (ready < 0)
+        {
+            if (errno == EINTR) continue;
+            perror("epoll_wait:");
+            exit(1);
+        }
+
+        // This is when we found out about the interrupt
+        uint64_t timestamp = irqRingTimestamp();
+
+        // Drain the eventfds that fired, making note of which vectors they belong to
+        uint32_t vectors = 0;
+        for (int i=0; i<ready; ++i)
+        {
+            int vector = event[i].data.u32;
+            if (read(vfio.eventFD[vector], &count, sizeof count) != sizeof count) continue;
+            interruptCount += count;
+            stats.kernelInterrupts += count;
+            vectors |= (1 << vector);
+        }
+
+        // Find out which interrupt sources are active.  With one vector per source, the vectors
+        // tell us.  Otherwise we have to ask the interrupt manager
+        uint32_t intSources = vfio.perSource ? vectors : intManager.read<IM_REG0>();
+        ++stats.interrupts;
+
+        // Clear and distribute the interrupts from those sources, then poll for more events
+        if (intSources)
+        {
+            handleSources(intSources, interruptCount, timestamp);
+            pollSources(interruptCount);
+        }
+        else
+            ++stats.spurious;
+
+        // An MSI is only sent when the interrupt manager's request line rises, and that line stays
+        // high for as long as any source is active.  A source that went active after we read the
+        // status register (or after the polling budget ran out) will never send us another MSI,
+        // so keep going until the interrupt manager says that nothing is active
+        if (vfioEdgeTriggered(vfio)) drainSources(interruptCount);
+
+        // A level-triggered INTx has to be re-armed once the device has stopped asserting it
+        unmaskVFIO(vfio);
+    }
+}
+//=================================================================================================
+
+
+
+
+//=================================================================================================
+// handleSources() - Clears the specified interrupt sources in the interrupt manager and
+//                   distributes a notification for each of them
+//
+// Passed:  intSources     = bitmap of the interrupt sources that are active
+//          interruptCount = the running interrupt count reported by UIO or VFIO
+//          timestamp      = irqRingTimestamp() when we found out about them
+//=================================================================================================
+void handleSources(uint32_t intSources, uint32_t interruptCount, uint64_t timestamp)
+{
+    // If we're in verbose mode, tell the world that an interrupt occured
+    if (conf.verbose) printf("Interrupt from sources 0x%08x\n", intSources);
+
+    // Clear the interrupts from those sources
+    intManager.write<IM_REG1>(intSources);
+
+    // And distribute the interrupt notifications to the FIFOs
+    Distributor.distribute(intSources, interruptCount, timestamp);
+
+    // Keep track of how much work we've done
+    ++stats.events;
+    stats.notifications += __builtin_popcount(intSources);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// pollSources() - After an interrupt, keeps polling the interrupt manager for new events
+//                 instead of re-arming the interrupt.  We give up once "-budget" microseconds
+//                 go by without a new event, and the caller re-arms the interrupt
+//
+// When sources fire at high rates, this handles a burst of events for the price of a single
+// interrupt, in the same way that NAPI does for network drivers
+//=================================================================================================
+void pollSources(uint32_t interruptCount)
+{
+    timespec ts;
+
+    // If there's no polling budget, don't poll
+    if (conf.budgetUS == 0) return;
+
+    // Returns the current time in nanoseconds
+    auto now = [&]() {clock_gettime(CLOCK_MONOTONIC, &ts); return ts.tv_sec * 1000000000ULL + ts.tv_nsec;};
+
+    // This is how long we'll poll for without seeing a new event
+    const uint64_t budgetNS = conf.budgetUS * 1000ULL;
+
+    uint64_t deadline = now() + budgetNS;
+    while (now() < deadline)
+    {
+        // Are any interrupt sources active?
+        uint32_t intSources = intManager.read<IM_REG0>();
         if (intSources == 0) continue;
 
-        // If we're in verbose mode, tell the world that an interrupt occured
-        if (conf.verbose) printf("Interrupt from sources 0x%08x\n", intSources);
+        // Handle them, and since events are still arriving, keep polling
+        handleSources(intSources, interruptCount, irqRingTimestamp());
+        ++stats.polled;
+        deadline = now() + budgetNS;
+    }
+}
+//=================================================================================================
+
 
-        // Clear the interrupts from those sources
-        *imReg1 = intSources;
+//=================================================================================================
+// drainSources() - Handles interrupt sources until the interrupt manager reports that none are
+//                  active.  Unlike pollSources(), this stops as soon as the status register reads
+//                  zero, however "-budget" is set
+//=================================================================================================
+void drainSources(uint32_t interruptCount)
+{
+    uint32_t intSources;
 
-        // And distribute the interrupt notifications to the FIFOs
-        Distributor.distribute(intSources);
+    while ((intSources = intManager.read<IM_REG0>()) != 0)
+    {
+        handleSources(intSources, interruptCount, irqRingTimestamp());
+        ++stats.polled;
     }
 }
 //=================================================================================================
 
 
+//=================================================================================================
+// irqAcks() - Returns the number of IRQ_ACKs the interrupt manager has seen since we started
+//=================================================================================================
+static uint32_t irqAcks()
+{
+    return intManager.read<IM_REG1>() - stats.irqAckBase;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// hardwareInterrupts() - Converts a count of IRQ_ACKs into the number of interrupts raised
+//
+// With INTx, the PCIe bridge acknowledges both the assertion and the de-assertion of an interrupt,
+// so each interrupt is two acknowledgements.  With MSI there's no fixed relationship between the
+// two, so this is only meaningful when stats.intx is true
+//=================================================================================================
+static uint32_t hardwareInterrupts(uint32_t acks)
+{
+    return (acks + 1) / 2;
+}
+//=================================================================================================
 
 
 //=================================================================================================
-// initializePCI() - Map the interrupt manager's status/control registers into userspace
+// reportStats() - Tells the user how many interrupts we took and how many events we handled
+//=================================================================================================
+void reportStats()
+{
+    // If we never got as far as handling interrupts, there's nothing to report
+    if (stats.interrupts == 0) return;
+
+    // Bring the statistics file up to date one last time
+    if (conf.statsSeconds) writeStats();
+
+    // With INTx, we can tell how many interrupts the card raised.  Otherwise, we just know how many
+    // times the PCIe bridge acknowledged a request
+    if (stats.intx)
+        printf("\n%u interrupts raised by the card", hardwareInterrupts(irqAcks()));
+    else
+        printf("\n%u IRQ_ACKs from the PCIe bridge", irqAcks());
+
+    printf(", %lu reported by the kernel, %lu taken (%lu spurious)\n", stats.kernelInterrupts.load(),
+           stats.interrupts.load(), stats.spurious.load());
+    printf("%lu events handled (%lu found by polling), %lu notifications\n", stats.events.load(),
+           stats.polled.load(), stats.notifications.load());
+    printf("%.2lf events per interrupt\n", (double)stats.events / stats.interrupts);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// writeStats() - Writes our counters to "<dir>/interrupts.stats", one "name value" pair per line
+//
+// Comparing the counters shows where interrupts are being coalesced or lost:
+//    hw_interrupts     vs kernel_interrupts : interrupts the kernel never reported
+//    kernel_interrupts vs interrupts_taken  : interrupts that arrived while we were busy
+//    notified          vs dropped           : notifications a slow consumer never saw
+//=================================================================================================
+void writeStats()
+{
+    // We write a temporary file and rename it, so readers never see a half-written file
+    string filename = conf.dirName + "/interrupts.stats";
+    string tempName = filename + ".tmp";
+
+    FILE* ofile = fopen(tempName.c_str(), "w");
+    if (ofile == nullptr) return;
+
+    uint32_t acks = irqAcks();
+    fprintf(ofile, "irq_acks %u\n",             acks);
+    if (stats.intx) fprintf(ofile, "hw_interrupts %u\n", hardwareInterrupts(acks));
+    fprintf(ofile, "kernel_interrupts %lu\n",   stats.kernelInterrupts.load());
+    fprintf(ofile, "interrupts_taken %lu\n",    stats.interrupts.load());
+    fprintf(ofile, "spurious_interrupts %lu\n", stats.spurious.load());
+    fprintf(ofile, "events %lu\n",              stats.events.load());
+    fprintf(ofile, "polled_events %lu\n",       stats.polled.load());
+    fprintf(ofile, "notifications %lu\n",       stats.notifications.load());
+
+    // And the counters for each interrupt source
+    for (int irq=0; irq<Distributor.irqCount(); ++irq)
+    {
+        fprintf(ofile, "source%d_notified %lu\n",  irq, Distributor.notified(irq));
+        fprintf(ofile, "source%d_coalesced %lu\n", irq, Distributor.coalesced(irq));
+        fprintf(ofile, "source%d_dropped %lu\n",   irq, Distributor.dropped(irq));
+    }
+
+    fclose(ofile);
+    rename(tempName.c_str(), filename.c_str());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// spawnStatsWriter() - Spawns a thread that rewrites the statistics file every "-stats" seconds
+//=================================================================================================
+void spawnStatsWriter()
+{
+    thread thread([]() {while (true) {writeStats(); sleep(conf.statsSeconds);}});
+    thread.detach();
+}
+//=================================================================================================
+
+
 //=================================================================================================
-bool initializePCI()
+// setupRealtime() - Pins the monitor thread to the CPU given by "-cpu", and if we've been asked
+//                   to, steers the card's interrupts to that same CPU so that the interrupt
+//                   handler and the thread it wakes share a cache
+//
+// This runs after every other thread (the notification handlers, the statistics writer and the
+// self-test) has been spawned, so they stay on any CPU of the card's NUMA node rather than
+// sharing the monitor thread's.  Otherwise, a monitor thread spinning through its "-budget" at
+// real-time priority would keep the self-test from raising the next interrupt until it gave up
+//=================================================================================================
+void setupRealtime(const pciFunction_t& card)
 {
-    // Find the colon in the device name
-    const char* colon = strchr(conf.device.c_str(), ':');
+    // If we haven't been asked to pin to a CPU, there's nothing to do
+    if (conf.cpu < 0) return;
 
-    // If there was no colon in the device name, we fail
-    if (colon == nullptr) return false;
+    // Pin the monitor thread
+    if (!pinThread(conf.cpu)) exit(1);
 
-    // Extract the vendor ID from the device name
-    int vendorID = strtoul(conf.device.c_str(), nullptr, 16);
+    // And steer the card's interrupts to the same CPU
+    if (conf.irqAffinity && setIrqAffinity(card, conf.cpu) == 0)
+    {
+        fprintf(stderr, "Can't steer the interrupts of %s to CPU %d\n", card.bdf.c_str(), conf.cpu);
+    }
+}
+//=================================================================================================
 
-    // Extract the device ID from the device name
-    int deviceID = strtoul(colon + 1, nullptr, 16);
 
+//=================================================================================================
+// findCard() - Finds the PCI device we've been asked to drive, either by its BDF or by its
+//              vendor ID, device ID and instance index
+//=================================================================================================
+bool findCard(pciFunction_t* card)
+{
     try
     {
-        // Memory map the regions of the specified PCI device
-        PCI.open(vendorID, deviceID);
+        // If the user gave us a BDF, that's the card we want
+        if (!conf.bdf.empty())
+        {
+            *card = findPciDevice(conf.bdf);
+            return true;
+        }
+
+        // Find the colon in the device name
+        const char* colon = strchr(conf.device.c_str(), ':');
+
+        // If there was no colon in the device name, we fail
+        if (colon == nullptr)
+        {
+            fprintf(stderr, "Malformed device name %s\n", conf.device.c_str());
+            return false;
+        }
+
+        // Extract the vendor ID and device ID from the device name
+        int vendorID = strtoul(conf.device.c_str(), nullptr, 16);
+        int deviceID = strtoul(colon + 1, nullptr, 16);
+
+        // And find the card with those IDs
+        *card = findPciDevice(vendorID, deviceID, conf.card);
+    }
+    catch(const exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return false;
+    }
+
+    // Tell the caller that we found their card
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// initializePCI() - Map the interrupt manager's status/control registers into userspace
+//=================================================================================================
+bool initializePCI(const pciFunction_t& card)
+{
+    try
+    {
+        // Memory map the regions of the specified PCI device.  The interrupt manager lives in
+        // BAR0, so there's no reason to build page tables for the DDR window in BAR1
+        PCI.setLazy(1);
+        PCI.open(card);
     }
     catch(const exception& e)
     {
@@ -216,9 +678,8 @@ bool initializePCI()
     // Fetch the user-space address of the first region, where our AXI registers are mapped        
     auto baseAddr = PCI.resourceList()[0].baseAddr;
 
-    // Compute the addresses of the two control/status registers of the interrupt manager
-    imReg0 = (uint32_t*)(baseAddr + conf.axiAddr + 0x0);
-    imReg1 = (uint32_t*)(baseAddr + conf.axiAddr + 0x4);
+    // Point to the control/status registers of the interrupt manager
+    intManager = RegisterBlock(baseAddr, conf.axiAddr);
 
     // And tell the caller that all is well
     return true;
@@ -228,6 +689,20 @@ bool initializePCI()
 
 
 
+//=================================================================================================
+// dumpTrace() - Writes the MMIO trace to a file
+//=================================================================================================
+void dumpTrace()
+{
+    int64_t count = MmioTrace::dump(conf.traceFile.c_str());
+    if (count < 0)
+        fprintf(stderr, "Can't write MMIO trace %s\n", conf.traceFile.c_str());
+    else
+        fprintf(stderr, "Wrote %ld register accesses to %s\n", count, conf.traceFile.c_str());
+}
+//=================================================================================================
+
+
 //=================================================================================================
 // showHelp() - Displays help text to the user
 //=================================================================================================
@@ -235,11 +710,24 @@ void showHelp()
 {
     printf("options:\n");
     printf(" -device <vendor_id:device_id>\n");
+    printf(" -card <index of card>\n");
+    printf(" -bdf <PCI bus:device.function>\n");
     printf(" -dir <fifo_directory_name>\n");
     printf(" -vectors <# of irq sources>\n");
     printf(" -axi <AXI interrupt manager base address>\n");
-    printf(" -selftest\n");
+    printf(" -selftest [iterations]\n");
     printf(" -verbose\n");
+    printf(" -eventfd\n");
+    printf(" -ring\n");
+    printf(" -vfio\n");
+    printf(" -budget <microseconds to poll for more events after an interrupt>\n");
+    printf(" -cpu <CPU to pin the monitor thread to>\n");
+    printf(" -rtprio <SCHED_FIFO priority, 1-99>\n");
+    printf(" -mlock\n");
+    printf(" -irqaffinity\n");
+    printf(" -shards <# of notification handler threads>\n");
+    printf(" -stats <seconds between updates of the statistics file>\n");
+    printf(" -trace [MMIO trace file]\n");
     exit(1);
 }
 //=================================================================================================
@@ -272,6 +760,10 @@ void parseCommandLine(const char** argv)
 
         if (option == "-device")
             conf.device = arg;
+        else if (option == "-card")
+            conf.card = stoi(arg, 0, 0);
+        else if (option == "-bdf")
+            conf.bdf = arg;
         else if (option == "-dir")
             conf.dirName = arg;
         else if (option == "-vectors")
@@ -279,9 +771,34 @@ void parseCommandLine(const char** argv)
         else if (option == "-axi")
             conf.axiAddr = stoi(arg, 0, 0);
         else if (option == "-selftest")
+        {
             conf.selfTest = true;
+            if (!arg.empty()) conf.selfTestCount = stoi(arg, 0, 0);
+        }
         else if (option == "-verbose")
             conf.verbose = true;
+        else if (option == "-eventfd")
+            conf.eventfd = true;
+        else if (option == "-ring")
+            conf.ring = true;
+        else if (option == "-vfio")
+            conf.vfio = true;
+        else if (option == "-budget")
+            conf.budgetUS = stoi(arg, 0, 0);
+        else if (option == "-cpu")
+            conf.cpu = stoi(arg, 0, 0);
+        else if (option == "-rtprio")
+            conf.rtPriority = stoi(arg, 0, 0);
+        else if (option == "-mlock")
+            conf.mlock = true;
+        else if (option == "-irqaffinity")
+            conf.irqAffinity = true;
+        else if (option == "-shards")
+            conf.shards = stoi(arg, 0, 0);
+        else if (option == "-stats")
+            conf.statsSeconds = stoi(arg, 0, 0);
+        else if (option == "-trace")
+            conf.traceFile = arg.empty() ? "mmio.trace" : arg;
         else
             showHelp();
     }
@@ -0,0 +1,148 @@
+//=================================================================================================
+// realtime.cpp - Routines that make interrupt handling more deterministic: CPU pinning, real-time
+//                scheduling, locking memory, and steering the device's interrupts to a CPU
+//=================================================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "PciDiscovery.h"
+
+using namespace std;
+
+
+//=================================================================================================
+// pinThread() - Pins the calling thread to the specified CPU
+//=================================================================================================
+bool pinThread(int cpu)
+{
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpu, &cpuSet);
+
+    int err = pthread_setaffinity_np(pthread_self(), sizeof cpuSet, &cpuSet);
+    if (err) fprintf(stderr, "Can't pin to CPU %d: %s\n", cpu, strerror(err));
+    return err == 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// pinToDeviceNode() - Restricts the calling thread (and every thread it creates afterwards) to
+//                     the CPUs on the same NUMA node as the card, which the kernel lists in the
+//                     card's "local_cpulist" file
+//
+// Returns: true if it worked
+//=================================================================================================
+bool pinToDeviceNode(const pciFunction_t& card)
+{
+    char      list[4096] = "";
+    cpu_set_t cpuSet;
+    int       count = 0;
+
+    // Fetch the list of CPUs, which looks like "0-7,16-23"
+    FILE* file = fopen((card.dir + "/local_cpulist").c_str(), "r");
+    if (file == nullptr) return false;
+    bool ok = fgets(list, sizeof list, file) != nullptr;
+    fclose(file);
+    if (!ok) return false;
+
+    // Turn it into a CPU set
+    CPU_ZERO(&cpuSet);
+    for (char* p = list; *p >= '0' && *p <= '9';)
+    {
+        int first = strtol(p, &p, 10);
+        int last  = (*p == '-') ? strtol(p + 1, &p, 10) : first;
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu, ++count) CPU_SET(cpu, &cpuSet);
+        if (*p == ',') ++p;
+    }
+    if (count == 0) return false;
+
+    int err = pthread_setaffinity_np(pthread_self(), sizeof cpuSet, &cpuSet);
+    if (err) fprintf(stderr, "Can't run on the CPUs local to %s: %s\n", card.bdf.c_str(), strerror(err));
+    return err == 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// setRealtime() - Switches the calling thread to the SCHED_FIFO scheduling policy at the
+//                 specified priority (1 thru 99).  Threads it creates afterwards inherit it
+//=================================================================================================
+bool setRealtime(int priority)
+{
+    sched_param param;
+    memset(&param, 0, sizeof param);
+    param.sched_priority = priority;
+
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err) fprintf(stderr, "Can't set SCHED_FIFO priority %d: %s\n", priority, strerror(err));
+    return err == 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// lockMemory() - Locks every page we have now (and every page we get later) into RAM, so that
+//                handling an interrupt never waits on a page fault
+//=================================================================================================
+bool lockMemory()
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) return true;
+    perror("mlockall");
+    return false;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// setIrqAffinity() - Steers every interrupt the card raises (its legacy interrupt and any MSI
+//                    or MSI-X vectors) to the specified CPU
+//
+// Returns: the number of interrupts that were steered
+//=================================================================================================
+int setIrqAffinity(const pciFunction_t& card, int cpu)
+{
+    vector<string> irqs;
+    int            irq, count = 0;
+
+    // Fetch the legacy interrupt number
+    FILE* file = fopen((card.dir + "/irq").c_str(), "r");
+    if (file)
+    {
+        if (fscanf(file, "%d", &irq) == 1 && irq > 0) irqs.push_back(to_string(irq));
+        fclose(file);
+    }
+
+    // And the interrupt numbers of any MSI or MSI-X vectors
+    string msiDir = card.dir + "/msi_irqs";
+    if (filesystem::exists(msiDir))
+    {
+        for (auto& entry : filesystem::directory_iterator(msiDir))
+        {
+            irqs.push_back(entry.path().filename().string());
+        }
+    }
+
+    // Point each of those interrupts at our CPU
+    for (auto& name : irqs)
+    {
+        string filename = "/proc/irq/" + name + "/smp_affinity_list";
+        file = fopen(filename.c_str(), "w");
+        if (file == nullptr) continue;
+        bool ok = fprintf(file, "%d\n", cpu) > 0;
+        if (fclose(file) == 0 && ok)
+            ++count;
+        else
+            fprintf(stderr, "Can't steer irq %s to CPU %d\n", name.c_str(), cpu);
+    }
+
+    // Tell the caller how many interrupts we steered
+    return count;
+}
+//=================================================================================================
@@ -8,72 +8,23 @@
 #include <string.h>
 #include <filesystem>
 #include <string>
+#include "PciDiscovery.h"
 
 using namespace std;
 
 static volatile int bitBucket;
 
-//=================================================================================================
-// getBDF() - Converts a <vendorID:deviceID> into a PCI BDF
-//=================================================================================================
-static string getBDF(string device)
-{
-    char command[64];
-    char buffer[256];
-    string retval = "0000:";
-
-    // Build the command "lspci -d {device}"
-    sprintf(command, "lspci -d %s", device.c_str());
-
-    // Open the lpsci command as a process
-    FILE* fp = popen(command, "r");
-
-    // If we couldn't do that, give up
-    if (fp == nullptr) return "";
-
-    // Fetch the first line of the output
-    if (!fgets(buffer, sizeof buffer, fp))
-    {
-        fclose(fp);
-        return "";
-    }
-
-    // Find the first space in the line
-    char* p = strchr(buffer, ' ');
-    if (p == nullptr)
-    {
-        fclose(fp);
-        return "";
-    }
-
-    // Terminate the string at the first space. 
-    *p = 0;
-    
-    // The PCI BDF of the device is the first token in the buffer
-    return retval + buffer;
-}
-//=================================================================================================
-
-
 //=================================================================================================
 // registerUioDevice() - Registers our device with the Linux UIO subsystem
 //=================================================================================================
-static void registerUioDevice(string device)
+static void registerUioDevice(const pciFunction_t& card)
 {
     char buffer[100];
 
     const char* filename = "/sys/bus/pci/drivers/uio_pci_generic/new_id";
 
-    // Get a copy of our device name in vendorID:deviceID format
-    strcpy(buffer, device.c_str());
-
-    // Replace the ':' delimeter with a space
-    char* delimeter = strchr(buffer, ':');
-    if (delimeter == nullptr) return;
-    *delimeter = ' ';
-
-    // Append a linefeed to the end
-    strcat(buffer, "\n");
+    // The driver expects "<vendorID> <deviceID>" in hex, followed by a linefeed
+    sprintf(buffer, "%04x %04x\n", card.vendorID, card.deviceID);
 
     // Open the psuedo-file that allows us to register a new device
     int fd = open(filename, O_WRONLY);
@@ -114,37 +65,25 @@ static int extractIndexFromUioName(string name)
 
 //=================================================================================================
 // findUioIndex() - Returns the UIO index of our device
+//
+// Once uio_pci_generic has claimed a device, the device's sysfs directory contains a "uio"
+// sub-directory with a single "uio<N>" entry in it
 //=================================================================================================
-static int findUioIndex(string bdf)
+static int findUioIndex(const pciFunction_t& card)
 {
-    string directory = "/sys/class/uio";
+    string directory = card.dir + "/uio";
 
-    // We're looking for a symlink target that contains "/<bdf>/uio/uio"
-    string searchKey = "/" + bdf + "/uio/uio";
+    // If the device hasn't been claimed by the UIO subsystem, there's nothing to find
+    if (!filesystem::is_directory(directory)) return -1;
 
-    // Loop through the entry for each device in the specified directory...
+    // Look for the "uio<N>" entry
     for (auto const& entry : filesystem::directory_iterator(directory)) 
     {
-        // Ignore any entry that isn't a symbolic link
-        if (!entry.is_symlink()) continue;
-
-        // Fetch the path of the source of the symlink
-        filesystem::path source = entry.path();
-
-        // Find the target of the symlink
-        filesystem::path target = filesystem::read_symlink(source);
-
-        // Get the filename (or folder name) of the target
-        string targetFilename = target.string();
-
-        // If we found the key we're looking for, return the associated UIO index
-        if (targetFilename.find(searchKey) != string::npos)
-        {
-            return extractIndexFromUioName(source.string());
-        }
+        string name = entry.path().filename().string();
+        if (name.compare(0, 3, "uio") == 0) return extractIndexFromUioName(name);
     }
 
-    // If we get here, we couldn't find the BDF we were looking for
+    // If we get here, we couldn't find the UIO entry for this device
     return -1;
 }
 //=================================================================================================
@@ -155,33 +94,23 @@ static int findUioIndex(string bdf)
 // initializeUIO() - Registers our device with the Linux UIO subsystem and returns the 
 //                   UIO index that corresponds to our device
 //
-// Passed: device = PCI device name in vendorID:deviceID format
+// Passed: card = the PCI device we're going to drive
 //=================================================================================================
-int initializeUIO(string device)
+int initializeUIO(const pciFunction_t& card)
 {
-    // Convert the device ID into a BDF
-    string bdf = getBDF(device);
-
-    // If this device isn't installed, drop dead
-    if (bdf.empty())
-    {
-        fprintf(stderr, "PCI device %s not found\n", device.c_str());
-        exit(1);
-    }
-
     // Make sure the generic UIO PCI device driver is loaded
     bitBucket = system("modprobe uio_pci_generic");
 
     // Register our device with the UIO subsystem
-    registerUioDevice(device);
+    registerUioDevice(card);
 
     // Fetch the UIO index that corresponds to our device
-    int index = findUioIndex(bdf);
+    int index = findUioIndex(card);
 
     // If we couldn't find a valid index, complain and give up
     if (index < 0)
     {
-        fprintf(stderr, "Can't initialize UIO subsystem for device %s\n", device.c_str());
+        fprintf(stderr, "Can't initialize UIO subsystem for device %s\n", card.bdf.c_str());
         exit(1);        
     }
 
@@ -0,0 +1,265 @@
+//=================================================================================================
+// vfio.cpp - Binds our device to the vfio-pci driver and routes its interrupts to eventfds
+//
+// Unlike uio_pci_generic, VFIO supports MSI and MSI-X.  When the device offers at least one
+// MSI-X vector per interrupt source, each source gets its own vector and its own eventfd, and
+// there's no need to read the interrupt manager's status register to find out who fired.
+// When it doesn't (the standard bitstream has a single legacy interrupt), we fall back to MSI
+// or INTx and de-multiplex the sources the same way the UIO backend does
+//=================================================================================================
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <linux/vfio.h>
+#include <filesystem>
+#include <string>
+#include "vfio.h"
+
+using namespace std;
+
+static volatile int bitBucket;
+
+// The bits in the PCI command register that enable memory decoding and bus-mastering
+static const uint16_t PCI_COMMAND_MEMORY = 0x2;
+static const uint16_t PCI_COMMAND_MASTER = 0x4;
+
+
+//=================================================================================================
+// writeFile() - Writes a string to a sysfs pseudo-file
+//=================================================================================================
+static void writeFile(string filename, string value)
+{
+    int fd = open(filename.c_str(), O_WRONLY);
+    if (fd < 0) return;
+    bitBucket = write(fd, value.c_str(), value.size());
+    close(fd);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// bindToVfio() - Detaches our device from whatever driver owns it and hands it to vfio-pci
+//=================================================================================================
+static void bindToVfio(const pciFunction_t& card)
+{
+    // Make sure the VFIO PCI driver is loaded
+    bitBucket = system("modprobe vfio-pci");
+
+    // If vfio-pci already owns the device, there's nothing to do
+    string driver = card.dir + "/driver";
+    if (filesystem::exists(driver) && filesystem::read_symlink(driver).filename() == "vfio-pci") return;
+
+    // Tell the kernel that only vfio-pci may claim this device
+    writeFile(card.dir + "/driver_override", "vfio-pci");
+
+    // Detach the device from its current driver
+    if (filesystem::exists(driver)) writeFile(driver + "/unbind", card.bdf);
+
+    // And ask the kernel to find it a driver again, which will now be vfio-pci
+    writeFile("/sys/bus/pci/drivers_probe", card.bdf);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// openDevice() - Opens the VFIO container and group our device belongs to, and returns the
+//                VFIO device file descriptor, or -1 on failure
+//=================================================================================================
+static int openDevice(const pciFunction_t& card)
+{
+    // Find out which IOMMU group our device belongs to
+    string groupLink = card.dir + "/iommu_group";
+    if (!filesystem::exists(groupLink))
+    {
+        fprintf(stderr, "%s has no IOMMU group.  Is the IOMMU enabled?\n", card.bdf.c_str());
+        return -1;
+    }
+    string group = filesystem::read_symlink(groupLink).filename().string();
+
+    // Open the container
+    int container = open("/dev/vfio/vfio", O_RDWR);
+    if (container < 0 || ioctl(container, VFIO_GET_API_VERSION) != VFIO_API_VERSION)
+    {
+        fprintf(stderr, "Can't open the VFIO container\n");
+        if (container >= 0) close(container);
+        return -1;
+    }
+
+    // Open the group.  Without an IOMMU, the group (if it exists at all) is "noiommu-<N>"
+    int groupFD = open(("/dev/vfio/" + group).c_str(), O_RDWR);
+    if (groupFD < 0) groupFD = open(("/dev/vfio/noiommu-" + group).c_str(), O_RDWR);
+    if (groupFD < 0)
+    {
+        fprintf(stderr, "Can't open VFIO group %s\n", group.c_str());
+        close(container);
+        return -1;
+    }
+
+    // Make sure every device in the group is bound to vfio-pci
+    vfio_group_status status = {sizeof status};
+    ioctl(groupFD, VFIO_GROUP_GET_STATUS, &status);
+    if (!(status.flags & VFIO_GROUP_FLAGS_VIABLE))
+    {
+        fprintf(stderr, "VFIO group %s isn't viable; bind every device in it to vfio-pci\n", group.c_str());
+        close(groupFD);
+        close(container);
+        return -1;
+    }
+
+    // Attach the group to the container and pick an IOMMU model
+    if (ioctl(groupFD, VFIO_GROUP_SET_CONTAINER, &container) != 0
+    ||  (ioctl(container, VFIO_SET_IOMMU, VFIO_TYPE1v2_IOMMU) != 0
+    &&   ioctl(container, VFIO_SET_IOMMU, VFIO_TYPE1_IOMMU)   != 0
+    &&   ioctl(container, VFIO_SET_IOMMU, VFIO_NOIOMMU_IOMMU) != 0))
+    {
+        fprintf(stderr, "Can't set up the VFIO container for group %s\n", group.c_str());
+        close(groupFD);
+        close(container);
+        return -1;
+    }
+
+    // And fetch the device itself
+    int deviceFD = ioctl(groupFD, VFIO_GROUP_GET_DEVICE_FD, card.bdf.c_str());
+    if (deviceFD < 0)
+    {
+        fprintf(stderr, "Can't open VFIO device %s\n", card.bdf.c_str());
+        close(groupFD);
+        close(container);
+    }
+    return deviceFD;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// enableDevice() - Turns on memory decoding and bus-mastering in the PCI command register.  A
+//                  device can't send an MSI (or DMA) without bus-mastering
+//=================================================================================================
+static void enableDevice(int deviceFD)
+{
+    uint16_t command;
+
+    // Find out where config space lives in the device file
+    vfio_region_info region = {sizeof region};
+    region.index = VFIO_PCI_CONFIG_REGION_INDEX;
+    if (ioctl(deviceFD, VFIO_DEVICE_GET_REGION_INFO, &region) != 0) return;
+
+    // Read-modify-write the command register
+    if (pread(deviceFD, &command, 2, region.offset + 4) != 2) return;
+    command |= PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER;
+    bitBucket = pwrite(deviceFD, &command, 2, region.offset + 4);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// initializeVFIO() - Binds our device to vfio-pci and routes its interrupts to eventfds
+//
+// Passed:  card     = the PCI device we're going to drive
+//          irqCount = the number of interrupt sources we manage
+//
+// On Exit: vfio     = describes the interrupt vectors and their eventfds
+//=================================================================================================
+bool initializeVFIO(const pciFunction_t& card, int irqCount, vfioIrqs_t* vfio)
+{
+    vfio_irq_info info;
+
+    // Hand the device to vfio-pci and open it
+    bindToVfio(card);
+    vfio->deviceFD = openDevice(card);
+    if (vfio->deviceFD < 0) return false;
+
+    // Make sure the device can send messages
+    enableDevice(vfio->deviceFD);
+
+    // Use the best kind of interrupt the device offers: MSI-X, then MSI, then INTx
+    for (int index : {VFIO_PCI_MSIX_IRQ_INDEX, VFIO_PCI_MSI_IRQ_INDEX, VFIO_PCI_INTX_IRQ_INDEX})
+    {
+        memset(&info, 0, sizeof info);
+        info.argsz = sizeof info;
+        info.index = index;
+        if (ioctl(vfio->deviceFD, VFIO_DEVICE_GET_IRQ_INFO, &info) == 0 && info.count > 0) break;
+        info.count = 0;
+    }
+
+    // If the device has no interrupts at all, we can't do anything useful
+    if (info.count == 0)
+    {
+        fprintf(stderr, "%s offers no interrupts\n", card.bdf.c_str());
+        return false;
+    }
+
+    // Decide how many vectors we're going to use
+    vfio->irqIndex    = info.index;
+    vfio->vectorCount = (info.index == VFIO_PCI_INTX_IRQ_INDEX) ? 1 : min((int)info.count, irqCount);
+    vfio->perSource   = (vfio->vectorCount >= irqCount && info.index != VFIO_PCI_INTX_IRQ_INDEX);
+
+    // Create one eventfd per vector
+    for (int i=0; i<vfio->vectorCount; ++i) vfio->eventFD[i] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    // Ask VFIO to signal those eventfds when the vectors fire
+    char buffer[sizeof(vfio_irq_set) + sizeof(int) * 32];
+    vfio_irq_set* set = (vfio_irq_set*)buffer;
+    set->argsz = sizeof(vfio_irq_set) + sizeof(int) * vfio->vectorCount;
+    set->flags = VFIO_IRQ_SET_DATA_EVENTFD | VFIO_IRQ_SET_ACTION_TRIGGER;
+    set->index = vfio->irqIndex;
+    set->start = 0;
+    set->count = vfio->vectorCount;
+    memcpy(set->data, vfio->eventFD, sizeof(int) * vfio->vectorCount);
+    if (ioctl(vfio->deviceFD, VFIO_DEVICE_SET_IRQS, set) != 0)
+    {
+        fprintf(stderr, "Can't route the %s interrupts of %s to eventfds\n", vfioIrqName(*vfio), card.bdf.c_str());
+        return false;
+    }
+
+    // Tell the caller that all is well
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// unmaskVFIO() - VFIO masks a level-triggered INTx interrupt each time it fires.  This unmasks it
+//                once the device has stopped asserting it.  There's nothing to do for MSI/MSI-X
+//=================================================================================================
+void unmaskVFIO(const vfioIrqs_t& vfio)
+{
+    if (vfio.irqIndex != VFIO_PCI_INTX_IRQ_INDEX) return;
+
+    vfio_irq_set unmask = {sizeof unmask};
+    unmask.flags = VFIO_IRQ_SET_DATA_NONE | VFIO_IRQ_SET_ACTION_UNMASK;
+    unmask.index = VFIO_PCI_INTX_IRQ_INDEX;
+    unmask.start = 0;
+    unmask.count = 1;
+    ioctl(vfio.deviceFD, VFIO_DEVICE_SET_IRQS, &unmask);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// vfioIrqName() - Returns a human readable name for the kind of interrupt we're using
+//=================================================================================================
+const char* vfioIrqName(const vfioIrqs_t& vfio)
+{
+    if (vfio.irqIndex == VFIO_PCI_MSIX_IRQ_INDEX) return "MSI-X";
+    if (vfio.irqIndex == VFIO_PCI_MSI_IRQ_INDEX)  return "MSI";
+    return "INTx";
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// vfioEdgeTriggered() - Returns true if we're using MSI or MSI-X.  These are messages that are
+//                       sent once when the interrupt manager's request line rises, so unlike
+//                       INTx, a source that stays active won't signal us again
+//=================================================================================================
+bool vfioEdgeTriggered(const vfioIrqs_t& vfio)
+{
+    return vfio.irqIndex != VFIO_PCI_INTX_IRQ_INDEX;
+}
+//=================================================================================================
@@ -0,0 +1,27 @@
+//=================================================================================================
+// vfio.h - Defines the interface to the VFIO-based interrupt backend
+//=================================================================================================
+#pragma once
+#include "PciDiscovery.h"
+
+// This describes the interrupts we've wired up through VFIO
+struct vfioIrqs_t
+{
+    int  deviceFD;          // The VFIO device file descriptor
+    int  irqIndex;          // VFIO_PCI_MSIX_IRQ_INDEX, VFIO_PCI_MSI_IRQ_INDEX or VFIO_PCI_INTX_IRQ_INDEX
+    int  vectorCount;       // The number of interrupt vectors we're using
+    bool perSource;         // True if every interrupt source has a vector of its own
+    int  eventFD[32];       // One eventfd per vector, signalled by the kernel when the vector fires
+};
+
+// Binds the card to vfio-pci and routes its interrupt vectors to eventfds
+bool initializeVFIO(const pciFunction_t& card, int irqCount, vfioIrqs_t* vfio);
+
+// Re-arms a level-triggered INTx interrupt after it has been handled
+void unmaskVFIO(const vfioIrqs_t& vfio);
+
+// Returns a human readable name for the kind of interrupt we're using
+const char* vfioIrqName(const vfioIrqs_t& vfio);
+
+// Returns true if we're using edge-triggered (MSI or MSI-X) interrupts rather than INTx
+bool vfioEdgeTriggered(const vfioIrqs_t& vfio);
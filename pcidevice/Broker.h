@@ -0,0 +1,120 @@
+//=================================================================================================
+// Broker.h - Defines the protocol spoken over the Sidewinder broker's Unix socket
+//
+// The broker runs as root and owns every Sidewinder in the machine.  Unprivileged clients connect
+// to its socket and send it brokerRequest_t messages; each one is answered with a brokerReply_t,
+// with file descriptors attached via SCM_RIGHTS when the request asks for them:
+//
+//    BROKER_LIST      - the number of cards, and the BDF of card "card"
+//    BROKER_OPEN_BAR  - an open "resourceN" (or "resourceN_wc") file for resource "index" of a card
+//    BROKER_OPEN_IRQS - the eventfds (and event ring) the card's interrupt driver hands out
+//    BROKER_LOCK      - exclusive use of the measure_bw engines in "engines"
+//    BROKER_UNLOCK    - gives those engines back
+//
+// Engines are identified by where their registers live: bit N of "engines" is the engine at BAR0
+// offset N * 0x1000.  Locks belong to a connection, so a client that dies gives its engines back
+//=================================================================================================
+#pragma once
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// This is where the broker's socket lives unless it's told otherwise
+#define BROKER_SOCKET "/run/sidewinder_broker.sock"
+
+// A reply never carries more than this many file descriptors
+enum {BROKER_MAX_FDS = 40};
+
+// These are the requests a client can make
+enum {BROKER_LIST = 1, BROKER_OPEN_BAR, BROKER_OPEN_IRQS, BROKER_LOCK, BROKER_UNLOCK};
+
+// Request flags: map a resource write-combining, or wait for engines that are in use
+enum {BROKER_WC = 1, BROKER_WAIT = 2};
+
+// This is a request from a client
+struct brokerRequest_t
+{
+    uint32_t op;            // BROKER_LIST, BROKER_OPEN_BAR, etc
+    uint32_t card;          // Which card (counting from 0, in BDF order)
+    uint32_t index;         // For BROKER_OPEN_BAR, which of the card's mappable resources
+    uint32_t flags;         // BROKER_WC and/or BROKER_WAIT
+    uint64_t engines;       // For BROKER_LOCK and BROKER_UNLOCK, bit N = engine at BAR0 offset N * 4K
+};
+
+// This is the broker's reply
+struct brokerReply_t
+{
+    int32_t  status;        // 0 on success, otherwise an errno value
+    uint32_t count;         // BROKER_LIST: number of cards.  BROKER_OPEN_IRQS: number of sources
+    uint32_t flags;         // BROKER_OPEN_BAR: BROKER_WC if it is.  BROKER_OPEN_IRQS: IRQ_MSG_* flags
+    uint32_t index;         // BROKER_OPEN_BAR: the resource's BAR number
+    uint64_t size;          // BROKER_OPEN_BAR: the size of the resource
+    uint64_t physAddr;      // BROKER_OPEN_BAR: the physical address of the resource
+    char     bdf[32];       // The PCI bus/device/function of the card
+};
+
+
+//=================================================================================================
+// brokerSend() - Sends a message over a socket with (optionally) some file descriptors attached
+//
+// Returns: true if the message was sent
+//=================================================================================================
+inline bool brokerSend(int sock, const void* message, size_t length, const int* fd = nullptr, int fdCount = 0)
+{
+    char control[CMSG_SPACE(sizeof(int) * BROKER_MAX_FDS)];
+
+    iovec  iov = {(void*)message, length};
+    msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov    = &iov;
+    msg.msg_iovlen = 1;
+
+    // Attach the file descriptors, if there are any
+    if (fdCount > 0 && fdCount <= BROKER_MAX_FDS)
+    {
+        memset(control, 0, sizeof control);
+        msg.msg_control    = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fdCount);
+        cmsghdr* cmsg      = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level   = SOL_SOCKET;
+        cmsg->cmsg_type    = SCM_RIGHTS;
+        cmsg->cmsg_len     = CMSG_LEN(sizeof(int) * fdCount);
+        memcpy(CMSG_DATA(cmsg), fd, sizeof(int) * fdCount);
+    }
+
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)length;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// brokerReceive() - Receives a message, and any file descriptors attached to it.  "fd" must have
+//                   room for BROKER_MAX_FDS entries
+//
+// Returns: the number of file descriptors received, or -1 if a whole message didn't arrive
+//=================================================================================================
+inline int brokerReceive(int sock, void* message, size_t length, int* fd)
+{
+    char control[CMSG_SPACE(sizeof(int) * BROKER_MAX_FDS)];
+
+    iovec  iov = {message, length};
+    msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof control;
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != (ssize_t)length) return -1;
+
+    // Find the file descriptors in the message
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS) return 0;
+    int fdCount = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fd, CMSG_DATA(cmsg), fdCount * sizeof(int));
+
+    // Tell the caller how many file descriptors they have
+    return fdCount;
+}
+//=================================================================================================
@@ -0,0 +1,87 @@
+//=================================================================================================
+// Histogram.h - Defines a fixed-size, log-linear histogram for recording latencies
+//
+// Values are grouped into buckets the way an HDR histogram does it: every power of two is split
+// into 16 equal sub-buckets, so any recorded value is reported to within 6.25% of its true value,
+// recording is a handful of instructions, and the memory footprint never grows
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+class LatencyHistogram
+{
+public:
+
+    // Default constructor
+    LatencyHistogram() : bucket_(BUCKETS, 0) {reset();}
+
+    // Throws away every value that has been recorded
+    void     reset() {for (auto& b : bucket_) b = 0; count_ = 0; min_ = UINT64_MAX; max_ = 0;}
+
+    // Records a single value
+    void     record(uint64_t value)
+    {
+        ++bucket_[indexOf(value)];
+        ++count_;
+        if (value < min_) min_ = value;
+        if (value > max_) max_ = value;
+    }
+
+    // Fetches the number of values recorded, and the smallest and largest of them
+    uint64_t count() const {return count_;}
+    uint64_t min()   const {return count_ ? min_ : 0;}
+    uint64_t max()   const {return max_;}
+
+    // Returns the value below which "pct" percent of the recorded values fall
+    uint64_t percentile(double pct) const
+    {
+        // Figure out how many values have to be at or below the value we return
+        uint64_t target = (uint64_t)(count_ * pct / 100.0 + 0.5);
+        if (target == 0) target = 1;
+
+        // Walk through the buckets until we've accounted for that many values
+        uint64_t seen = 0;
+        for (int i=0; i<BUCKETS; ++i)
+        {
+            seen += bucket_[i];
+            if (seen >= target)
+            {
+                uint64_t value = highestValue(i);
+                return value < max_ ? value : max_;
+            }
+        }
+
+        // If we get here, the histogram is empty
+        return max_;
+    }
+
+protected:
+
+    // Each power of two is split into 2^SUB_BITS sub-buckets
+    enum {SUB_BITS = 4, SUB_COUNT = 1 << SUB_BITS, BUCKETS = 61 * SUB_COUNT};
+
+    // Returns the index of the bucket that "value" belongs in
+    static int indexOf(uint64_t value)
+    {
+        if (value < SUB_COUNT) return (int)value;
+        int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + (int)((value >> shift) & (SUB_COUNT - 1));
+    }
+
+    // Returns the largest value that can land in the bucket at "index"
+    static uint64_t highestValue(int index)
+    {
+        if (index < SUB_COUNT) return index;
+        int shift = index / SUB_COUNT - 1;
+        uint64_t lowest = (uint64_t)(SUB_COUNT + index % SUB_COUNT) << shift;
+        return lowest + (1ULL << shift) - 1;
+    }
+
+    // One counter per bucket
+    std::vector<uint64_t> bucket_;
+
+    // The number of values recorded, and the smallest and largest of them
+    uint64_t count_, min_, max_;
+};
+//=================================================================================================
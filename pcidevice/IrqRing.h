@@ -0,0 +1,306 @@
+//=================================================================================================
+// IrqRing.h - Defines a lock-free, single-producer/multi-consumer ring of interrupt events that
+//             lives in a shared-memory segment (a memfd, backed by a hugepage when possible)
+//
+// The interrupt driver publishes one event per interrupt: the bitmap of active sources, a
+// timestamp, and the UIO interrupt count.  It also keeps a monotonic counter per source.
+// Consumers map the same memory and busy-poll it without making any system calls.  Every slot
+// carries the number of the event it holds, so a consumer that falls more than a full ring
+// behind knows exactly how many events it missed
+//=================================================================================================
+#pragma once
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// Identifies a block of shared memory as an interrupt event ring
+#define IRQ_RING_MAGIC   0x52495753
+#define IRQ_RING_VERSION 1
+
+// This is one interrupt event in the ring
+struct irqRingSlot_t
+{
+    std::atomic<uint64_t> seq;          // Event number + 1 once written, 0 while being written
+    uint64_t              timestamp;    // irqRingTimestamp() when the driver saw the interrupt
+    uint32_t              sources;      // Bitmap of the sources that were active
+    uint32_t              uioCount;     // The UIO subsystem's running interrupt count
+    uint64_t              reserved;
+};
+
+// This is a copy of one event, as handed to a consumer
+struct irqEvent_t
+{
+    uint64_t number;                // The number of this event (the first is event 0)
+    uint64_t timestamp;             // irqRingTimestamp() when the driver saw the interrupt
+    uint32_t sources;               // Bitmap of the sources that were active
+    uint32_t uioCount;              // The UIO subsystem's running interrupt count
+};
+
+// This lives at the start of the shared memory segment, and the slots follow it
+struct irqRingHeader_t
+{
+    uint32_t magic;                 // IRQ_RING_MAGIC
+    uint32_t version;               // IRQ_RING_VERSION
+    uint32_t slotCount;             // The number of slots in the ring (always a power of 2)
+    uint32_t irqCount;              // The number of interrupt sources the driver manages
+    double   ticksPerNS;            // How fast irqRingTimestamp() ticks
+
+    // The number of events that have ever been published
+    alignas(64) std::atomic<uint64_t> head;
+
+    // The number of times each source has fired
+    alignas(64) std::atomic<uint64_t> sourceCount[32];
+};
+
+
+//=================================================================================================
+// irqRingTimestamp() - Returns a timestamp from the fastest clock that both the driver and its
+//                      consumers can read.  On x86 that's the TSC
+//=================================================================================================
+inline uint64_t irqRingTimestamp()
+{
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// IrqRingWriter - The driver uses this to create the ring and publish events into it
+//=================================================================================================
+class IrqRingWriter
+{
+public:
+
+    // Default constructor and destructor
+    IrqRingWriter() {fd_ = -1; header_ = nullptr;}
+    ~IrqRingWriter() {destroy();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    IrqRingWriter (const IrqRingWriter&) = delete;
+    IrqRingWriter& operator= (const IrqRingWriter&) = delete;
+
+    // Creates the shared memory segment and initializes the ring.  "slotCount" must be a power of 2
+    bool create(uint32_t irqCount, uint32_t slotCount = 4096)
+    {
+        const size_t HUGE_PAGE = 2 << 20;
+
+        // Figure out how much memory we need, rounded up to a whole hugepage
+        size_t size = sizeof(irqRingHeader_t) + slotCount * sizeof(irqRingSlot_t);
+        size = (size + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+
+        // Try for a hugepage first, and settle for ordinary pages if there aren't any
+        fd_ = memfd_create("sidewinder_irq_ring", MFD_CLOEXEC | MFD_HUGETLB);
+        if (fd_ < 0 || ftruncate(fd_, size) != 0 || !map(size))
+        {
+            if (fd_ >= 0) ::close(fd_);
+            fd_ = memfd_create("sidewinder_irq_ring", MFD_CLOEXEC);
+            if (fd_ < 0 || ftruncate(fd_, size) != 0 || !map(size))
+            {
+                destroy();
+                return false;
+            }
+        }
+
+        // Initialize the header
+        header_->version    = IRQ_RING_VERSION;
+        header_->slotCount  = slotCount;
+        header_->irqCount   = irqCount;
+        header_->ticksPerNS = calibrate();
+        header_->head       = 0;
+        for (auto& counter : header_->sourceCount) counter = 0;
+        for (uint32_t i=0; i<slotCount; ++i) slot_[i].seq = 0;
+
+        // Writing the magic number last tells consumers the ring is ready to use
+        std::atomic_thread_fence(std::memory_order_release);
+        header_->magic = IRQ_RING_MAGIC;
+        return true;
+    }
+
+    // Publishes one event into the ring
+    void publish(uint32_t sources, uint32_t uioCount, uint64_t timestamp)
+    {
+        uint64_t       number = header_->head.load(std::memory_order_relaxed);
+        irqRingSlot_t& slot   = slot_[number & (header_->slotCount - 1)];
+
+        // Mark the slot as "being written", fill it in, then stamp it with its event number
+        slot.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.timestamp = timestamp;
+        slot.sources   = sources;
+        slot.uioCount  = uioCount;
+        slot.seq.store(number + 1, std::memory_order_release);
+
+        // Bump the counter for every active source
+        for (uint32_t bits = sources; bits; bits &= bits - 1)
+        {
+            auto& counter = header_->sourceCount[__builtin_ctz(bits)];
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        // And make the event visible to consumers
+        header_->head.store(number + 1, std::memory_order_release);
+    }
+
+    // Fetches the file descriptor of the shared memory segment, to hand to consumers
+    int  fd() const {return fd_;}
+
+    // Releases the shared memory
+    void destroy()
+    {
+        if (header_) munmap(header_, size_);
+        if (fd_ >= 0) ::close(fd_);
+        header_ = nullptr;
+        fd_     = -1;
+    }
+
+protected:
+
+    // Maps the shared memory segment into our address space
+    bool map(size_t size)
+    {
+        void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, 0);
+        if (ptr == MAP_FAILED) return false;
+        header_ = (irqRingHeader_t*)ptr;
+        slot_   = (irqRingSlot_t*)(header_ + 1);
+        size_   = size;
+        return true;
+    }
+
+    // Measures how fast irqRingTimestamp() ticks
+    static double calibrate()
+    {
+#if defined(__x86_64__)
+        timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+        uint64_t tick0 = irqRingTimestamp();
+        usleep(50000);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+        uint64_t tick1 = irqRingTimestamp();
+        double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+        return (tick1 - tick0) / ns;
+#else
+        return 1.0;
+#endif
+    }
+
+    // The shared memory segment, and where it's mapped
+    int              fd_;
+    size_t           size_;
+    irqRingHeader_t* header_;
+    irqRingSlot_t*   slot_;
+};
+//=================================================================================================
+
+
+//=================================================================================================
+// IrqRingReader - Consumers use this to map the ring and read events from it
+//=================================================================================================
+class IrqRingReader
+{
+public:
+
+    // Default constructor and destructor
+    IrqRingReader() {header_ = nullptr; next_ = 0; lost_ = 0;}
+    ~IrqRingReader() {if (header_) munmap(header_, size_);}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    IrqRingReader (const IrqRingReader&) = delete;
+    IrqRingReader& operator= (const IrqRingReader&) = delete;
+
+    // Maps the ring whose memfd the driver gave us.  Consumption starts with the next new event
+    bool attach(int fd)
+    {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < sizeof(irqRingHeader_t)) return false;
+        void* ptr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) return false;
+        header_ = (irqRingHeader_t*)ptr;
+        slot_   = (irqRingSlot_t*)(header_ + 1);
+        size_   = st.st_size;
+
+        // Make sure this really is a ring we understand
+        if (header_->magic != IRQ_RING_MAGIC || header_->version != IRQ_RING_VERSION) return false;
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        next_ = header_->head.load(std::memory_order_acquire);
+        return true;
+    }
+
+    // Fetches the next event, if there is one.  Never blocks
+    bool next(irqEvent_t* event)
+    {
+        while (true)
+        {
+            uint64_t head = header_->head.load(std::memory_order_acquire);
+
+            // If there's nothing new, tell the caller
+            if (next_ >= head) return false;
+
+            // If the producer has lapped us, skip past the events that have been overwritten
+            if (head - next_ > header_->slotCount)
+            {
+                lost_ += head - next_ - header_->slotCount;
+                next_  = head - header_->slotCount;
+            }
+
+            // Copy the event out of its slot
+            irqRingSlot_t& slot = slot_[next_ & (header_->slotCount - 1)];
+            uint64_t seq1    = slot.seq.load(std::memory_order_acquire);
+            event->timestamp = slot.timestamp;
+            event->sources   = slot.sources;
+            event->uioCount  = slot.uioCount;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t seq2    = slot.seq.load(std::memory_order_relaxed);
+
+            // If the slot held our event the whole time, we have a good copy
+            if (seq1 == next_ + 1 && seq2 == seq1)
+            {
+                event->number = next_++;
+                return true;
+            }
+
+            // Otherwise the producer overwrote it while we were reading.  Go around again,
+            // which will count it as lost
+            if (seq1 > next_ + 1 || seq1 == 0)
+            {
+                ++lost_;
+                ++next_;
+            }
+        }
+    }
+
+    // The number of events we missed because the producer lapped us
+    uint64_t lost() const {return lost_;}
+
+    // The number of times an interrupt source has fired since the driver started
+    uint64_t sourceCount(int irq) const {return header_->sourceCount[irq].load(std::memory_order_acquire);}
+
+    // The number of interrupt sources, and how fast the timestamps tick
+    uint32_t irqCount()   const {return header_->irqCount;}
+    double   ticksPerNS() const {return header_->ticksPerNS;}
+
+protected:
+
+    // Where the ring is mapped
+    irqRingHeader_t* header_;
+    irqRingSlot_t*   slot_;
+    size_t           size_;
+
+    // The number of the next event we'll read, and the number of events we've missed
+    uint64_t         next_;
+    uint64_t         lost_;
+};
+//=================================================================================================
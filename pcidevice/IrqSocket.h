@@ -0,0 +1,82 @@
+//=================================================================================================
+// IrqSocket.h - Defines the protocol spoken over the interrupt driver's Unix socket
+//
+// When a consumer connects to "<dir>/interrupts.sock", the driver sends it a single irqSocketMsg_t
+// with file descriptors attached via SCM_RIGHTS: one eventfd per interrupt source (if the driver
+// is in eventfd mode), followed by the memfd of the shared-memory event ring (if there is one)
+//=================================================================================================
+#pragma once
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+
+// This is the name (within the FIFO directory) of the driver's socket
+#define IRQ_SOCKET_NAME "interrupts.sock"
+
+// The driver never manages more than this many interrupt sources
+enum {IRQ_SOCKET_MAX_IRQS = 32};
+
+// These flags say which file descriptors are attached to the message
+enum {IRQ_MSG_EVENTFDS = 1, IRQ_MSG_RING = 2};
+
+// This is the message a consumer receives when it connects
+struct irqSocketMsg_t
+{
+    uint32_t irqCount;      // The number of interrupt sources the driver manages
+    uint32_t flags;         // IRQ_MSG_EVENTFDS and/or IRQ_MSG_RING
+};
+
+
+//=================================================================================================
+// receiveIrqFDs() - Connects to the driver's socket and fetches the message and its file
+//                   descriptors.  "fd" must have room for IRQ_SOCKET_MAX_IRQS + 1 entries
+//
+// Returns: the number of file descriptors received, or -1 if we couldn't talk to the driver
+//=================================================================================================
+inline int receiveIrqFDs(std::string socketName, irqSocketMsg_t* message, int* fd)
+{
+    sockaddr_un addr;
+    char        control[CMSG_SPACE(sizeof(int) * (IRQ_SOCKET_MAX_IRQS + 1))];
+
+    // If the socket name won't fit in a socket address, there's no way to connect to it
+    if (socketName.size() >= sizeof addr.sun_path) return -1;
+
+    // Build the address of the socket
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketName.c_str());
+
+    // Connect to the driver
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+    if (connect(sock, (sockaddr*)&addr, sizeof addr) != 0)
+    {
+        ::close(sock);
+        return -1;
+    }
+
+    // Receive the message and the file descriptors attached to it
+    iovec  iov = {message, sizeof *message};
+    msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof control;
+    int bytesRead = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    ::close(sock);
+
+    // Find the file descriptors in the message
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (bytesRead != sizeof *message) return -1;
+    if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS) return 0;
+    int fdCount = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fd, CMSG_DATA(cmsg), fdCount * sizeof(int));
+
+    // Tell the caller how many file descriptors they have
+    return fdCount;
+}
+//=================================================================================================
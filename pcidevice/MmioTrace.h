@@ -0,0 +1,228 @@
+//=================================================================================================
+// MmioTrace.h - Defines an opt-in flight recorder for register (MMIO) traffic
+//
+// When the program is compiled with MMIO_TRACE defined, every access that goes through a
+// RegisterBlock is recorded: its userspace address, the value read or written, the direction
+// and width, and a TSC timestamp.  Each thread records into a ring of its own, so recording takes
+// no locks and no atomic read-modify-writes; when a ring fills, the oldest entries are overwritten.
+// Recording is off until enable() is called, and dump() writes every ring to a binary file
+// (translating each address into a BAR and an offset) that "measure_bw -decode" can read.
+//
+// Without MMIO_TRACE, the recording hooks compile to nothing and RegisterBlock is unchanged
+//=================================================================================================
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// These are the hooks that RegisterBlock calls on every access
+#ifdef MMIO_TRACE
+#define MMIO_TRACE_READ(addr, value, width)  MmioTrace::record(addr, value, MmioTrace::READ  | (width))
+#define MMIO_TRACE_WRITE(addr, value, width) MmioTrace::record(addr, value, MmioTrace::WRITE | (width))
+#else
+#define MMIO_TRACE_READ(addr, value, width)  ((void)0)
+#define MMIO_TRACE_WRITE(addr, value, width) ((void)0)
+#endif
+
+// This is the header of a trace file
+struct mmioTraceHeader_t
+{
+    char     magic[8];      // "MMIOTRC1"
+    double   ticksPerNS;    // How fast the timestamps tick
+    uint64_t firstTick;     // The timestamp when tracing was enabled
+    uint32_t threadCount;   // The number of threads that recorded accesses
+    uint32_t unused;
+    uint64_t recordCount;   // The number of mmioTraceRecord_t that follow the header
+    uint64_t lostCount;     // Accesses that were overwritten before the trace was dumped
+};
+
+// This is one register access in a trace file.  The records are in timestamp order
+struct mmioTraceRecord_t
+{
+    uint64_t tick;          // When the access happened
+    uint64_t offset;        // Byte offset within the BAR, or the userspace address if "bar" is 0xFF
+    uint64_t value;         // The value read or written
+    uint8_t  bar;           // The BAR the access went to
+    uint8_t  flags;         // MmioTrace::READ or WRITE, plus the width in bytes
+    uint16_t thread;        // Which thread made the access (in the order threads first traced)
+    uint32_t unused;
+};
+
+
+class MmioTrace
+{
+public:
+
+    // The flags of an access are its direction plus its width in bytes (4 or 8)
+    enum {READ = 0x00, WRITE = 0x80, WIDTH_MASK = 0x0F};
+
+    // Returns true if the recording hooks were compiled in
+    static constexpr bool compiledIn()
+    {
+    #ifdef MMIO_TRACE
+        return true;
+    #else
+        return false;
+    #endif
+    }
+
+    // Tells the tracer which BAR a mapped address range belongs to
+    static void addMapping(const void* baseAddr, size_t size, int bar)
+    {
+        std::lock_guard<std::mutex> lock(mutex());
+        mappings().push_back({(const uint8_t*)baseAddr, size, bar});
+    }
+
+    // Starts recording.  Each thread that makes an access gets a ring of "entries" accesses
+    static void enable(size_t entries = 1 << 16)
+    {
+        size_t size = 1;
+        while (size < entries) size <<= 1;
+        ringSize() = size;
+        startTick() = tick();
+        clock_gettime(CLOCK_MONOTONIC_RAW, &startTime());
+        enabled().store(true, std::memory_order_release);
+    }
+
+    // Stops recording
+    static void disable() {enabled().store(false, std::memory_order_release);}
+
+    // Records one access.  This is the only thing that runs on the traced path
+    static inline void record(const volatile void* address, uint64_t value, uint8_t flags)
+    {
+        if (!enabled().load(std::memory_order_relaxed)) return;
+        ring_t* ring = myRing();
+        if (ring == nullptr) ring = myRing() = newRing();
+        uint64_t head  = ring->head.load(std::memory_order_relaxed);
+        entry_t& entry = ring->entry[head & ring->mask];
+        entry.tick     = tick();
+        entry.address  = (const uint8_t*)address;
+        entry.value    = value;
+        entry.flags    = flags;
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+
+    // Writes every ring to a trace file.  Returns the number of accesses written, or -1 on error
+    static int64_t dump(const char* filename)
+    {
+        std::vector<mmioTraceRecord_t> records;
+        mmioTraceHeader_t header = {{'M','M','I','O','T','R','C','1'}, 1.0, startTick(), 0, 0, 0, 0};
+        std::lock_guard<std::mutex> lock(mutex());
+
+        // Gather up every access that's still in a ring
+        for (size_t t = 0; t < rings().size(); ++t)
+        {
+            ring_t*  ring  = rings()[t];
+            uint64_t head  = ring->head.load(std::memory_order_acquire);
+            uint64_t first = (head > ring->mask + 1) ? head - ring->mask - 1 : 0;
+            header.lostCount += first;
+            for (uint64_t i = first; i < head; ++i)
+            {
+                entry_t& entry = ring->entry[i & ring->mask];
+                mmioTraceRecord_t record = {entry.tick, (uint64_t)entry.address, entry.value, 0xFF,
+                                            (uint8_t)entry.flags, (uint16_t)t, 0};
+                translate(entry.address, &record);
+                records.push_back(record);
+            }
+        }
+
+        // Put them in the order they happened
+        std::sort(records.begin(), records.end(),
+                  [](const mmioTraceRecord_t& a, const mmioTraceRecord_t& b) {return a.tick < b.tick;});
+
+        // Find out how fast the timestamps ticked while we were recording
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+        double ns = (now.tv_sec - startTime().tv_sec) * 1e9 + (now.tv_nsec - startTime().tv_nsec);
+        if (ns > 0) header.ticksPerNS = (tick() - startTick()) / ns;
+
+        // And write the file
+        header.threadCount = rings().size();
+        header.recordCount = records.size();
+        FILE* file = fopen(filename, "wb");
+        if (file == nullptr) return -1;
+        bool ok = fwrite(&header, sizeof header, 1, file) == 1
+               && fwrite(records.data(), sizeof(mmioTraceRecord_t), records.size(), file) == records.size();
+        if (fclose(file) != 0 || !ok) return -1;
+        return records.size();
+    }
+
+protected:
+
+    // One recorded access, as it sits in a ring
+    struct entry_t
+    {
+        uint64_t       tick;
+        const uint8_t* address;
+        uint64_t       value;
+        uint64_t       flags;
+    };
+
+    // The ring that one thread records into
+    struct ring_t
+    {
+        std::atomic<uint64_t> head;
+        uint64_t              mask;
+        entry_t*              entry;
+    };
+
+    // An address range that belongs to a BAR
+    struct mapping_t {const uint8_t* baseAddr; size_t size; int bar;};
+
+    // Returns a timestamp from the fastest clock we have
+    static inline uint64_t tick()
+    {
+    #if defined(__x86_64__)
+        return __rdtsc();
+    #else
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    #endif
+    }
+
+    // Creates the calling thread's ring the first time it makes an access
+    static ring_t* newRing()
+    {
+        ring_t* ring = new ring_t;
+        ring->head   = 0;
+        ring->mask   = ringSize() - 1;
+        ring->entry  = new entry_t[ringSize()];
+        std::lock_guard<std::mutex> lock(mutex());
+        rings().push_back(ring);
+        return ring;
+    }
+
+    // Translates a userspace address into a BAR and offset.  The newest mapping wins
+    static void translate(const uint8_t* address, mmioTraceRecord_t* record)
+    {
+        auto& list = mappings();
+        for (auto it = list.rbegin(); it != list.rend(); ++it)
+        {
+            if (address >= it->baseAddr && address < it->baseAddr + it->size)
+            {
+                record->bar    = it->bar;
+                record->offset = address - it->baseAddr;
+                return;
+            }
+        }
+    }
+
+    // The tracer's state.  These are functions so that this class can live entirely in a header
+    static std::atomic<bool>&      enabled()   {static std::atomic<bool> value(false); return value;}
+    static size_t&                 ringSize()  {static size_t value = 1 << 16; return value;}
+    static uint64_t&               startTick() {static uint64_t value; return value;}
+    static timespec&               startTime() {static timespec value; return value;}
+    static std::mutex&             mutex()     {static std::mutex value; return value;}
+    static std::vector<ring_t*>&   rings()     {static std::vector<ring_t*> value; return value;}
+    static std::vector<mapping_t>& mappings()  {static std::vector<mapping_t> value; return value;}
+    static ring_t*&                myRing()    {static thread_local ring_t* value = nullptr; return value;}
+};
+//=================================================================================================
@@ -0,0 +1,403 @@
+//=================================================================================================
+// PciDevice.cpp - Implements a generic class for mapping PCIe devices into user-space
+//=================================================================================================
+#include <unistd.h>
+#include <stdint.h>
+#include <string>
+#include <fstream>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "PciDevice.h"
+#include "PciDiscovery.h"
+#include "MmioTrace.h"
+using namespace std;
+
+#define c(s) s.c_str()
+
+
+//=================================================================================================
+// FileDes - This is a standard Unix/Linux file descriptor that closes itself
+//           when it goes out of scope
+//=================================================================================================
+class FileDes
+{
+public:
+    // Constructor with no value
+    FileDes() {fd = -1;}
+
+    // Constructor with a file descriptor
+    FileDes(int value) {fd = value;}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    FileDes (const FileDes&) = delete;
+    FileDes& operator= (const FileDes&) = delete;
+
+    // Destructor - Closes the file descriptor
+    ~FileDes() {if (fd != -1) ::close(fd);}
+
+    // Assignment from an int
+    FileDes& operator=(int value) {fd=value; return *this;} 
+
+    // Conversion to an int
+    operator int() {return fd;}
+
+    // The actual file descriptor
+    int fd;
+};
+//=================================================================================================
+
+
+
+
+//=================================================================================================
+// throwRuntime() - Throws a runtime exception
+//=================================================================================================
+static void throwRuntime(const char* fmt, ...)
+{
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsprintf(buffer, fmt, ap);
+    va_end(ap);
+
+    throw runtime_error(buffer);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// mapFile() - Maps "size" bytes of a file, starting at "offset", with read/write access
+//
+// Passed:  populate = true to have the page tables filled in now (MAP_POPULATE)
+//
+// Notes: A mapping of HUGE_ALIGN bytes or more is put at a virtual address that is a multiple of
+//        HUGE_ALIGN (1G for a mapping that size or larger), so that a kernel that can map device
+//        memory with huge pages is free to do so.  That takes far fewer TLB entries to sweep a
+//        large BAR.  We get such an address by reserving a larger region and trimming it
+//
+// Returns: the userspace address of the mapping, or MAP_FAILED
+//=================================================================================================
+static void* mapFile(int fd, off_t offset, size_t size, bool populate)
+{
+    const size_t HUGE_ALIGN = 2 << 20, GIANT_ALIGN = 1 << 30;
+    const int    protection = PROT_READ | PROT_WRITE;
+    const int    flags      = MAP_SHARED | (populate ? MAP_POPULATE : 0);
+
+    // Small mappings can go anywhere
+    if (size < HUGE_ALIGN) return ::mmap(0, size, protection, flags, fd, offset);
+
+    // Reserve enough address space to be sure an aligned range of "size" bytes fits in it
+    size_t   align = (size >= GIANT_ALIGN) ? GIANT_ALIGN : HUGE_ALIGN;
+    uint8_t* area  = (uint8_t*)::mmap(0, size + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (area == MAP_FAILED) return MAP_FAILED;
+
+    // Give back the parts of the reservation on either side of the aligned range
+    uint8_t* aligned = (uint8_t*)(((uintptr_t)area + align - 1) & ~(uintptr_t)(align - 1));
+    if (aligned > area) ::munmap(area, aligned - area);
+    ::munmap(aligned + size, area + align - aligned);
+
+    // And map the file over the aligned range
+    void* ptr = ::mmap(aligned, size, protection, flags | MAP_FIXED, fd, offset);
+    if (ptr == MAP_FAILED) ::munmap(aligned, size);
+    return ptr;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// mapResource() - Maps one memory-mappable resource of this device into user-space
+//
+// Passed:   index     = the index of the resource in resource_
+//
+// On Entry: dir_      = the sysfs directory of the device, which has the "resourceN" files
+//           fd_       = for a device whose resources were handed to open() as open files, the file
+//                       for each resource that hasn't been mapped yet.  Otherwise empty
+//
+// On Exit:  resource_[index] has its userspace "baseAddr" and "isWC" filled in
+//
+// Notes: A resource that open() was handed a file for is mapped through that file.  Otherwise it
+//        is mapped through its sysfs "resourceN" file, which is uncached, or through
+//        "resourceN_wc" if the caller asked for write-combining and the kernel offers it (it only
+//        does for prefetchable BARs).  The kernel picks the caching from the file name, so those
+//        are opened without O_SYNC.  If the sysfs files can't be opened we fall back to mapping
+//        the resource through /dev/mem, where O_SYNC is what makes the mapping uncached
+//=================================================================================================
+void PciDevice::mapResource(int index)
+{
+    const char* devMemName = "/dev/mem";
+    auto&       bar        = resource_[index];
+    bool        populate   = (populateMask_ & (1 << index)) != 0;
+    void*       ptr;
+    FileDes     fd;
+
+    // If this resource is already mapped, there's nothing to do
+    if (bar.baseAddr) return;
+
+    // If open() was handed files, the one for this resource is ours to map (and close)
+    bool handed = index < fd_.size();
+    if (handed)
+    {
+        fd = fd_[index];
+        fd_[index] = -1;
+    }
+
+    // Otherwise, open the sysfs file for it, trying the write-combining flavor first if the
+    // caller wants it
+    else
+    {
+        string filename = dir_ + "/resource" + to_string(bar.index);
+        if (wcMask_ & (1 << index)) fd = ::open(c((filename + "_wc")), O_RDWR | O_CLOEXEC);
+        bar.isWC = (fd >= 0);
+        if (fd < 0) fd = ::open(c(filename), O_RDWR | O_CLOEXEC);
+    }
+
+    // Map the resource through its file if we have one.  If sysfs wouldn't give us one, fall
+    // back to /dev/mem
+    if (fd >= 0)
+        ptr = mapFile(fd, 0, bar.size, populate);
+    else if (handed)
+        ptr = MAP_FAILED;
+    else
+    {
+        FileDes devMem(::open(devMemName, O_RDWR | O_SYNC | O_CLOEXEC));
+
+        // If that open failed, we're done here
+        if (devMem < 0) throwRuntime("Can't open %s.  Must be root.  Use sudo.", devMemName);
+
+        ptr = mapFile(devMem, bar.physAddr, bar.size, populate);
+    }
+
+    // If a mapping error occurs, tell the caller
+    if (ptr == MAP_FAILED) throwRuntime("mmap failed on 0x%lx for size 0x%lx", bar.physAddr, bar.size);
+
+    // Otherwise, save the user-space address that our PCI resource is mapped to
+    bar.baseAddr = (uint8_t*)ptr;
+
+    // Let the MMIO tracer know which BAR accesses to this address range belong to
+    MmioTrace::addMapping(bar.baseAddr, bar.size, bar.index);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// mapResources() - Maps each memory-mappable resource for this device into user-space, except
+//                  for the ones the caller asked to have mapped lazily
+//
+// If any of them can't be mapped, the device is closed
+//=================================================================================================
+void PciDevice::mapResources()
+{
+    try
+    {
+        for (int i=0; i<resource_.size(); ++i)
+        {
+            if ((lazyMask_ & (1 << i)) == 0) mapResource(i);
+        }
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// resource() - Returns the resource at "index" in the resource list, mapping it first if it
+//              was left unmapped by open()
+//=================================================================================================
+PciDevice::resource_t& PciDevice::resource(int index)
+{
+    if (index < 0 || index >= resource_.size()) throwRuntime("Device has no resource %d", index);
+    mapResource(index);
+    return resource_[index];
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// close() - Unmap any memory mapped resources from this PCI device
+//=================================================================================================
+void PciDevice::close()
+{
+    // Loop through each resource slot, and if it's memory mapped, unmap it
+    for (auto& resource : resource_)
+    {
+        if (resource.baseAddr) munmap(resource.baseAddr, resource.size); 
+    }
+
+    // Close the files for any resources we never got around to mapping
+    for (int fd : fd_)
+    {
+        if (fd >= 0) ::close(fd);
+    }
+
+    // Delete the list of memory-mapped resources
+    resource_.clear();
+    fd_.clear();
+
+    // We no longer have a device open
+    bdf_.clear();
+    dir_.clear();
+}
+//=================================================================================================
+
+
+
+//=================================================================================================
+// getResourceList() - Returns a vector of resource_t entries that describe each memory-mappable
+//                     resource (i.e., BAR) that this PCI device supports
+//
+// On Entry: deviceDir = the name of the device directory that contains the "resource" file
+//
+//
+// Notes: The resource file will contain 1 line of ASCII data for each potential mappable resource.
+//        Each line contains 3 fields separated one space character:
+//           (1) The physical starting address of the memory mapped resource
+//           (2) The physical ending address of the memory mapped resource
+//           (3) A set of flags that we don't care about    
+//=================================================================================================
+std::vector<PciDevice::resource_t> PciDevice::getResourceList(std::string deviceDir)
+{
+    string             line;
+    vector<resource_t> result;
+    int                index = -1;
+    
+    // This file will contain 1 line per potential resource
+    string filename = deviceDir + "/resource";
+
+    // Open the specified file  
+    ifstream file(filename);
+
+    // If we couldn't open the file, hand the caller an invalid value   
+    if (!file.is_open()) throwRuntime("Can't open %s", c(filename));
+    
+    // Loop through each line of the file...
+    while (getline(file, line))
+    {
+        // Keep track of which resource (i.e., which "resourceN" file) this line describes
+        ++index;
+
+        // Get pointers to the 1st and 2nd text fields of that line
+        const char* p1 = c(line);
+        const char* p2 = strchr(p1, ' ');
+        
+        // Parse the physical starting and ending address of this memory-mappable resource
+        off_t starting_address = strtoll(p1, 0, 0);
+        off_t ending_address   = strtoll(p2, 0, 0);
+
+        // A starting address of 0 means "this line doesn't define a memory-mappable resource"
+        if (starting_address == 0) continue;
+
+        // Compute how many bytes long that memory region is
+        size_t size = ending_address - starting_address + 1;
+
+        // Append the description of this mappable resource into our result vector        
+        result.push_back({0, size, starting_address, index, false});
+    }
+
+    // If there are no memory-mappable resources, create an error message
+    if (result.empty()) throwRuntime("Device contains no memory-mappable resources");
+
+    // Hand the caller the list of resources that can be memory mapped for this PCI device
+    return result;
+}
+//=================================================================================================
+
+
+
+
+//=================================================================================================
+// open() - Opens a connection to the specified PCIe device
+//
+// Passed: vendorID  = The vendor ID of the PCIe device we're looking for
+//         deviceID  = The device ID of the PCIe device we're looking for
+//         deviceDir = Name of the file-system directory where PCI device information can
+//                     be found.   If empty-string, a sensible default is used
+//=================================================================================================
+void PciDevice::open(int vendorID, int deviceID, string deviceDir)
+{
+    open(findPciDevice(vendorID, deviceID, 0, deviceDir));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// open() - Opens a connection to the Nth PCIe device with the specified vendor ID and device ID
+//
+// Passed: vendorID  = The vendor ID of the PCIe device we're looking for
+//         deviceID  = The device ID of the PCIe device we're looking for
+//         index     = Which of the matching devices to open (0 = the one with the lowest BDF)
+//         deviceDir = Name of the sysfs PCI device directory, or empty-string for the default
+//=================================================================================================
+void PciDevice::open(int vendorID, int deviceID, int index, string deviceDir)
+{
+    open(findPciDevice(vendorID, deviceID, index, deviceDir));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// open() - Opens a connection to the PCIe device at the specified bus/device/function
+//
+// Passed: bdf       = "0000:01:00.0", or "01:00.0" to mean PCI domain 0
+//         deviceDir = Name of the sysfs PCI device directory, or empty-string for the default
+//=================================================================================================
+void PciDevice::open(string bdf, string deviceDir)
+{
+    open(findPciDevice(bdf, deviceDir));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// open() - Opens a connection to a PCIe device that has already been found in sysfs
+//=================================================================================================
+void PciDevice::open(const pciFunction_t& function)
+{
+    // If we already have a PCIe device mapped, unmap it
+    close();
+
+    // Keep track of which device we have open, and where sysfs describes it
+    bdf_ = function.bdf;
+    dir_ = function.dir;
+
+    // Fetch the physical address and size of each resource (i.e. BAR) that our device supports
+    resource_ = getResourceList(function.dir);
+
+    // Memory map the PCI device resources into userspace
+    mapResources();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// open() - Maps the resources of a PCIe device through files that someone else opened.  This is
+//          how an unprivileged process maps a device that the broker has handed it
+//
+// Passed: bdf       = The PCI bus/device/function of the device
+//         resources = The physical address, size, index, and write-combining flag of each resource
+//         fds       = An open "resourceN" (or "resourceN_wc") file for each resource.  These are
+//                     closed once they're mapped (or when the device is closed)
+//=================================================================================================
+void PciDevice::open(string bdf, const vector<resource_t>& resources, const vector<int>& fds)
+{
+    // If we already have a PCIe device mapped, unmap it
+    close();
+
+    // Hold on to the file for each resource until the resource is mapped
+    resource_ = resources;
+    fd_       = fds;
+    fd_.resize(resource_.size(), -1);
+    for (int i=resource_.size(); i<fds.size(); ++i) ::close(fds[i]);
+
+    // Keep track of which device we have open
+    bdf_ = bdf;
+
+    // Memory map the resources we don't have to map lazily
+    mapResources();
+}
+//=================================================================================================
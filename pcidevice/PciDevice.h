@@ -0,0 +1,120 @@
+//=================================================================================================
+// PciDevice.h - Defines a generic class for mapping PCIe devices into user-space
+//=================================================================================================
+#pragma once
+#include <string.h>
+#include <string>
+#include <vector>
+#include "PciDiscovery.h"
+
+class PciDevice
+{
+public:
+   
+    // Default constructor
+    PciDevice() {};
+
+    // Destructor
+    ~PciDevice() {close();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    PciDevice (const PciDevice&) = delete;
+    PciDevice& operator= (const PciDevice&) = delete;
+
+    // These each describe a memory mapped resource from a PCI device.  "baseAddr" is null until
+    // the resource is mapped
+    struct resource_t {uint8_t* baseAddr; size_t size; off_t physAddr; int index; bool isWC;};
+
+    // Asks for the resource at "index" in resourceList() to be mapped write-combining.  This must
+    // be called before open(), and only takes effect if the resource is prefetchable
+    void    setWriteCombining(int index, bool enable = true)
+    {
+        if (enable) wcMask_ |= (1 << index); else wcMask_ &= ~(1 << index);
+    }
+
+    // Asks for the resource at "index" in resourceList() to be left unmapped by open() and mapped
+    // the first time resource() asks for it.  This must be called before open()
+    void    setLazy(int index, bool enable = true)
+    {
+        if (enable) lazyMask_ |= (1 << index); else lazyMask_ &= ~(1 << index);
+    }
+
+    // Asks for the page tables of the resource at "index" to be filled in when it's mapped
+    // (MAP_POPULATE) instead of one page at a time as it's touched.  This must be called before
+    // the resource is mapped
+    void    setPopulate(int index, bool enable = true)
+    {
+        if (enable) populateMask_ |= (1 << index); else populateMask_ &= ~(1 << index);
+    }
+
+    // Opens a connection to the first PCIe device with the specified vendor ID and device ID
+    void    open(int vendorID, int deviceID, std::string deviceDir = "");
+
+    // Opens a connection to the Nth PCIe device (in BDF order) with the specified IDs
+    void    open(int vendorID, int deviceID, int index, std::string deviceDir = "");
+
+    // Opens a connection to the PCIe device at the specified bus/device/function
+    void    open(std::string bdf, std::string deviceDir = "");
+
+    // Opens a connection to a PCIe device that has already been found
+    void    open(const pciFunction_t& function);
+
+    // Maps the resources of a device through "resourceN" files that were opened elsewhere
+    void    open(std::string bdf, const std::vector<resource_t>& resources, const std::vector<int>& fds);
+
+    // Fetches the list of memory mappable resources.  Resources left unmapped by setLazy() have
+    // a null "baseAddr"
+    std::vector<resource_t>& resourceList() {return resource_;}
+
+    // Fetches the resource at "index" in resourceList(), mapping it first if it isn't mapped yet.
+    // Two threads mustn't ask for the same unmapped resource at the same time
+    resource_t& resource(int index);
+
+    // Fetches the PCI bus/device/function (i.e., "0000:01:00.0") of the open device
+    std::string bdf() {return bdf_;}
+    
+    // Stop access to the PCI device
+    void    close();
+
+    // Drains the CPU's write-combining buffers, so that every store made so far through a
+    // write-combining mapping is on its way to the device before any store that follows it
+    static void flushWC()
+    {
+    #if defined(__x86_64__) || defined(__i386__)
+        __asm__ __volatile__("sfence" ::: "memory");
+    #else
+        __sync_synchronize();
+    #endif
+    }
+
+    // Copies a block of data into a write-combining mapping and flushes it to the device
+    static void copyWC(void* dst, const void* src, size_t length)
+    {
+        memcpy(dst, src, length);
+        flushWC();
+    }
+
+protected:
+
+    // Fetches the list of memory-mappable resources
+    std::vector<resource_t> getResourceList(std::string deviceDir);
+
+    // Memory maps every resource in resource_ that isn't supposed to be mapped lazily
+    void mapResources();
+
+    // Memory maps the resource at resource_[index]
+    void mapResource(int index);
+
+    // Contains one entry for each resource (i.e, BAR) that is configured in the PCI device
+    std::vector<resource_t> resource_;
+
+    // The files that open() was handed for each resource, until each resource is mapped
+    std::vector<int> fd_;
+
+    // The PCI bus/device/function of the device we have open, and its sysfs directory
+    std::string bdf_, dir_;
+
+    // Bit "n" is set if the caller wants resource_[n] mapped write-combining, lazily, or with its
+    // page tables populated up front
+    uint32_t wcMask_ = 0, lazyMask_ = 0, populateMask_ = 0;
+};
@@ -0,0 +1,177 @@
+//=================================================================================================
+// PciDiscovery.cpp - Implements routines for finding PCI functions by scanning sysfs directly
+//
+// Each function's vendor ID and device ID are the first four bytes of its "config" file, so
+// finding a device costs one small read per PCI function, with no child process and no parsing
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "PciDiscovery.h"
+using namespace std;
+
+
+//=================================================================================================
+// throwRuntime() - Throws a runtime exception
+//=================================================================================================
+static void throwRuntime(const char* fmt, ...)
+{
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsprintf(buffer, fmt, ap);
+    va_end(ap);
+
+    throw runtime_error(buffer);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readIDs() - Fetches the vendor ID and device ID of a PCI function from its config space
+//
+// Returns: true if the IDs could be read
+//=================================================================================================
+static bool readIDs(const string& dirName, int* vendorID, int* deviceID)
+{
+    uint8_t config[4];
+
+    // Config space is world-readable, and the IDs are the first two 16-bit little-endian words
+    int fd = ::open((dirName + "/config").c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    int bytesRead = ::pread(fd, config, sizeof config, 0);
+    ::close(fd);
+
+    // If we couldn't read the IDs, tell the caller
+    if (bytesRead != sizeof config) return false;
+
+    // Hand the caller the IDs
+    *vendorID = config[0] | (config[1] << 8);
+    *deviceID = config[2] | (config[3] << 8);
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// scanPciBus() - Returns every PCI function in the system, sorted by BDF
+//
+// Passed: deviceDir = Name of the file-system directory where PCI device information can
+//                     be found.   If empty-string, a sensible default is used
+//=================================================================================================
+vector<pciFunction_t> scanPciBus(string deviceDir)
+{
+    vector<pciFunction_t> result;
+    dirent*               entry;
+
+    // If the caller didn't specify a device-directory, use the default
+    if (deviceDir.empty()) deviceDir = "/sys/bus/pci/devices";
+
+    // Open the directory that contains one entry per PCI function
+    DIR* dir = opendir(deviceDir.c_str());
+    if (dir == nullptr) throwRuntime("Can't open %s", deviceDir.c_str());
+
+    // Loop through each entry, ignoring "." and ".."
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        if (entry->d_name[0] == '.') continue;
+
+        pciFunction_t function = {entry->d_name, deviceDir + "/" + entry->d_name, 0, 0};
+
+        // If this entry has readable IDs, it's a PCI function
+        if (readIDs(function.dir, &function.vendorID, &function.deviceID)) result.push_back(function);
+    }
+    closedir(dir);
+
+    // Sort the list so that "the Nth card" means the same card every time
+    sort(result.begin(), result.end(),
+         [](const pciFunction_t& a, const pciFunction_t& b) {return a.bdf < b.bdf;});
+
+    // Hand the caller the list of PCI functions
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// findPciDevices() - Returns every PCI function with the specified vendor ID and device ID
+//=================================================================================================
+vector<pciFunction_t> findPciDevices(int vendorID, int deviceID, string deviceDir)
+{
+    vector<pciFunction_t> result;
+
+    for (auto& function : scanPciBus(deviceDir))
+    {
+        if (function.vendorID == vendorID && function.deviceID == deviceID) result.push_back(function);
+    }
+
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// findPciDevice() - Returns the Nth PCI function with the specified vendor ID and device ID
+//
+// Passed: vendorID  = The vendor ID of the PCIe device we're looking for
+//         deviceID  = The device ID of the PCIe device we're looking for
+//         index     = Which of the matching devices we want (0 = lowest BDF)
+//         deviceDir = Name of the sysfs PCI device directory, or empty-string for the default
+//=================================================================================================
+pciFunction_t findPciDevice(int vendorID, int deviceID, int index, string deviceDir)
+{
+    auto list = findPciDevices(vendorID, deviceID, deviceDir);
+
+    // If we couldn't find a device with that vendor ID and device ID, complain
+    if (list.empty()) throwRuntime("No PCI device found for vendor=0x%X, device=0x%X", vendorID, deviceID);
+
+    // If there aren't enough of them, complain
+    if (index < 0 || index >= list.size())
+    {
+        throwRuntime("PCI device %04x:%04x #%d not found (%d present)", vendorID, deviceID, index,
+                     (int)list.size());
+    }
+
+    // Hand the caller the device they asked for
+    return list[index];
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// findPciDevice() - Returns the PCI function at the specified bus/device/function
+//
+// Passed: bdf       = "0000:01:00.0", or "01:00.0" to mean PCI domain 0
+//         deviceDir = Name of the sysfs PCI device directory, or empty-string for the default
+//=================================================================================================
+pciFunction_t findPciDevice(string bdf, string deviceDir)
+{
+    pciFunction_t function;
+
+    // If the caller didn't specify a device-directory, use the default
+    if (deviceDir.empty()) deviceDir = "/sys/bus/pci/devices";
+
+    // If the caller left off the PCI domain, it's domain 0
+    if (count(bdf.begin(), bdf.end(), ':') == 1) bdf = "0000:" + bdf;
+
+    // Build the description of this function
+    function.bdf = bdf;
+    function.dir = deviceDir + "/" + bdf;
+
+    // If there's no such function, complain
+    if (!readIDs(function.dir, &function.vendorID, &function.deviceID))
+    {
+        throwRuntime("No PCI device found at %s", bdf.c_str());
+    }
+
+    // Hand the caller the description of the function
+    return function;
+}
+//=================================================================================================
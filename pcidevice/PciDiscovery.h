@@ -0,0 +1,27 @@
+//=================================================================================================
+// PciDiscovery.h - Defines routines for finding PCI functions by scanning sysfs directly
+//=================================================================================================
+#pragma once
+#include <string>
+#include <vector>
+
+// This describes one PCI function found in sysfs
+struct pciFunction_t
+{
+    std::string bdf;        // PCI bus/device/function, i.e. "0000:01:00.0"
+    std::string dir;        // The sysfs directory that describes this function
+    int         vendorID;   // PCI vendor ID
+    int         deviceID;   // PCI device ID
+};
+
+// Returns every PCI function in the system (sorted by BDF) in a single pass over sysfs
+std::vector<pciFunction_t> scanPciBus(std::string deviceDir = "");
+
+// Returns every PCI function (sorted by BDF) that has the specified vendor ID and device ID
+std::vector<pciFunction_t> findPciDevices(int vendorID, int deviceID, std::string deviceDir = "");
+
+// Returns the Nth function (counting from 0, in BDF order) with the specified vendor and device ID
+pciFunction_t findPciDevice(int vendorID, int deviceID, int index = 0, std::string deviceDir = "");
+
+// Returns the function at the specified BDF ("0000:01:00.0", or "01:00.0" for domain 0)
+pciFunction_t findPciDevice(std::string bdf, std::string deviceDir = "");
@@ -0,0 +1,130 @@
+//=================================================================================================
+// RegisterBlock.h - Defines zero-overhead accessors for a block of 32-bit AXI registers that
+//                   live at some offset inside a memory-mapped PCI resource (i.e., a BAR)
+//
+// Register numbers are template parameters, so every access compiles down to the same single
+// volatile load or store that hand-computed pointer arithmetic would produce.  Every access
+// goes through rd32()/wr32()/rd64()/wr64(), so there's exactly one place to add counting or
+// tracing of MMIO traffic
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include "PciDevice.h"
+#include "MmioTrace.h"
+
+class RegisterBlock
+{
+public:
+
+    // Default constructor - the block isn't usable until it's assigned from one that is
+    RegisterBlock() {base_ = nullptr;}
+
+    // Constructs a block of registers at "offset" bytes into a mapped resource
+    RegisterBlock(const PciDevice::resource_t& bar, uint32_t offset) {base_ = bar.baseAddr + offset;}
+    RegisterBlock(uint8_t* barAddr, uint32_t offset)                 {base_ = barAddr + offset;}
+
+    // Returns true if this block points to a mapped resource
+    bool        isValid() const {return base_ != nullptr;}
+
+    // Reads or writes the 32-bit register at index REG (i.e., at byte offset REG * 4)
+    template <uint32_t REG> uint32_t read() const                {return rd32(REG * 4);}
+    template <uint32_t REG> void     write(uint32_t value) const {wr32(REG * 4, value);}
+
+    // Reads or writes a 64-bit register at index REG with a single 8-byte access
+    template <uint32_t REG> uint64_t read64() const
+    {
+        static_assert(REG % 2 == 0, "64-bit registers must be 8-byte aligned");
+        return rd64(REG * 4);
+    }
+
+    template <uint32_t REG> void write64(uint64_t value) const
+    {
+        static_assert(REG % 2 == 0, "64-bit registers must be 8-byte aligned");
+        wr64(REG * 4, value);
+    }
+
+    // Reads a 64-bit value that the hardware presents as a pair of 32-bit registers.  If the
+    // high half changes while we're reading the low half, the low half wrapped in between and
+    // we read it again, so the result is never torn
+    template <uint32_t REG_H, uint32_t REG_L> uint64_t readHiLo() const
+    {
+        uint32_t hi = read<REG_H>();
+        while (true)
+        {
+            uint32_t lo    = read<REG_L>();
+            uint32_t hiNow = read<REG_H>();
+            if (hiNow == hi) return ((uint64_t)hi << 32) | lo;
+            hi = hiNow;
+        }
+    }
+
+    // Writes a 64-bit value to a pair of 32-bit registers, high half first
+    template <uint32_t REG_H, uint32_t REG_L> void writeHiLo(uint64_t value) const
+    {
+        write<REG_H>((uint32_t)(value >> 32));
+        write<REG_L>((uint32_t)(value & 0xFFFFFFFF));
+    }
+
+    // Reads or writes a register whose index isn't known until runtime
+    uint32_t    read(uint32_t reg) const                  {return rd32(reg * 4);}
+    void        write(uint32_t reg, uint32_t value) const {wr32(reg * 4, value);}
+
+    // Returns the userspace address of a register, for code that needs a raw pointer
+    volatile uint32_t* address(uint32_t reg) const {return (volatile uint32_t*)(base_ + reg * 4);}
+
+protected:
+
+    // Every register access in the program funnels through these four routines.  When the
+    // program is built with MMIO_TRACE, each of them records the access (see MmioTrace.h)
+    uint32_t rd32(uint32_t byteOffset) const
+    {
+        volatile uint32_t* reg = (volatile uint32_t*)(base_ + byteOffset);
+        uint32_t value = *reg;
+        MMIO_TRACE_READ(reg, value, 4);
+        return value;
+    }
+
+    void wr32(uint32_t byteOffset, uint32_t value) const
+    {
+        volatile uint32_t* reg = (volatile uint32_t*)(base_ + byteOffset);
+        MMIO_TRACE_WRITE(reg, value, 4);
+        *reg = value;
+    }
+
+    uint64_t rd64(uint32_t byteOffset) const
+    {
+        volatile uint64_t* reg = (volatile uint64_t*)(base_ + byteOffset);
+        uint64_t value = *reg;
+        MMIO_TRACE_READ(reg, value, 8);
+        return value;
+    }
+
+    void wr64(uint32_t byteOffset, uint64_t value) const
+    {
+        volatile uint64_t* reg = (volatile uint64_t*)(base_ + byteOffset);
+        MMIO_TRACE_WRITE(reg, value, 8);
+        *reg = value;
+    }
+
+    // Userspace address of the first register in the block
+    uint8_t*    base_;
+};
+
+
+//=================================================================================================
+// RegisterBlockAt - A block of registers whose offset inside the resource is fixed at compile time
+//=================================================================================================
+template <uint32_t OFFSET>
+class RegisterBlockAt : public RegisterBlock
+{
+public:
+
+    // The byte offset of this block within its resource
+    static const uint32_t offset = OFFSET;
+
+    // Constructors
+    RegisterBlockAt() {}
+    RegisterBlockAt(const PciDevice::resource_t& bar) : RegisterBlock(bar, OFFSET) {}
+    RegisterBlockAt(uint8_t* barAddr)                 : RegisterBlock(barAddr, OFFSET) {}
+};
+//=================================================================================================
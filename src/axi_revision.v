@@ -6,17 +6,25 @@
 //   Date     Who   Ver  Changes
 //====================================================================================
 // 26-Jul-22  DWW  1000  Initial creation
+// 14-Oct-26  ---  1001  Added the clock-rate registers
 //====================================================================================
 
 /*
 
     This module serves as a simple AXI4-Lite slave for reportion build version:
 
-    On the AXI4-lite slave interface, there are four 32-bit registers:
+    On the AXI4-lite slave interface, there are eight 32-bit registers:
        Offset 0x00 : Read-only = Major Revision
        Offset 0x04 : Read-only = Minor Revision
        Offset 0x08 : Read-only = Build Number
        Offset 0x0C : Read-only = Build Date
+       Offset 0x10 : Read-only = 0x434C4B53 ("CLKS"), meaning the clock-rate registers exist
+       Offset 0x14 : Read-only = Clock rate (in kHz) of the core at BAR0 offset 0x1000
+       Offset 0x18 : Read-only = Clock rate (in kHz) of the core at BAR0 offset 0x2000
+       Offset 0x1C : Read-only = Clock rate (in kHz) of the core at BAR0 offset 0x3000
+
+    A clock rate of 0 means the rate isn't known.  Bitstreams built before the clock-rate
+    registers existed only decode 4 address bits, so offset 0x10 reads as the major revision
 */
 
 
@@ -29,7 +37,13 @@
 module axi_revision#
 (
     parameter integer S_AXI_DATA_WIDTH   = 32,
-    parameter integer S_AXI_ADDR_WIDTH   =  4
+    parameter integer S_AXI_ADDR_WIDTH   =  5,
+
+    // The clock rates (in kHz) of the cores in the first three 4K slots after this one.  These
+    // must match the clocks those cores are driven by in the block design
+    parameter integer SLOT1_CLOCK_KHZ    = 250000,
+    parameter integer SLOT2_CLOCK_KHZ    = 266500,
+    parameter integer SLOT3_CLOCK_KHZ    = 0
 )
 (
     input wire  AXI_ACLK,
@@ -208,6 +222,12 @@ module axi_revision#
     localparam REG_MINOR = 1;
     localparam REG_BUILD = 2;
     localparam REG_DATE  = 3;
+    localparam REG_CLKS  = 4;
+    localparam REG_SLOT1 = 5;
+    localparam REG_SLOT2 = 6;
+    localparam REG_SLOT3 = 7;
+
+    localparam CLOCK_MAGIC = 32'h434C4B53;
    
     //=========================================================================================================
     // State machine that handles AXI master reads of our AXI4-Lite slave registers
@@ -230,6 +250,10 @@ module axi_revision#
                 REG_MINOR:  s_axi_rdata <= VERSION_MINOR;
                 REG_BUILD:  s_axi_rdata <= VERSION_BUILD;
                 REG_DATE:   s_axi_rdata <= VERSION_DATE;
+                REG_CLKS:   s_axi_rdata <= CLOCK_MAGIC;
+                REG_SLOT1:  s_axi_rdata <= SLOT1_CLOCK_KHZ;
+                REG_SLOT2:  s_axi_rdata <= SLOT2_CLOCK_KHZ;
+                REG_SLOT3:  s_axi_rdata <= SLOT3_CLOCK_KHZ;
             endcase
         end
     end
@@ -1,13 +1,14 @@
 
 //================================================================================================
-//    Date         Version  Who  Changes
+//    Date         Version  Who    Changes
 // -----------------------------------------------------------------------------------------------
-// 06-Aug-2022    1.0.0000  DWW  Initial creation
+// 06-Aug-2022    1.0.0000  DWW    Initial creation
+// 14-Oct-2026    1.0.0001  agent  axi_revision reports the measure_bw clock rates
 //================================================================================================
 localparam VERSION_MAJOR = 1;
 localparam VERSION_MINOR = 0;
-localparam VERSION_BUILD = 0;
+localparam VERSION_BUILD = 1;
 
-localparam VERSION_MONTH = 8;
-localparam VERSION_DAY   = 6;
-localparam VERSION_YEAR  = 2022;
+localparam VERSION_MONTH = 10;
+localparam VERSION_DAY   = 14;
+localparam VERSION_YEAR  = 2026;